@@ -0,0 +1,38 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#ifndef ARP_PROXY_H
+#define ARP_PROXY_H
+
+
+#include "n2n.h"
+
+
+int arp_proxy_init (arp_proxy_t *proxy, uint32_t size, uint32_t ttl);
+
+void arp_proxy_free (arp_proxy_t *proxy);
+
+void arp_proxy_learn (arp_proxy_t *proxy, uint8_t version, const uint8_t *addr, const n2n_mac_t mac, uint8_t is_router, time_t now);
+
+void arp_proxy_snoop (arp_proxy_t *proxy, const uint8_t *frame, size_t len, time_t now);
+
+int arp_proxy_answer (arp_proxy_t *proxy, const uint8_t *frame, size_t len, uint8_t *reply, size_t reply_size, time_t now);
+
+
+#endif // ARP_PROXY_H
@@ -0,0 +1,42 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#ifndef EDGE_PEER_CACHE_H
+#define EDGE_PEER_CACHE_H
+
+
+#include "n2n.h"
+
+
+/* called for each peer read from the cache */
+typedef void (*edge_peer_cache_restore_cb) (n2n_edge_t *eee,
+                                            const n2n_mac_t mac,
+                                            const n2n_sock_t *sock,
+                                            const n2n_ip_subnet_t *dev_addr,
+                                            const n2n_desc_t *dev_desc,
+                                            uint16_t timeout,
+                                            uint64_t last_valid_time_stamp);
+
+
+int edge_peer_cache_write (n2n_edge_t *eee, time_t now);
+
+int edge_peer_cache_load (n2n_edge_t *eee, time_t now, edge_peer_cache_restore_cb restore);
+
+
+#endif // EDGE_PEER_CACHE_H
@@ -0,0 +1,51 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+
+#ifndef HOLE_PUNCH_H
+#define HOLE_PUNCH_H
+
+
+#include "n2n.h"
+
+
+typedef void (*hole_punch_send_f) (void *ctx, const n2n_mac_t mac, const n2n_sock_t *sock, uint8_t type, uint32_t cookie);
+
+void hole_punch_init (hole_punch_t *hp, const n2n_mac_t mac, uint32_t nonce);
+
+int hole_punch_add (hole_punch_t *hp, const n2n_sock_t *sock, uint8_t type);
+
+int hole_punch_predict (hole_punch_t *hp, const n2n_sock_t *reflexive, int delta);
+
+void hole_punch_start (hole_punch_t *hp);
+
+int hole_punch_probe (hole_punch_t *hp, uint64_t now, hole_punch_send_f send, void *ctx);
+
+int hole_punch_probe_now (hole_punch_t *hp, int i, uint64_t now, hole_punch_send_f send, void *ctx);
+
+int hole_punch_answer (hole_punch_t *hp, uint32_t cookie, const n2n_sock_t *from, uint64_t now);
+
+int hole_punch_nominate (const hole_punch_t *hp, uint64_t now);
+
+int hole_punch_delta (const hole_punch_t *hp, int i);
+
+uint64_t hole_punch_due (const hole_punch_t *hp);
+
+
+#endif // HOLE_PUNCH_H
@@ -0,0 +1,42 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#ifndef MAC_TABLE_H
+#define MAC_TABLE_H
+
+
+#include "n2n.h"
+
+
+uint64_t hash_mix (uint64_t h);
+
+void* hash_array_alloc (uint32_t size, size_t entry_size, uint32_t *mask, uint64_t *seed);
+
+void mac_table_init (mac_table_t *table);
+
+void mac_table_free (mac_table_t *table);
+
+struct peer_info* mac_table_find (const mac_table_t *table, const n2n_mac_t mac);
+
+int mac_table_add (mac_table_t *table, const n2n_mac_t mac, struct peer_info *peer);
+
+int mac_table_remove (mac_table_t *table, const n2n_mac_t mac);
+
+
+#endif // MAC_TABLE_H
@@ -0,0 +1,38 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#ifndef MCAST_SNOOP_H
+#define MCAST_SNOOP_H
+
+
+#include "n2n.h"
+
+
+int mcast_snoop_prunable (const n2n_mac_t mac);
+
+int mcast_snoop_report (mcast_snoop_t *snoop, const uint8_t *frame, size_t len, time_t now);
+
+int mcast_snoop_expire (mcast_snoop_t *snoop, time_t now);
+
+size_t mcast_snoop_igmp_query (uint8_t *buf, size_t size, const n2n_mac_t querier);
+
+size_t mcast_snoop_mld_query (uint8_t *buf, size_t size, const n2n_mac_t querier);
+
+
+#endif // MCAST_SNOOP_H
@@ -147,6 +147,17 @@
 #include "n2n_regex.h"
 #include "sn_selection.h"
 #include "network_traffic_filter.h"
+#include "timer_wheel.h"
+#include "mac_table.h"
+#include "peer_pool.h"
+#include "sn_snapshot.h"
+#include "token_bucket.h"
+#include "tx_queue.h"
+#include "hole_punch.h"
+#include "query_cache.h"
+#include "edge_peer_cache.h"
+#include "arp_proxy.h"
+#include "mcast_snoop.h"
 
 /* ************************************** */
 
@@ -211,6 +222,7 @@ int sock_equal (const n2n_sock_t * a,
 /* Header encryption */
 uint64_t time_stamp (void);
 uint64_t initial_time_stamp (void);
+uint64_t time_usec (void);
 int time_stamp_verify_and_update (uint64_t stamp, uint64_t * previous_stamp, int allow_jitter);
 
 /* Operations on peer_info lists. */
@@ -218,6 +230,8 @@ size_t purge_peer_list (struct peer_info ** peer_list,
                         time_t purge_before);
 size_t clear_peer_list (struct peer_info ** peer_list);
 size_t purge_expired_registrations (struct peer_info ** peer_list, time_t* p_last_purge, int timeout);
+void arm_peer_expiry (n2n_timer_wheel_t *wheel, struct peer_info *peer, time_t now);
+size_t purge_expired_peers (n2n_timer_wheel_t *wheel, mac_table_t *index, struct peer_info ** peer_list, time_t now);
 
 /* Edge conf */
 void edge_init_conf_defaults (n2n_edge_conf_t *conf);
@@ -245,12 +259,18 @@ int quick_edge_init (char *device_name, char *community_name,
                      char *supernode_ip_address_port,
                      int *keep_on_running);
 int comm_init (struct sn_community *comm, char *cmn);
+int sn_community_add (n2n_sn_t *sss, struct sn_community *comm);
+int sn_community_add_with_id (n2n_sn_t *sss, struct sn_community *comm, uint32_t id);
+void sn_community_del (n2n_sn_t *sss, struct sn_community *comm);
+struct sn_community* sn_community_by_id (const n2n_sn_t *sss, uint32_t id);
+int community_allowed_by_rules (n2n_sn_t *sss, const char *community);
 int sn_init (n2n_sn_t *sss);
 void sn_term (n2n_sn_t *sss);
 int supernode2sock (n2n_sock_t * sn, const n2n_sn_name_t addrIn);
 struct peer_info* add_sn_to_list_by_mac_or_sock (struct peer_info **sn_list, n2n_sock_t *sock, n2n_mac_t *mac, int *skip_add);
 int run_sn_loop (n2n_sn_t *sss, int *keep_running);
 int assign_one_ip_subnet (n2n_sn_t *sss, struct sn_community *comm);
+int subnet_available (n2n_sn_t *sss, struct sn_community *comm, uint32_t net_id, uint32_t mask);
 const char* compression_str (uint8_t cmpr);
 const char* transop_str (enum n2n_transform tr);
 
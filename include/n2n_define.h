@@ -28,7 +28,8 @@
 #define MSG_TYPE_FEDERATION                 9
 #define MSG_TYPE_PEER_INFO                  10
 #define MSG_TYPE_QUERY_PEER                 11
-#define MSG_TYPE_MAX_TYPE                   11
+#define MSG_TYPE_BROADCAST                  12
+#define MSG_TYPE_MAX_TYPE                   12
 
 /* Max available space to add supernodes' informations (sockets and MACs) in REGISTER_SUPER_ACK
  * Field sizes of REGISTER_SUPER_ACK as used in encode/decode fucntions in src/wire.c
@@ -41,6 +42,21 @@
 #define PURGE_REGISTRATION_FREQUENCY     30
 #define RE_REG_AND_PURGE_FREQUENCY       10
 #define REGISTRATION_TIMEOUT             60
+#define REMOTE_EDGE_ABSENT_TIMEOUT       10 /* sec, packets to an edge not found in the federation get dropped rather than broadcast again */
+
+/* Timer wheel: TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SIZE slots each, one tick per second,
+ * i.e. 64 sec, ~68 min and ~73 h spans; later deadlines are parked in the outermost level */
+#define TIMER_WHEEL_BITS                 6
+#define TIMER_WHEEL_SIZE                 (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK                 (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS               3
+
+/* MAC table: control bytes are probed in groups, the table grows beyond a load of 7/8 */
+#define MAC_TABLE_GROUP_SIZE             16
+#define MAC_TABLE_MIN_CAPACITY           MAC_TABLE_GROUP_SIZE
+
+/* Peer pool: peer entries are carved from slabs of this many hot and cold records */
+#define PEER_POOL_SLAB_SIZE              256
 
 #define SOCKET_TIMEOUT_INTERVAL_SECS     10
 #define REGISTER_SUPER_INTERVAL_DFL      20 /* sec, usually UDP NAT entries in a firewall expire after 30 seconds */
@@ -57,7 +73,48 @@
 #define IFACE_UPDATE_INTERVAL            (30) /* sec. How long it usually takes to get an IP lease. */
 #define TRANSOP_TICK_INTERVAL            (10) /* sec */
 
+#define SN_COMMUNITY_IDS_MIN_CAPACITY    16 /* initial number of slots for interned community ids */
+#define SN_COMMUNITY_IDS_MAX_RESTORE     (1 << 20) /* highest community id to be taken over from a snapshot */
 #define SORT_COMMUNITIES_INTERVAL        90 /* sec. until supernode sorts communities' hash list again */
+#define SN_COMMUNITY_HOMES_MAX           8  /* max number of supernodes a community can be homed on */
+#define SN_SNAPSHOT_INTERVAL             30 /* sec. until supernode writes its state snapshot again if changed */
+#define SN_SNAPSHOT_REFRESH_INTERVAL     300 /* sec. until supernode writes its state snapshot again anyway */
+#define SN_ACK_PAYLOAD_REFRESH_INTERVAL  5  /* sec. until supernode rebuilds the REGISTER_SUPER_ACK payload at the latest */
+#define SN_PEER_LIST_REFRESH_INTERVAL    5  /* sec. until supernode ranks a community's edges for peer list requests again */
+
+/* Supernode control plane admission (REGISTER_SUPER, UNREGISTER_SUPER, QUERY_PEER, REGISTER),
+ * the default rates in messages per second allow for that many edges behind a single source
+ * ip address, in a single community and overall, see --ctrl-rates */
+#define SN_CTRL_ADMISSION_TABLE_SIZE     4096 /* buckets per table */
+#define SN_CTRL_MSGS_PER_EDGE            4    /* control messages an edge sends per registration interval */
+#define SN_CTRL_RATE_FOR(edges)          ((edges) * SN_CTRL_MSGS_PER_EDGE / REGISTER_SUPER_INTERVAL_DFL)
+#define SN_CTRL_RATE_PER_SOURCE          SN_CTRL_RATE_FOR(20000)
+#define SN_CTRL_RATE_PER_COMMUNITY       SN_CTRL_RATE_FOR(100000)
+#define SN_CTRL_RATE_TOTAL               SN_CTRL_RATE_FOR(1000000)
+#define SN_CTRL_BURST_SECS               5    /* buckets hold that many seconds' worth of messages */
+
+#define SN_NAT_PROBES_MAX                16384 /* delayed PING answers a supernode holds at most */
+
+/* Edge holding queue for frames sent while registration is in flight */
+#define TX_QUEUE_SIZE                    256 /* frames overall ... */
+#define TX_QUEUE_PER_DEST                16  /* ... and per destination mac */
+#define TX_QUEUE_WINDOW_DFL              150 /* ms a frame may be held before it is relayed through the supernode */
+#define TX_QUEUE_WINDOW_MAX              1000
+
+/* Edge connectivity checks, REGISTERs probing the candidate sockets of a new peer */
+#define HOLE_PUNCH_CANDIDATES            24  /* candidates per peer at most */
+#define HOLE_PUNCH_PREDICT               8   /* predicted ports on either side of the reflexive one */
+#define HOLE_PUNCH_DELTA_MAX             64  /* largest port allocation step to learn */
+#define HOLE_PUNCH_BURST                 4   /* probes sent at once ... */
+#define HOLE_PUNCH_PACING                5   /* ... every ms */
+#define HOLE_PUNCH_ROUNDS                3   /* rounds over the unanswered candidates ... */
+#define HOLE_PUNCH_ROUND_INTERVAL        200 /* ... starting every ms */
+#define HOLE_PUNCH_SETTLE                20  /* ms after the first answer to wait for one with a lower round trip time */
+
+#define HOLE_PUNCH_CAND_REFLEXIVE        1   /* peer socket as seen by the supernode */
+#define HOLE_PUNCH_CAND_PREDICTED        2   /* port predicted from the reflexive one */
+#define HOLE_PUNCH_CAND_LAN              3   /* local multicast group */
+#define HOLE_PUNCH_CAND_PEER             4   /* socket a direct REGISTER of the peer came from */
 
 #define ETH_FRAMESIZE 14
 #define IP4_SRCOFFSET 12
@@ -107,6 +164,34 @@ enum sn_purge{SN_PURGEABLE = 0, SN_UNPURGEABLE = 1};
 #define N2N_EDGE_SN_HOST_SIZE     48
 #define N2N_EDGE_NUM_SUPERNODES   2
 #define N2N_EDGE_SUP_ATTEMPTS     3             /* Number of failed attmpts before moving on to next supernode. */
+#define N2N_KEEPALIVE_MISSED      3             /* Keepalives a registration survives to miss if longer than REGISTRATION_TIMEOUT. */
+#define N2N_NAT_PROBE_DELAY_MIN   5             /* NAT lifetime discovery: sec, shortest binding lifetime probed ... */
+#define N2N_NAT_PROBE_DELAY_MAX   300           /* ... and longest one, thus also the longest keepalive interval. */
+#define N2N_NAT_PROBE_GRACE       3             /* NAT lifetime discovery: sec to wait for the delayed answer beyond the delay. */
+#define N2N_NAT_PROBE_RESOLUTION  5             /* NAT lifetime discovery: sec, the search stops once the lifetime is known that precisely. */
+#define N2N_NAT_PROBE_RETRY       60            /* NAT lifetime discovery: sec to wait before retrying a probe the supernode did not answer at all ... */
+#define N2N_NAT_PROBE_RECHECK     3600          /* ... and before probing a found lifetime again. */
+#define N2N_QUERY_CACHE_SIZE      1024          /* Peer queries: MAC addresses the backoff is kept for ... */
+#define N2N_QUERY_BACKOFF_MAX     160           /* ... and sec, longest pause between queries for a MAC not reached. */
+#define N2N_QUERY_BATCH_MAX       16            /* Peer queries: MACs per QUERY_PEER ... */
+#define N2N_QUERY_BATCH_WINDOW    10            /* ... and ms to wait for further ones. */
+#define N2N_PEER_LIST_PAGE        40            /* Peer list: peers per PEER_INFO, 40 MACs with IPv6 sockets keep it below DEFAULT_MTU ... */
+#define N2N_PEER_LIST_MAX         120           /* ... and most recently active peers offered in total. */
+#define N2N_ARP_PROXY_SIZE        4096          /* ARP proxy: IP addresses bindings are kept for ... */
+#define N2N_ARP_PROXY_TTL         300           /* ... and sec until a binding not seen again expires. */
+#define N2N_PEER_CACHE_INTERVAL   60            /* Peer cache: sec until the edge writes it again ... */
+#define N2N_PEER_CACHE_MAX_AGE    900           /* ... sec since a peer was last seen it still gets restored ... */
+#define N2N_PEER_CACHE_MAX_PEERS  4096          /* ... and peers kept at most. */
+#define N2N_BCAST_P2P_MAX         16            /* Broadcast replication: peers an edge sends a broadcast to directly at most. */
+#define N2N_MCAST_GROUPS_MAX      32            /* Multicast snooping: groups an edge announces at most ... */
+#define N2N_MCAST_QUERY_INTERVAL  125           /* ... sec between the general queries sent into the TAP device ... */
+#define N2N_MCAST_MEMBERSHIP      260           /* ... sec a group not reported again is kept ... */
+#define N2N_MCAST_LEAVE_WAIT      2             /* ... and sec after a leave for other members to report. */
+#define N2N_EDGE_REVAL_PROBES     3             /* REGISTERs sent to an idle known peer, one per second, before relaying through the supernode. */
+#define N2N_EDGE_FAILOVER_MISSED  3             /* Fast failover: keepalives the current supernode may leave unanswered. */
+#define N2N_EDGE_FAILOVER_MIN     20            /* Fast failover: ms, shortest keepalive interval ... */
+#define N2N_EDGE_FAILOVER_MAX     1000          /* ... and longest one */
+#define N2N_EDGE_FAILOVER_FRESH   2             /* Fast failover: sec, a standby supernode must have answered within to be failed over to. */
 #define N2N_PATHNAME_MAXLEN       256
 #define N2N_EDGE_MGMT_PORT        5644
 #define N2N_SN_MGMT_PORT          5645
@@ -124,6 +209,7 @@ enum skip_add{SN_ADD = 0, SN_ADD_SKIP = 1, SN_ADD_ADDED = 2};
 
 #define N2N_SN_LPORT_DEFAULT 7654
 #define N2N_SN_PKTBUF_SIZE   2048
+#define N2N_SN_PKTBUF_HEADROOM 32  /* free bytes in front of a received packet, lets the supernode grow a header in place */
 
 
 /* The way TUNTAP allocated IP. */
@@ -144,6 +230,8 @@ enum skip_add{SN_ADD = 0, SN_ADD_SKIP = 1, SN_ADD_ADDED = 2};
 /* ************************************** */
 
 #define N2N_PKT_VERSION            3
+#define N2N_PKT_VERSION_COMPACT    4  /* PACKET with community id instead of name, see encode_PACKET_compact() */
+#define N2N_COMPACT_COMMON_SIZE    8  /* version, ttl, flags, community id */
 #define N2N_DEFAULT_TTL            2  /* can be forwarded twice at most */
 #define N2N_COMMUNITY_SIZE         16
 #define N2N_MAC_SIZE               6
@@ -153,6 +241,20 @@ enum skip_add{SN_ADD = 0, SN_ADD_SKIP = 1, SN_ADD_ADDED = 2};
 #define N2N_SOCKBUF_SIZE           64  /* string representation of INET or INET6 sockets */
 
 #define N2N_MULTICAST_PORT         1968
+
+/* features an edge can ask for in REGISTER_SUPER */
+#define N2N_FEATURE_COMPACT_PACKET 0x0001
+#define N2N_FEATURE_KEEPALIVE      0x0002  /* the edge announces its registration interval */
+#define N2N_FEATURE_QUERY_BATCH    0x0004  /* QUERY_PEER may carry several target MACs */
+#define N2N_FEATURE_PEER_LIST      0x0008  /* the supernode hands out the community's peers page by page */
+#define N2N_FEATURE_MCAST_SNOOP    0x0010  /* the edge announces the multicast groups it wants to receive */
+#define N2N_FEATURE_BCAST_P2P      0x0020  /* the edge sends broadcasts to its direct peers itself, see BROADCAST */
+
+/* PEER_INFO aflags */
+#define N2N_AFLAGS_NAT_PROBE_SCHEDULED 0x0001  /* answer to a delayed ping, the delayed answer will follow */
+#define N2N_AFLAGS_NAT_PROBE           0x0002  /* the delayed answer */
+#define N2N_AFLAGS_PEER_LIST           0x0004  /* a page of the peer list */
+#define N2N_AFLAGS_PEER_LIST_MORE      0x0008  /* further pages follow */
 #define N2N_MULTICAST_GROUP        "224.0.0.68"
 
 #ifdef WIN32
@@ -163,6 +265,14 @@ enum skip_add{SN_ADD = 0, SN_ADD_SKIP = 1, SN_ADD_ADDED = 2};
 
 #define SN_SELECTION_CRITERION_DATA_TYPE    uint32_t
 #define SN_SELECTION_CRITERION_BUF_SIZE     14
+#define SN_SELECTION_CRITERION_NOT_HOME     (1 << 28) /* added to the load reported by supernodes not homing the community */
+#define SN_SELECTION_CRITERION_HOME_RANK    (1 << 20) /* added per rank to the load reported by the secondary homes */
+
+#define SN_SELECTION_STRATEGY_LOAD          1         /* edge connects to the least loaded supernode */
+#define SN_SELECTION_STRATEGY_RTT           2         /* edge connects to the supernode with the lowest (smoothed) round trip time */
+#define SN_SELECTION_RTT_HYSTERESIS         5000      /* microseconds another supernode needs to be faster than the current one ... */
+#define SN_SELECTION_RTT_HYSTERESIS_SHIFT   3         /* ... or 1/8 of the current one's rtt, whichever is more */
+#define SN_SELECTION_RTT_SAMPLE_MAX         10000000  /* microseconds, longer samples are considered bogus */
 
 #define N2N_TRANSFORM_ID_USER_START         64
 #define N2N_TRANSFORM_ID_MAX                65535
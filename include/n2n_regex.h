@@ -69,6 +69,18 @@ int re_matchp (re_t pattern, const char* text, int* matchlenght);
 int  re_match (const char* pattern, const char* text, int* matchlenght);
 
 
+/* Compile a set of regex_t-arrays into a single automaton. */
+re_set_t re_set_compile (const re_t* patterns, int num_patterns);
+
+
+/* Check if any pattern of the set fully matches text, returns 1 if so, 0 otherwise. */
+int re_set_matchp (re_set_t set, const char* text);
+
+
+/* Free a compiled set. */
+void re_set_free (re_set_t set);
+
+
 #ifdef __cplusplus
 }
 #endif
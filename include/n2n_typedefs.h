@@ -246,7 +246,8 @@ typedef enum n2n_pc {
     n2n_register_super_nak = 8,     /* NAK from supernode to edge - registration refused */
     n2n_federation =         9,     /* Not used by edge */
     n2n_peer_info =          10,    /* Send info on a peer from sn to edge */
-    n2n_query_peer =         11     /* ask supernode for info on a peer */
+    n2n_query_peer =         11,    /* ask supernode for info on a peer */
+    n2n_broadcast =          12     /* broadcast PACKET partly sent peer-to-peer already */
 } n2n_pc_t;
 
 #define N2N_FLAGS_OPTIONS                0x0080
@@ -344,6 +345,10 @@ typedef struct n2n_REGISTER_SUPER {
     n2n_ip_subnet_t    dev_addr;    /**< IP address of the tuntap adapter. */
     n2n_desc_t         dev_desc;    /**< Hint description correlated with the edge */
     n2n_auth_t         auth;        /**< Authentication scheme and tokens */
+    uint16_t           features;    /**< N2N_FEATURE_* asked for, optional (omitted if zero) */
+    uint16_t           keepalive;   /**< Seconds between the edge's registrations, only with N2N_FEATURE_KEEPALIVE */
+    uint8_t            num_mcast_groups; /**< Multicast MACs to send to the edge, only with N2N_FEATURE_MCAST_SNOOP */
+    n2n_mac_t          mcast_groups[N2N_MCAST_GROUPS_MAX];
 } n2n_REGISTER_SUPER_t;
 
 
@@ -362,6 +367,8 @@ typedef struct n2n_REGISTER_SUPER_ACK {
     uint8_t            num_sn;      /**< Number of supernodes that were send
                                       * even if we cannot store them all. If
                                       * non-zero then sn_bak is valid. */
+    uint32_t           community_id; /**< Id to use in compact PACKETs, optional (omitted if not granted and no features follow) */
+    uint16_t           features;    /**< N2N_FEATURE_* asked for and supported, optional (omitted if zero) */
 } n2n_REGISTER_SUPER_ACK_t;
 
 
@@ -393,6 +400,10 @@ typedef struct n2n_PEER_INFO {
     n2n_mac_t                        mac;
     n2n_sock_t                       sock;
     SN_SELECTION_CRITERION_DATA_TYPE data;
+    uint8_t                          page;       /**< N2N_AFLAGS_PEER_LIST only: page of the peer list ... */
+    uint8_t                          num_peers;  /**< ... and the peers on it, most recently active first */
+    n2n_mac_t                        peer_macs[N2N_PEER_LIST_PAGE];
+    n2n_sock_t                       peer_socks[N2N_PEER_LIST_PAGE];
 } n2n_PEER_INFO_t;
 
 
@@ -400,31 +411,197 @@ typedef struct n2n_QUERY_PEER {
     n2n_mac_t                     srcMac;
     n2n_sock_t                    sock;
     n2n_mac_t                     targetMac;
+    uint16_t                      delay;      /**< PING only: seconds until answering a second time, optional (omitted if zero and no targets follow) */
+    uint8_t                       num_targets; /**< Further MACs looked up, optional (omitted if zero) */
+    n2n_mac_t                     targets[N2N_QUERY_BATCH_MAX];
+    uint8_t                       page;       /**< Peer list requests only: page asked for, optional (omitted if zero) */
 } n2n_QUERY_PEER_t;
 
+
+/* Linked with n2n_broadcast in n2n_pc_t. Only from edge to supernode, followed by the PACKET the
+ * edge sent to the excluded peers directly already. */
+typedef struct n2n_BROADCAST {
+    uint8_t                       num_excluded;
+    n2n_mac_t                     excluded[N2N_BCAST_P2P_MAX]; /**< Peers the supernode shall not send it to */
+} n2n_BROADCAST_t;
+
 typedef struct n2n_buf n2n_buf_t;
 
+
+/* Timer wheel, see timer_wheel.c */
+typedef struct n2n_timer {
+    struct n2n_timer   *next;
+    struct n2n_timer   **pprev;                 /* NULL if not armed */
+    time_t             expires;
+} n2n_timer_t;
+
+typedef struct n2n_timer_wheel {
+    time_t             now;                     /* next tick to be processed */
+    n2n_timer_t        *slot[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+} n2n_timer_wheel_t;
+
+typedef void (*n2n_timer_cb_t) (n2n_timer_t *timer, void *data);
+
+
+/* Open addressing MAC table, see mac_table.c */
+typedef struct mac_table_slot {
+    uint64_t           key;                     /* MAC packed into the lower 48 bits */
+    struct peer_info   *peer;
+} mac_table_slot_t;
+
+typedef struct mac_table {
+    uint8_t            *ctrl;                   /* per slot: empty, deleted or 7 bits of the hash */
+    mac_table_slot_t   *slots;
+    uint32_t           capacity;                /* power of two, multiple of MAC_TABLE_GROUP_SIZE */
+    uint32_t           size;                    /* live entries */
+    uint32_t           deleted;                 /* tombstones */
+    uint64_t           seed[2];                 /* key of the hash function */
+} mac_table_t;
+
+/* Token buckets for rate limiting, see token_bucket.c */
+typedef struct n2n_token_bucket {
+    uint32_t           tokens;
+    uint32_t           last_refill;             /* lower 32 bits of the time of the last refill */
+} n2n_token_bucket_t;
+
+typedef struct token_bucket_entry {
+    uint64_t           key;
+    n2n_token_bucket_t bucket;
+} token_bucket_entry_t;
+
+typedef struct token_bucket_table {
+    token_bucket_entry_t *entries;              /* power of two of them */
+    uint32_t           mask;
+    uint32_t           rate;                    /* tokens per second */
+    uint32_t           burst;                   /* bucket size */
+    uint64_t           seed;                    /* key of the hash function */
+} token_bucket_table_t;
+
+/* Negative cache for peer queries, see query_cache.c */
+typedef struct query_cache_entry {
+    n2n_mac_t          mac;
+    uint16_t           backoff;                 /* seconds to pause after the next query */
+    uint32_t           next_query;              /* lower 32 bits of the time the next query may be sent */
+} query_cache_entry_t;
+
+typedef struct query_cache {
+    query_cache_entry_t *entries;               /* power of two of them */
+    uint32_t           mask;
+    uint64_t           seed;                    /* key of the hash function */
+} query_cache_t;
+
+/* ARP and IPv6 neighbor discovery proxy, see arp_proxy.c */
+typedef struct arp_proxy_entry {
+    uint8_t            addr[IPV6_SIZE];         /* IPv4 ones in the first four bytes, network byte order */
+    n2n_mac_t          mac;
+    uint8_t            version;                 /* 4 or 6, 0 if unused */
+    uint8_t            flags;
+    uint32_t           expires;                 /* lower 32 bits of the time the binding expires */
+} arp_proxy_entry_t;
+
+typedef struct arp_proxy {
+    arp_proxy_entry_t  *entries;                /* power of two of them */
+    uint32_t           mask;
+    uint32_t           ttl;                     /* seconds a binding is kept */
+    uint64_t           seed;                    /* key of the hash function */
+} arp_proxy_t;
+
+/* IGMP and MLD snooping, see mcast_snoop.c */
+typedef struct mcast_group {
+    n2n_mac_t          mac;
+    uint32_t           expires;                 /* lower 32 bits of the time the membership expires */
+} mcast_group_t;
+
+typedef struct mcast_snoop {
+    mcast_group_t      groups[N2N_MCAST_GROUPS_MAX];
+    uint8_t            num_groups;
+    uint8_t            overflow;                /* a group did not fit, receive all of them */
+    uint8_t            query_due;               /* a member left, ask for remaining ones */
+} mcast_snoop_t;
+
+/* Holding queue for outgoing frames, see tx_queue.c */
+typedef struct tx_queue_frame {
+    uint64_t           queued;                  /* time_usec() the frame got queued */
+    n2n_mac_t          dst;
+    uint16_t           len;
+    uint8_t            *data;
+} tx_queue_frame_t;
+
+typedef struct tx_queue {
+    tx_queue_frame_t   frames[TX_QUEUE_SIZE];   /* in order of arrival */
+    uint16_t           num;
+    uint8_t            flushing;                /* guards against flushing from within a flush */
+} tx_queue_t;
+
+/* Connectivity check towards a new peer, see hole_punch.c */
+typedef struct hole_punch_candidate {
+    n2n_sock_t         sock;                    /* where to send the probes */
+    n2n_sock_t         from;                    /* where the answer came from, the direct path to nominate */
+    uint64_t           sent;                    /* time_usec() of the latest probe, 0 if not probed yet */
+    uint32_t           rtt;                     /* round trip time in microseconds, 0 if not answered */
+    uint8_t            type;                    /* HOLE_PUNCH_CAND_* */
+} hole_punch_candidate_t;
+
+typedef struct hole_punch {
+    hole_punch_candidate_t cand[HOLE_PUNCH_CANDIDATES];
+    n2n_mac_t          mac;                     /* peer the check is for */
+    uint8_t            num;
+    uint8_t            next;                    /* next candidate to probe in the current round */
+    uint8_t            round;                   /* rounds started so far */
+    uint32_t           nonce;                   /* upper cookie bits of the probes, the lower ones name the candidate */
+    uint64_t           round_start;             /* time_usec() */
+    uint64_t           due;                     /* time_usec() the next probes are due */
+    uint64_t           answered;                /* time_usec() of the first answer, 0 if none */
+    n2n_sock_t         reflexive;               /* socket to predict ports next to ... */
+    int                delta;                   /* ... in steps of, 0 if none */
+    uint8_t            predicted;               /* set once the predicted ports got added */
+} hole_punch_t;
+
+
+/* peer data only needed for registration, authentication and management output */
+struct peer_info_cold {
+    n2n_desc_t                       dev_desc;
+    n2n_cookie_t                     last_cookie;
+    n2n_auth_t                       auth;
+    char                             *ip_addr;
+    uint64_t                         tx_queue_until; /* edge, pending peers: time_usec() up to which frames to it may be held */
+    hole_punch_t                     *hole_punch;    /* edge, pending peers: connectivity check, NULL if none */
+    uint32_t                         srtt;    /* supernodes: smoothed round trip time in microseconds, 0 if not measured yet */
+    uint32_t                         rttvar;  /* supernodes: round trip time variation in microseconds */
+    uint64_t                         ping_sent; /* supernodes: time_usec() the PING awaiting its answer was sent at, 0 if none */
+    n2n_mac_t                        *mcast_groups;    /* supernode: multicast MACs the edge announced, see mcast_snoop ... */
+    uint8_t                          num_mcast_groups; /* ... and their number */
+};
+
+/* peer data used on the forwarding path, the cold part is kept apart */
 struct peer_info {
     n2n_mac_t                        mac_addr;
+    uint8_t                          purgeable;
+    uint8_t                          compact_packets;  /* supernode: edge accepts compact PACKETs */
+    uint8_t                          mcast_snoop;      /* supernode: edge receives only the multicast groups it announced */
     n2n_ip_subnet_t                  dev_addr;
-    n2n_desc_t                       dev_desc;
     n2n_sock_t                       sock;
-    n2n_cookie_t                     last_cookie;
-    n2n_auth_t                       auth;
     int                              timeout;
-    uint8_t                          purgeable;
     time_t                           last_seen;
     time_t                           last_p2p;
     time_t                           last_sent_query;
     SN_SELECTION_CRITERION_DATA_TYPE selection_criterion;
+    uint8_t                          reval_probes;     /* edge: REGISTERs sent to revalidate the direct path of an idle known peer */
     uint64_t                         last_valid_time_stamp;
-    char                             *ip_addr;
+    n2n_timer_t                      expiry;  /* armed in the owning list's timer wheel */
+    struct peer_info_cold            *cold;   /* attached by peer_info_alloc() */
 
     UT_hash_handle     hh; /* makes this structure hashable */
 };
 
 typedef struct peer_info peer_info_t;
 
+typedef struct peer_pool_stats {
+    size_t             in_use;                  /* peer entries currently allocated */
+    size_t             capacity;                /* peer entries the slabs can hold */
+    size_t             bytes;                   /* memory taken by the slabs */
+} peer_pool_stats_t;
+
 typedef struct n2n_route {
     in_addr_t    net_addr;
     uint8_t      net_bitlen;
@@ -586,9 +763,16 @@ typedef struct n2n_edge_conf {
     uint8_t            allow_p2p;              /**< Allow P2P connection */
     uint8_t            sn_num;                 /**< Number of supernode addresses defined. */
     uint8_t            tos;                    /** TOS for sent packets */
+    uint8_t            sn_selection_strategy;  /**< Supernode selection by load or by round trip time, switchable at runtime. */
     char               *encrypt_key;
     int                register_interval;      /**< Interval for supernode registration, also used for UDP NAT hole punching. */
     int                register_ttl;           /**< TTL for registration packet when UDP NAT hole punching through supernode. */
+    int                failover_interval;      /**< Fast failover: ms between keepalives to the current and a standby supernode, 0 if disabled. */
+    int                tx_queue_window;        /**< ms frames may be held while registration or peer resolution is in flight, 0 if disabled. */
+    uint8_t            fixed_keepalive;        /**< Keep register_interval instead of following the NAT binding lifetime. */
+    char               *peer_cache_path;       /**< If set, known peers get saved to and restored from this file. */
+    uint8_t            arp_proxy;              /**< Answer ARP requests and neighbor solicitations for known addresses locally. */
+    uint8_t            mcast_snoop;            /**< Tell the supernode the multicast groups joined behind the TAP device to receive only these. */
     int                local_port;
     int                mgmt_port;
     n2n_auth_t         auth;
@@ -603,6 +787,28 @@ struct n2n_edge_stats {
     uint32_t rx_sup;
     uint32_t tx_sup_broadcast;
     uint32_t rx_sup_broadcast;
+    uint32_t sn_failover;         /* number of fast failovers to a standby supernode */
+    uint32_t sn_failover_last_ms; /* duration of the last one, from the last sign of life of the lost supernode to registration at the standby */
+    uint32_t sn_failover_max_ms;  /* duration of the longest one */
+    uint32_t tx_queued;           /* frames held while registration or peer resolution was in flight */
+    uint32_t tx_queue_p2p;        /* held frames sent directly once the peer got registered */
+    uint32_t tx_queue_relay;      /* held frames relayed through the supernode after waiting the full window */
+    uint32_t tx_queue_drop;       /* frames dropped, queue full or not registered with any supernode in time */
+    uint32_t p2p_attempts;        /* connectivity checks started towards new peers */
+    uint32_t p2p_established;     /* connectivity checks that nominated a direct path ... */
+    uint32_t p2p_reflexive;       /* ... answered at the peer socket seen by the supernode */
+    uint32_t p2p_predicted;       /* ... answered at a predicted port */
+    uint32_t p2p_lan;             /* ... answered via the local multicast group */
+    uint32_t p2p_peer;            /* ... answered at the socket a direct REGISTER of the peer came from */
+    uint32_t query_sent;          /* peers queried at the supernode ... */
+    uint32_t query_answered;      /* ... and answered with a PEER_INFO */
+    uint32_t query_backoff;       /* relay misses not queried as still backing off */
+    uint32_t query_msgs;          /* QUERY_PEER messages the queries were sent in */
+    uint32_t peer_list_peers;     /* peers registered with right away as found on the supernode's peer list */
+    uint32_t arp_proxy_answered;  /* ARP requests and neighbor solicitations answered locally ... */
+    uint32_t arp_proxy_missed;    /* ... and sent out as the address was not known */
+    uint32_t mcast_announced;     /* registrations sent early as the multicast groups changed */
+    uint32_t tx_p2p_broadcast;    /* broadcast copies sent to peers directly instead of via the supernode */
 };
 
 struct n2n_edge {
@@ -611,6 +817,8 @@ struct n2n_edge {
     /* Status */
     struct peer_info                 *curr_sn;                           /**< Currently active supernode. */
     uint8_t                          sn_wait;                            /**< Whether we are waiting for a supernode response. */
+    uint32_t                         compact_community_id;               /**< Id granted by the current supernode for compact PACKETs, 0 if none. */
+    uint16_t                         sn_features;                        /**< N2N_FEATURE_* supported by the current supernode. */
     size_t                           sup_attempts;                       /**< Number of remaining attempts to this supernode. */
     tuntap_dev                       device;                             /**< All about the TUNTAP device */
     n2n_trans_op_t                   transop;                            /**< The transop to use when encoding */
@@ -619,6 +827,33 @@ struct n2n_edge {
     void                             *user_data;                         /**< Can hold user data */
     uint64_t                         sn_last_valid_time_stamp;           /**< last valid time stamp from supernode */
     SN_SELECTION_CRITERION_DATA_TYPE sn_selection_criterion_common_data;
+    uint64_t                         sn_register_sent;                   /**< time_usec() the last REGISTER_SUPER was sent, for measuring rtt */
+    struct peer_info                 *keepalive_sn;                      /**< Fast failover: supernode the keepalive state refers to, compared only. */
+    uint64_t                         keepalive_sent;                     /**< Fast failover: time_usec() of the last keepalive. */
+    uint64_t                         sn_last_heard;                      /**< Fast failover: time_usec() anything arrived from the current supernode. */
+    uint64_t                         failover_since;                     /**< Fast failover: sn_last_heard of the lost supernode while failing over, else 0. */
+    struct peer_info                 *nat_probe_sn;                      /**< NAT lifetime discovery: supernode the state refers to, compared only. */
+    int                              nat_probe_sock;                     /**< NAT lifetime discovery: socket of the probe in flight, -1 if none. */
+    time_t                           nat_probe_time;                     /**< NAT lifetime discovery: when the probe in flight was sent, else when the next one is due. */
+    uint8_t                          nat_probe_scheduled;                /**< NAT lifetime discovery: the supernode acknowledged the probe in flight. */
+    uint16_t                         nat_probe_delay;                    /**< NAT lifetime discovery: binding lifetime in seconds the probe in flight tests. */
+    uint16_t                         nat_lifetime_lo;                    /**< NAT lifetime discovery: longest binding lifetime confirmed, 0 if none. */
+    uint16_t                         nat_lifetime_hi;                    /**< NAT lifetime discovery: shortest binding lifetime disproved, 0 if none. */
+    uint32_t                         standby_rr;                         /**< Fast failover: round-robin over standby candidates if none answers. */
+    tx_queue_t                       tx_queue;                           /**< Frames held while registration or peer resolution is in flight. */
+    uint64_t                         hole_punch_due;                     /**< time_usec() the next connectivity check step is due, 0 if none. */
+    int                              hole_punch_delta;                   /**< Port allocation step of the peers' NATs, learned from nominated predicted ports, 0 if none. */
+    query_cache_t                    query_cache;                        /**< Backoff of peer queries per MAC. */
+    arp_proxy_t                      arp_proxy;                          /**< IP to MAC bindings ARP requests get answered from locally. */
+    n2n_mac_t                        query_batch[N2N_QUERY_BATCH_MAX];   /**< Peers to query at the supernode in one QUERY_PEER ... */
+    uint8_t                          query_batch_num;                    /**< ... their number ... */
+    uint64_t                         query_batch_due;                    /**< ... and time_usec() the QUERY_PEER is due. */
+    uint8_t                          peer_list_page;                     /**< Peer list: next page to ask the supernode for ... */
+    uint8_t                          peer_list_done;                     /**< ... and whether the list has been fetched completely. */
+    mcast_snoop_t                    mcast_snoop;                        /**< Multicast snooping: groups joined behind the TAP device ... */
+    time_t                           mcast_query_sent;                   /**< ... when the last general query was sent into it, 0 if none ... */
+    time_t                           mcast_announced;                    /**< ... when the groups were last announced early ... */
+    uint8_t                          mcast_changed;                      /**< ... and whether the supernode has yet to learn about changed groups. */
 
     /* Sockets */
     n2n_sock_t                       supernode;
@@ -634,6 +869,9 @@ struct n2n_edge {
     /* Peers */
     struct peer_info *               known_peers;                        /**< Edges we are connected to. */
     struct peer_info *               pending_peers;                      /**< Edges we have tried to register with. */
+    n2n_timer_wheel_t                known_peers_expiry;                 /**< Expiry timers of known_peers. */
+    mac_table_t                      known_peers_index;                  /**< known_peers by MAC, used on the packet path. */
+    n2n_timer_wheel_t                pending_peers_expiry;               /**< Expiry timers of pending_peers. */
 
     /* Timers */
     time_t                           last_register_req;                  /**< Check if time to re-register with super*/
@@ -655,27 +893,84 @@ typedef struct sn_stats {
     size_t reg_super;      /* Number of REGISTER_SUPER requests received. */
     size_t reg_super_nak;  /* Number of REGISTER_SUPER requests declined. */
     size_t fwd;            /* Number of messages forwarded. */
+    size_t cut_through;    /* Number of PACKETs forwarded without going through the full processing (subset of fwd). */
     size_t broadcast;      /* Number of messages broadcast to a community. */
+    size_t mcast_pruned;   /* Number of multicast copies not sent to edges which did not join the group. */
+    size_t bcast_p2p;      /* Number of broadcast copies not sent to edges the sender reached directly. */
+    size_t fed_unicast;    /* Number of messages to remote edges sent to the one supernode they are located at. */
+    size_t fed_broadcast;  /* Number of messages to edges not located so far, broadcast to the federation. */
+    size_t fed_absent;     /* Number of messages to edges recently found absent from the federation, dropped. */
+    size_t ctrl_dropped;   /* Number of control messages (registrations, queries) dropped by admission control. */
+    size_t nat_probes;     /* Number of delayed PING answers sent to probe edges' NAT binding lifetime. */
     time_t last_fwd;       /* Time when last message was forwarded. */
     time_t last_reg_super; /* Time when last REGISTER_SUPER was received. */
 } sn_stats_t;
 
+/* A community's most recently seen edges, ranked for answering peer list requests */
+typedef struct sn_peer_list {
+    n2n_mac_t              macs[N2N_PEER_LIST_MAX + 1]; /* One more as the requesting edge gets left out. */
+    n2n_sock_t             socks[N2N_PEER_LIST_MAX + 1];
+    uint32_t               num;
+    time_t                 refresh_at;       /* Time to rebuild. */
+} sn_peer_list_t;
+
 struct sn_community {
     char            community[N2N_COMMUNITY_SIZE];
+    uint32_t        id;                     /* Interned id, dense and non-zero while in the list of communities. */
     uint8_t         is_federation;          /* if not-zero, then the current community is the federation of supernodes */
     uint8_t         purgeable;              /* indicates purgeable community (fixed-name, predetermined (-c parameter) communties usually are unpurgeable) */
     uint8_t         header_encryption;      /* Header encryption indicator. */
     he_context_t    *header_encryption_ctx; /* Header encryption cipher context. */
     he_context_t    *header_iv_ctx;         /* Header IV ecnryption cipher context, REMOVE as soon as seperate fields for checksum and replay protection available */
     struct          peer_info *edges;       /* Link list of registered edges. */
+    n2n_timer_wheel_t edges_expiry;         /* Expiry timers of edges. */
+    mac_table_t     edges_index;            /* Edges by MAC, used on the forwarding path. */
+    struct          peer_info *remote_edges; /* Edges located at federated supernodes (sock is the supernode's), or absent (no sock). */
+    n2n_timer_wheel_t remote_expiry;        /* Expiry timers of remote edges. */
+    mac_table_t     remote_index;           /* Remote edges by MAC. */
     int64_t         number_enc_packets;     /* Number of encrypted packets handled so far, required for sorting from time to time */
     n2n_ip_subnet_t auto_ip_net;            /* Address range of auto ip address service. */
+    sn_peer_list_t  *peer_list;             /* Ranked edges for peer list requests, NULL until the first one. */
 
     UT_hash_handle hh;                      /* makes this structure hashable */
 };
 
+typedef struct sn_community_stats {
+    size_t fwd;            /* Number of messages forwarded within the community. */
+    size_t broadcast;      /* Number of messages broadcast to the community. */
+    size_t reg_super;      /* Number of REGISTER_SUPER requests received for the community. */
+} sn_community_stats_t;
+
+/* Communities interned to dense ids, the name is only needed at the protocol edge */
+typedef struct sn_community_ids {
+    struct sn_community    **by_id;          /* Slot 0 stays unused, id 0 means 'none'. */
+    sn_community_stats_t   *stats;           /* Per-community counters, indexed by id. */
+    uint32_t               *free_ids;        /* Released ids, re-used first to keep the ids dense. */
+    uint32_t               num_free;
+    uint32_t               next_id;          /* Lowest id never handed out so far. */
+    uint32_t               capacity;         /* Number of slots in by_id and stats. */
+} sn_community_ids_t;
+
+/* Active federated supernodes, ready to be copied into REGISTER_SUPER_ACK payloads */
+typedef struct sn_ack_payload {
+    n2n_REGISTER_SUPER_ACK_payload_t *entries;
+    uint32_t               num;
+    uint32_t               capacity;
+    uint32_t               num_members;      /* Size of the federation when built, a change triggers rebuilding. */
+    time_t                 refresh_at;       /* Time to rebuild, at the latest when the first entry turns inactive. */
+} sn_ack_payload_t;
+
+/* Delayed PING answer probing an edge's NAT binding lifetime */
+typedef struct sn_nat_probe {
+    n2n_timer_t            timer;            /* armed in the supernode's nat_probes wheel */
+    struct sockaddr_in     dst;
+    n2n_community_t        community;        /* looked up again when sending, it might be gone */
+    n2n_mac_t              mac;
+} sn_nat_probe_t;
+
 /* Typedef'd pointer to get abstract datatype. */
 typedef struct regex_t* re_t;
+typedef struct regex_set_t* re_set_t;
 
 struct sn_community_regular_expression {
     re_t rule;         /* compiles regular expression */
@@ -700,8 +995,22 @@ typedef struct n2n_sn {
 #endif
     int                                    lock_communities; /* If true, only loaded and matching communities can be used. */
     struct sn_community                    *communities;
+    sn_community_ids_t                     community_ids;   /* Communities by interned id. */
     struct sn_community_regular_expression *rules;
+    re_set_t                               rule_set;        /* All rules compiled into a single automaton. */
     struct sn_community                    *federation;
+    uint8_t                                community_homes; /* If non-zero, each community is homed on that many federation members. */
+    sn_ack_payload_t                       ack_payload;     /* Federation part of the REGISTER_SUPER_ACK payload. */
+    char                                   *snapshot_path;  /* If set, state gets saved to and restored from this file. */
+    uint8_t                                snapshot_dirty;  /* Set if communities, edges or supernodes changed since. */
+    uint32_t                               ctrl_rate_by_source;    /* Control plane admission rates in messages per second per source ip address ... */
+    uint32_t                               ctrl_rate_by_community; /* ... per community ... */
+    uint32_t                               ctrl_rate_total;        /* ... and overall, 0 disables the respective limit. */
+    token_bucket_table_t                   ctrl_by_source;  /* Control plane admission per source ip address... */
+    token_bucket_table_t                   ctrl_by_community; /* ... per community ... */
+    n2n_token_bucket_t                     ctrl_total;      /* ... and overall. */
+    n2n_timer_wheel_t                      nat_probes;      /* Delayed PING answers probing edges' NAT binding lifetime... */
+    uint32_t                               num_nat_probes;  /* ... and their number. */
     n2n_auth_t                             auth;
 } n2n_sn_t;
 
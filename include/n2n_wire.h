@@ -100,6 +100,17 @@ int decode_common (n2n_common_t * out,
                    size_t * rem,
                    size_t * idx);
 
+int encode_common_compact (uint8_t * base,
+                           size_t * idx,
+                           const n2n_common_t * common,
+                           uint32_t community_id);
+
+int decode_common_compact (n2n_common_t * out,
+                           uint32_t * community_id,
+                           const uint8_t * base,
+                           size_t * rem,
+                           size_t * idx);
+
 int encode_sock (uint8_t * base,
                  size_t * idx,
                  const n2n_sock_t * sock);
@@ -186,12 +197,29 @@ int encode_PACKET (uint8_t * base,
                    const n2n_common_t * common,
                    const n2n_PACKET_t * pkt);
 
+int encode_PACKET_compact (uint8_t * base,
+                           size_t * idx,
+                           const n2n_common_t * common,
+                           uint32_t community_id,
+                           const n2n_PACKET_t * pkt);
+
 int decode_PACKET (n2n_PACKET_t * pkt,
                    const n2n_common_t * cmn, /* info on how to interpret it */
                    const uint8_t * base,
                    size_t * rem,
                    size_t * idx);
 
+int encode_PACKET_fast (uint8_t * base,
+                        size_t * idx,
+                        const n2n_common_t * common,
+                        const n2n_PACKET_t * pkt);
+
+int decode_PACKET_fast (n2n_PACKET_t * pkt,
+                        const n2n_common_t * cmn, /* info on how to interpret it */
+                        const uint8_t * base,
+                        size_t * rem,
+                        size_t * idx);
+
 int encode_PEER_INFO (uint8_t * base,
                       size_t * idx,
                       const n2n_common_t * common,
@@ -214,4 +242,17 @@ int decode_QUERY_PEER (n2n_QUERY_PEER_t * pkt,
                        size_t * rem,
                        size_t * idx);
 
+int encode_BROADCAST (uint8_t * base,
+                      size_t * idx,
+                      const n2n_common_t * common,
+                      const n2n_BROADCAST_t * bcast,
+                      const n2n_PACKET_t * pkt);
+
+int decode_BROADCAST (n2n_BROADCAST_t * bcast,
+                      n2n_PACKET_t * pkt,
+                      const n2n_common_t * cmn, /* info on how to interpret it */
+                      const uint8_t * base,
+                      size_t * rem,
+                      size_t * idx);
+
 #endif /* #if !defined( N2N_WIRE_H_ ) */
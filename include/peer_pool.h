@@ -0,0 +1,34 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#ifndef PEER_POOL_H
+#define PEER_POOL_H
+
+
+#include "n2n.h"
+
+
+struct peer_info* peer_info_alloc (void);
+
+void peer_info_free (struct peer_info *peer);
+
+void peer_pool_get_stats (peer_pool_stats_t *stats);
+
+
+#endif // PEER_POOL_H
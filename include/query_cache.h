@@ -0,0 +1,34 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+
+#include "n2n.h"
+
+
+int query_cache_init (query_cache_t *cache, uint32_t size);
+
+void query_cache_free (query_cache_t *cache);
+
+int query_cache_admit (query_cache_t *cache, const n2n_mac_t mac, uint16_t backoff, uint16_t backoff_max, time_t now);
+
+void query_cache_clear (query_cache_t *cache, const n2n_mac_t mac);
+
+
+#endif // QUERY_CACHE_H
@@ -27,6 +27,7 @@ typedef char selection_criterion_str_t[SN_SELECTION_CRITERION_BUF_SIZE];
 int sn_selection_criterion_init (peer_info_t *peer);
 int sn_selection_criterion_default (SN_SELECTION_CRITERION_DATA_TYPE *selection_criterion);
 int sn_selection_criterion_calculate (n2n_edge_t *eee, peer_info_t *peer, SN_SELECTION_CRITERION_DATA_TYPE *data);
+int sn_selection_rtt_sample (peer_info_t *peer, uint64_t sent);
 
 /* common data's functions */
 int sn_selection_criterion_common_data_default (n2n_edge_t *eee);
@@ -36,9 +37,10 @@ int sn_selection_sort (peer_info_t **peer_list);
 
 /* gathering data function */
 SN_SELECTION_CRITERION_DATA_TYPE sn_selection_criterion_gather_data (n2n_sn_t *sss);
+SN_SELECTION_CRITERION_DATA_TYPE sn_selection_criterion_homing (SN_SELECTION_CRITERION_DATA_TYPE data, int home_rank);
 
 /* management port output function */
-extern char * sn_selection_criterion_str (selection_criterion_str_t out, peer_info_t *peer);
+extern char * sn_selection_criterion_str (n2n_edge_t *eee, selection_criterion_str_t out, peer_info_t *peer);
 
 
 #endif /* _SN_SELECTION_ */
@@ -0,0 +1,32 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#ifndef SN_SNAPSHOT_H
+#define SN_SNAPSHOT_H
+
+
+#include "n2n.h"
+
+
+int sn_snapshot_write (n2n_sn_t *sss, time_t now);
+
+int sn_snapshot_load (n2n_sn_t *sss, time_t now);
+
+
+#endif // SN_SNAPSHOT_H
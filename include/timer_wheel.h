@@ -0,0 +1,40 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+
+#include "n2n.h"
+
+
+/* get the structure a timer is embedded in, e.g. TIMER_CONTAINER(t, struct peer_info, expiry) */
+#define TIMER_CONTAINER(timer, type, member) ((type*)((char*)(timer) - offsetof(type, member)))
+
+
+void timer_wheel_init (n2n_timer_wheel_t *wheel, time_t now);
+
+void timer_wheel_arm (n2n_timer_wheel_t *wheel, n2n_timer_t *timer, time_t expires);
+
+void timer_wheel_disarm (n2n_timer_t *timer);
+
+size_t timer_wheel_advance (n2n_timer_wheel_t *wheel, time_t now, n2n_timer_cb_t cb, void *data);
+
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,40 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+
+#include "n2n.h"
+
+
+int token_bucket_ready (n2n_token_bucket_t *bucket, uint32_t rate, uint32_t burst, time_t now);
+
+void token_bucket_charge (n2n_token_bucket_t *bucket, uint32_t rate);
+
+int token_bucket_table_init (token_bucket_table_t *table, uint32_t size, uint32_t rate, uint32_t burst);
+
+void token_bucket_table_free (token_bucket_table_t *table);
+
+int token_bucket_table_ready (token_bucket_table_t *table, uint64_t key, time_t now);
+
+void token_bucket_table_charge (token_bucket_table_t *table, uint64_t key);
+
+
+#endif // TOKEN_BUCKET_H
@@ -0,0 +1,38 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#ifndef TX_QUEUE_H
+#define TX_QUEUE_H
+
+
+#include "n2n.h"
+
+
+typedef void (*tx_queue_send_f) (void *ctx, uint8_t *frame, size_t len);
+
+int tx_queue_add (tx_queue_t *queue, const uint8_t *frame, size_t len, uint64_t now);
+
+size_t tx_queue_count (const tx_queue_t *queue, const n2n_mac_t dst);
+
+size_t tx_queue_flush (tx_queue_t *queue, const n2n_mac_t dst, uint64_t queued_before, tx_queue_send_f send, void *ctx);
+
+void tx_queue_free (tx_queue_t *queue);
+
+
+#endif // TX_QUEUE_H
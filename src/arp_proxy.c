@@ -0,0 +1,331 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+#include "arp_proxy.h"
+
+
+// arp and ipv6 neighbor discovery proxy
+//
+// an arp request read from the tap device is an ethernet broadcast which the supernode
+// has to replicate to every edge of the community, with thousands of edges that is quite
+// some fan-out for learning a single mac address. this cache keeps ip to mac bindings the
+// edge learns anyway -- from the peers' REGISTERs and from arp and neighbor discovery
+// frames arriving from the network -- and answers a request for a known address right
+// into the tap device. only misses go out as broadcast (or multicast, for neighbor
+// solicitations) as before.
+//
+// the bindings expire after a few minutes. the host's own neighbor cache checks a stale
+// entry by unicast request which reaches the actual owner, the proxy just saves the
+// broadcasts. duplicate address detection probes and gratuitous arps never get answered.
+// a neighbor solicitation is answered only for an address a neighbor advertisement was
+// seen for, as that tells whether the owner is a router.
+//
+// it is a fixed-size array indexed by a keyed hash of the address, see hash_array_alloc()
+
+
+#define ARP_FRAME_SIZE      (ETH_FRAMESIZE + 28)
+#define ND_FRAME_SIZE       (ETH_FRAMESIZE + 40 + 24)   /* ipv6 header and neighbor solicitation/advertisement */
+#define ND_ANSWER_SIZE      (ND_FRAME_SIZE + 8)         /* ... with target link-layer address option */
+
+#define ICMP6_NS            135
+#define ICMP6_NA            136
+#define ICMP6_NA_ROUTER     0x80
+#define ICMP6_NA_SOLICITED  0x40
+#define ICMP6_NA_OVERRIDE   0x20
+#define ND_OPT_SOURCE_LL    1
+#define ND_OPT_TARGET_LL    2
+
+#define ARP_PROXY_ROUTER    0x01    /* entry flags, the owner is a router ... */
+#define ARP_PROXY_ADVERTISED 0x02   /* ... which is known from a neighbor advertisement */
+
+
+static const uint8_t ipv6_unspecified[IPV6_SIZE] = {0};
+
+
+static arp_proxy_entry_t* arp_proxy_entry (arp_proxy_t *proxy, uint8_t version, const uint8_t *addr) {
+
+    uint64_t lo = 0, hi = 0;
+
+    if(version == 4) {
+        memcpy(&lo, addr, IPV4_SIZE);
+    } else {
+        memcpy(&lo, addr, 8);
+        memcpy(&hi, addr + 8, 8);
+    }
+
+    return &(proxy->entries[hash_mix(lo ^ hash_mix(hi ^ proxy->seed) ^ version) & proxy->mask]);
+}
+
+
+/* returns the entry if the address is bound and the binding did not expire */
+static arp_proxy_entry_t* arp_proxy_find (arp_proxy_t *proxy, uint8_t version, const uint8_t *addr, time_t now) {
+
+    arp_proxy_entry_t *entry;
+
+    if(!proxy->entries)
+        return NULL;
+
+    entry = arp_proxy_entry(proxy, version, addr);
+    if((entry->version != version)
+       || (memcmp(entry->addr, addr, (version == 4) ? IPV4_SIZE : IPV6_SIZE) != 0)
+       || ((int32_t)((uint32_t)now - entry->expires) >= 0)) {
+        return NULL;
+    }
+
+    return entry;
+}
+
+
+static uint16_t icmp6_checksum (const uint8_t *ip6_hdr, const uint8_t *icmp, uint16_t len) {
+
+    uint32_t sum = 0;
+    uint16_t i;
+
+    /* pseudo header: source and destination address, length and next header */
+    for(i = 8; i < 40; i += 2) {
+        sum += (ip6_hdr[i] << 8) | ip6_hdr[i + 1];
+    }
+    sum += len;
+    sum += 58;
+
+    for(i = 0; i + 1 < len; i += 2) {
+        sum += (icmp[i] << 8) | icmp[i + 1];
+    }
+    if(len & 1) {
+        sum += icmp[len - 1] << 8;
+    }
+
+    while(sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return ~sum;
+}
+
+
+/* returns the icmpv6 type of a well-formed neighbor solicitation or advertisement, else 0 */
+static uint8_t nd_type (const uint8_t *frame, size_t len) {
+
+    const uint8_t *ip6 = frame + ETH_FRAMESIZE;
+
+    if((len < ND_FRAME_SIZE)
+       || (frame[12] != 0x86) || (frame[13] != 0xdd)
+       || ((ip6[0] >> 4) != 6)
+       || (ip6[6] != 58)     /* next header icmpv6 */
+       || (ip6[7] != 255)) { /* hop limit, neighbor discovery never gets routed */
+        return 0;
+    }
+
+    if(((ip6[40] != ICMP6_NS) && (ip6[40] != ICMP6_NA)) || (ip6[41] != 0)) {
+        return 0;
+    }
+
+    return ip6[40];
+}
+
+
+/* finds an ethernet link-layer address option of the given type */
+static const uint8_t* nd_option (const uint8_t *frame, size_t len, uint8_t type) {
+
+    const uint8_t *ip6 = frame + ETH_FRAMESIZE;
+    size_t opt_len, end = min(len, ETH_FRAMESIZE + 40 + (size_t)((ip6[4] << 8) | ip6[5]));
+    size_t pos = ND_FRAME_SIZE;
+
+    while(pos + 8 <= end) {
+        opt_len = frame[pos + 1] * 8;
+        if(opt_len == 0) {
+            break;
+        }
+        if((frame[pos] == type) && (opt_len == 8)) {
+            return frame + pos + 2;
+        }
+        pos += opt_len;
+    }
+
+    return NULL;
+}
+
+
+/* ************************************** */
+
+
+/* size gets rounded up to a power of two, bindings are kept for ttl seconds */
+int arp_proxy_init (arp_proxy_t *proxy, uint32_t size, uint32_t ttl) {
+
+    memset(proxy, 0, sizeof(arp_proxy_t));
+    proxy->entries = (arp_proxy_entry_t*)hash_array_alloc(size, sizeof(arp_proxy_entry_t),
+                                                          &(proxy->mask), &(proxy->seed));
+    if(!proxy->entries)
+        return -1;
+
+    proxy->ttl = ttl;
+
+    return 0;
+}
+
+
+void arp_proxy_free (arp_proxy_t *proxy) {
+
+    free(proxy->entries);
+    memset(proxy, 0, sizeof(arp_proxy_t));
+}
+
+
+/* binds an ipv4 (version 4) or ipv6 (version 6) address, in network byte order, to mac */
+void arp_proxy_learn (arp_proxy_t *proxy, uint8_t version, const uint8_t *addr, const n2n_mac_t mac, uint8_t is_router, time_t now) {
+
+    arp_proxy_entry_t *entry;
+
+    if(!proxy->entries || (mac[0] & 0x01))
+        return;
+
+    entry = arp_proxy_entry(proxy, version, addr);
+    if((entry->version != version)
+       || (memcmp(entry->addr, addr, (version == 4) ? IPV4_SIZE : IPV6_SIZE) != 0)
+       || (memcmp(entry->mac, mac, sizeof(n2n_mac_t)) != 0)) {
+        memset(entry, 0, sizeof(arp_proxy_entry_t));
+        entry->version = version;
+        memcpy(entry->addr, addr, (version == 4) ? IPV4_SIZE : IPV6_SIZE);
+        memcpy(entry->mac, mac, sizeof(n2n_mac_t));
+    }
+    if(is_router != 0xff) {
+        entry->flags = ARP_PROXY_ADVERTISED | (is_router ? ARP_PROXY_ROUTER : 0);
+    }
+    entry->expires = (uint32_t)now + proxy->ttl;
+}
+
+
+/* learns from arp and neighbor discovery frames arriving from the network */
+void arp_proxy_snoop (arp_proxy_t *proxy, const uint8_t *frame, size_t len, time_t now) {
+
+    const uint8_t *ip6 = frame + ETH_FRAMESIZE;
+    const uint8_t *arp = frame + ETH_FRAMESIZE;
+    const uint8_t *ll;
+    uint32_t spa;
+
+    if(!proxy->entries)
+        return;
+
+    if((len >= ARP_FRAME_SIZE) && (frame[12] == 0x08) && (frame[13] == 0x06)) {
+        /* ethernet, ipv4, sender hardware and protocol address */
+        if((arp[0] == 0) && (arp[1] == 1) && (arp[2] == 0x08) && (arp[3] == 0x00)
+           && (arp[4] == 6) && (arp[5] == 4)) {
+            memcpy(&spa, arp + 14, IPV4_SIZE);
+            if(spa != 0) {
+                arp_proxy_learn(proxy, 4, arp + 14, arp + 8, 0xff, now);
+            }
+        }
+        return;
+    }
+
+    switch(nd_type(frame, len)) {
+        case ICMP6_NS:
+            /* the soliciting node, unless probing for duplicates */
+            if(memcmp(ip6 + 8, ipv6_unspecified, IPV6_SIZE) != 0) {
+                ll = nd_option(frame, len, ND_OPT_SOURCE_LL);
+                arp_proxy_learn(proxy, 6, ip6 + 8, ll ? ll : frame + 6, 0xff, now);
+            }
+            break;
+
+        case ICMP6_NA:
+            ll = nd_option(frame, len, ND_OPT_TARGET_LL);
+            arp_proxy_learn(proxy, 6, ip6 + 48, ll ? ll : frame + 6, (ip6[44] & ICMP6_NA_ROUTER) ? 1 : 0, now);
+            break;
+    }
+}
+
+
+/* answers an arp request or neighbor solicitation read from the tap device if the address
+ * asked for is bound. returns the length of the answer written to reply, 0 if the address
+ * is not known and -1 if the frame is not a request to answer */
+int arp_proxy_answer (arp_proxy_t *proxy, const uint8_t *frame, size_t len, uint8_t *reply, size_t reply_size, time_t now) {
+
+    const uint8_t *arp = frame + ETH_FRAMESIZE;
+    const uint8_t *ip6 = frame + ETH_FRAMESIZE;
+    uint8_t *rip6 = reply + ETH_FRAMESIZE;
+    arp_proxy_entry_t *entry;
+    uint32_t spa;
+    uint16_t csum;
+
+    if(!proxy->entries)
+        return -1;
+
+    if((len >= ARP_FRAME_SIZE) && (frame[12] == 0x08) && (frame[13] == 0x06)) {
+        if(!((arp[0] == 0) && (arp[1] == 1) && (arp[2] == 0x08) && (arp[3] == 0x00)
+             && (arp[4] == 6) && (arp[5] == 4) && (arp[6] == 0) && (arp[7] == 1))) {
+            return -1;
+        }
+        /* duplicate address detection or gratuitous */
+        memcpy(&spa, arp + 14, IPV4_SIZE);
+        if((spa == 0) || (memcmp(arp + 14, arp + 24, IPV4_SIZE) == 0)) {
+            return -1;
+        }
+        if(reply_size < ARP_FRAME_SIZE) {
+            return -1;
+        }
+
+        entry = arp_proxy_find(proxy, 4, arp + 24, now);
+        if(!entry) {
+            return 0;
+        }
+
+        memcpy(reply, frame + 6, 6);                       /* to the requester ... */
+        memcpy(reply + 6, entry->mac, 6);                  /* ... from the owner */
+        reply[12] = 0x08; reply[13] = 0x06;
+        memcpy(reply + ETH_FRAMESIZE, arp, 6);             /* hardware and protocol type and size */
+        reply[ETH_FRAMESIZE + 6] = 0; reply[ETH_FRAMESIZE + 7] = 2;
+        memcpy(reply + ETH_FRAMESIZE + 8, entry->mac, 6);  /* sender: the owner ... */
+        memcpy(reply + ETH_FRAMESIZE + 14, arp + 24, 4);
+        memcpy(reply + ETH_FRAMESIZE + 18, arp + 8, 10);   /* ... target: the requester */
+
+        return ARP_FRAME_SIZE;
+    }
+
+    if(nd_type(frame, len) != ICMP6_NS) {
+        return -1;
+    }
+    if((memcmp(ip6 + 8, ipv6_unspecified, IPV6_SIZE) == 0) || (reply_size < ND_ANSWER_SIZE)) {
+        return -1;
+    }
+
+    entry = arp_proxy_find(proxy, 6, ip6 + 48, now);
+    if(!entry || !(entry->flags & ARP_PROXY_ADVERTISED)) {
+        return 0;
+    }
+
+    memset(reply, 0, ND_ANSWER_SIZE);
+    memcpy(reply, frame + 6, 6);
+    memcpy(reply + 6, entry->mac, 6);
+    reply[12] = 0x86; reply[13] = 0xdd;
+    rip6[0] = 0x60;
+    rip6[5] = 32;                                          /* payload length */
+    rip6[6] = 58;
+    rip6[7] = 255;
+    memcpy(rip6 + 8, ip6 + 48, IPV6_SIZE);                 /* from the target ... */
+    memcpy(rip6 + 24, ip6 + 8, IPV6_SIZE);                 /* ... to the soliciting node */
+    rip6[40] = ICMP6_NA;
+    rip6[44] = ICMP6_NA_SOLICITED | ICMP6_NA_OVERRIDE | ((entry->flags & ARP_PROXY_ROUTER) ? ICMP6_NA_ROUTER : 0);
+    memcpy(rip6 + 48, ip6 + 48, IPV6_SIZE);
+    rip6[64] = ND_OPT_TARGET_LL;
+    rip6[65] = 1;
+    memcpy(rip6 + 66, entry->mac, 6);
+    csum = icmp6_checksum(rip6, rip6 + 40, 32);
+    rip6[42] = csum >> 8;
+    rip6[43] = csum & 0xff;
+
+    return ND_ANSWER_SIZE;
+}
@@ -146,6 +146,8 @@ static void help () {
 #endif
                  "[-r] [-E] [-v] [-i <reg_interval>] [-L <reg_ttl>] [-t <mgmt port>] [-A[<cipher>]] [-H] [-z[<compression algo>]] "
                  "[-R <rule_str>] "
+                 "[--select-rtt] [--fast-failover <ms>] [--hold-window <ms>] [--fixed-keepalive] "
+                 "[--peer-cache <file>] [--no-arp-proxy] [--no-mcast-snoop] "
                  "[-h]\n\n");
 
 #if defined(N2N_CAN_NAME_IFACE)
@@ -196,6 +198,27 @@ static void help () {
     printf("-R <rule_str>            | Drop or accept packets by rules. Can be set multiple times. \n");
     printf("                         | Rule format: src_ip/len:[b_port,e_port],dst_ip/len:[s_port,e_port],TCP+/-,UDP+/-,ICMP+/- \n");
     printf("-t <port>                | Management UDP Port (for multiple edges on a machine).\n");
+    printf("--select-rtt             | Select supernode by round trip time, can be switched at runtime\n"
+           "                         | using the management port's 'select' command (default: by load%s).\n",
+#ifndef SN_SELECTION_RTT
+           ""
+#else
+           ", compiled to rtt"
+#endif
+           );
+    printf("--fast-failover <ms>     | Probe current and a standby supernode every <ms> (%u to %u) and fail\n"
+           "                         | over after %u missed keepalives (default: off).\n",
+           N2N_EDGE_FAILOVER_MIN, N2N_EDGE_FAILOVER_MAX, N2N_EDGE_FAILOVER_MISSED);
+    printf("--hold-window <ms>       | Hold packets to a new peer up to <ms> while connecting P2P, then relay\n"
+           "                         | them via supernode (default %u ms, 0 = relay right away).\n", TX_QUEUE_WINDOW_DFL);
+    printf("--fixed-keepalive        | Keep the registration interval instead of following the NAT binding\n"
+           "                         | lifetime probed with the help of the supernode.\n");
+    printf("--peer-cache <file>      | Save the peers connected to P2P to <file> and register with them\n"
+           "                         | directly at the next start-up (default: off).\n");
+    printf("--no-arp-proxy           | Do not answer ARP requests and IPv6 neighbor solicitations for addresses\n"
+           "                         | of known peers locally, always send them to the community.\n");
+    printf("--no-mcast-snoop         | Receive all multicast groups instead of the ones joined as seen from\n"
+           "                         | IGMP and MLD reports on the tap device (only with -E).\n");
 
     printf("\nEnvironment variables:\n");
     printf("    N2N_KEY              | Encryption key (ASCII). Not with -k.\n");
@@ -512,6 +535,60 @@ static int setOption (int optkey, char *optargument, n2n_tuntap_priv_config_t *e
             break;
         }
 
+        case '[': /* round-trip-time-based supernode selection strategy */ {
+            conf->sn_selection_strategy = SN_SELECTION_STRATEGY_RTT;
+            break;
+        }
+
+        case ']': /* load-based supernode selection strategy */ {
+            conf->sn_selection_strategy = SN_SELECTION_STRATEGY_LOAD;
+            break;
+        }
+
+        case '{': /* fast supernode failover, keepalive interval in ms */ {
+            conf->failover_interval = atoi(optargument);
+
+            if((conf->failover_interval < N2N_EDGE_FAILOVER_MIN) || (conf->failover_interval > N2N_EDGE_FAILOVER_MAX)) {
+                traceEvent(TRACE_WARNING, "Fast failover keepalive interval must be %u to %u ms",
+                           N2N_EDGE_FAILOVER_MIN, N2N_EDGE_FAILOVER_MAX);
+                conf->failover_interval = 0;
+                return(-1);
+            }
+            break;
+        }
+
+        case '}': /* holding window for frames while registering with peers */ {
+            conf->tx_queue_window = atoi(optargument);
+
+            if((conf->tx_queue_window < 0) || (conf->tx_queue_window > TX_QUEUE_WINDOW_MAX)) {
+                traceEvent(TRACE_WARNING, "Holding window must be 0 to %u ms", TX_QUEUE_WINDOW_MAX);
+                conf->tx_queue_window = TX_QUEUE_WINDOW_DFL;
+                return(-1);
+            }
+            break;
+        }
+
+        case '|': /* do not adapt the keepalive interval to the NAT binding lifetime */ {
+            conf->fixed_keepalive = 1;
+            break;
+        }
+
+        case '^': /* do not answer ARP requests and neighbor solicitations locally */ {
+            conf->arp_proxy = 0;
+            break;
+        }
+
+        case '@': /* receive all multicast groups */ {
+            conf->mcast_snoop = 0;
+            break;
+        }
+
+        case '~': /* peer cache file */ {
+            free(conf->peer_cache_path);
+            conf->peer_cache_path = strdup(optargument);
+            break;
+        }
+
         default: {
             traceEvent(TRACE_WARNING, "Unknown option -%c: Ignored", (char)optkey);
             return(-1);
@@ -530,6 +607,14 @@ static const struct option long_options[] =
         { "tap-device",        required_argument, NULL, 'd' },
         { "euid",              required_argument, NULL, 'u' },
         { "egid",              required_argument, NULL, 'g' },
+        { "select-rtt",        no_argument,       NULL, '[' },
+        { "select-load",       no_argument,       NULL, ']' },
+        { "fast-failover",     required_argument, NULL, '{' },
+        { "hold-window",       required_argument, NULL, '}' },
+        { "fixed-keepalive",   no_argument,       NULL, '|' },
+        { "peer-cache",        required_argument, NULL, '~' },
+        { "no-arp-proxy",      no_argument,       NULL, '^' },
+        { "no-mcast-snoop",    no_argument,       NULL, '@' },
         { "help"     ,         no_argument,       NULL, 'h' },
         { "verbose",           no_argument,       NULL, 'v' },
         { NULL,                0,                 NULL,  0  }
@@ -0,0 +1,228 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#include "edge_peer_cache.h"
+
+
+// edge peer cache for warm restarts
+//
+// the known peers, i.e. the ones with a working direct path, get written to a file every
+// N2N_PEER_CACHE_INTERVAL seconds and when the edge terminates. a restarted edge reads
+// them back and registers with each of them directly at the socket that worked last --
+// alongside its registration with the supernode instead of waiting for it and for the
+// traffic which would make it query the supernode for each peer. peers not seen for
+// N2N_PEER_CACHE_MAX_AGE seconds are skipped, so is a cache of another community
+//
+// as the supernode snapshot, the file gets written to a temporary one first which then is
+// renamed over the previous one. it holds the records below in host byte order and is
+// meant for restarting on the same machine. caches of different layout or with checksum
+// mismatch get ignored
+
+
+#define EDGE_PEER_CACHE_MAGIC     "n2nP"
+#define EDGE_PEER_CACHE_VERSION   1
+
+
+typedef struct edge_peer_cache_header {
+    char                  magic[4];
+    uint32_t              version;
+    uint32_t              header_size;      /* record sizes, a mismatch indicates a different layout */
+    uint32_t              peer_size;
+    uint32_t              num_peers;
+    uint64_t              checksum;         /* pearson_hash_64 of the peer records */
+    int64_t               written;
+    n2n_community_t       community;
+} edge_peer_cache_header_t;
+
+typedef struct edge_peer_cache_peer {
+    n2n_mac_t             mac_addr;
+    uint16_t              timeout;
+    n2n_ip_subnet_t       dev_addr;
+    n2n_sock_t            sock;
+    int64_t               last_seen;
+    uint64_t              last_valid_time_stamp;
+    n2n_desc_t            dev_desc;
+} edge_peer_cache_peer_t;
+
+
+/* ************************************** */
+
+
+static FILE* peer_cache_open_new (const char *path) {
+
+#ifndef WIN32
+    FILE *f;
+    int fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0)
+        return NULL;
+
+    f = fdopen(fd, "wb");
+    if(!f)
+        close(fd);
+
+    return f;
+#else
+    return fopen(path, "wb");
+#endif
+}
+
+
+int edge_peer_cache_write (n2n_edge_t *eee, time_t now) {
+
+    FILE *f;
+    edge_peer_cache_header_t hdr;
+    edge_peer_cache_peer_t *recs;
+    struct peer_info *peer, *tmp_peer;
+    char *tmp_path;
+    uint32_t num_peers = 0;
+    int ret = -1;
+
+    if(!eee->conf.peer_cache_path)
+        return 0;
+
+    recs = (edge_peer_cache_peer_t*)calloc(min(HASH_COUNT(eee->known_peers), N2N_PEER_CACHE_MAX_PEERS) + 1, sizeof(edge_peer_cache_peer_t));
+    tmp_path = (char*)malloc(strlen(eee->conf.peer_cache_path) + 5);
+    if(!recs || !tmp_path) {
+        free(recs);
+        free(tmp_path);
+        return -1;
+    }
+    sprintf(tmp_path, "%s.tmp", eee->conf.peer_cache_path);
+
+    HASH_ITER(hh, eee->known_peers, peer, tmp_peer) {
+        if(num_peers == N2N_PEER_CACHE_MAX_PEERS)
+            break;
+        memcpy(recs[num_peers].mac_addr, peer->mac_addr, sizeof(n2n_mac_t));
+        recs[num_peers].timeout = peer->timeout;
+        recs[num_peers].dev_addr = peer->dev_addr;
+        recs[num_peers].sock = peer->sock;
+        recs[num_peers].last_seen = peer->last_seen;
+        recs[num_peers].last_valid_time_stamp = peer->last_valid_time_stamp;
+        memcpy(recs[num_peers].dev_desc, peer->cold->dev_desc, sizeof(n2n_desc_t));
+        num_peers++;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, EDGE_PEER_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = EDGE_PEER_CACHE_VERSION;
+    hdr.header_size = sizeof(edge_peer_cache_header_t);
+    hdr.peer_size = sizeof(edge_peer_cache_peer_t);
+    hdr.num_peers = num_peers;
+    hdr.checksum = pearson_hash_64((uint8_t*)recs, num_peers * sizeof(edge_peer_cache_peer_t));
+    hdr.written = now;
+    memcpy(hdr.community, eee->conf.community_name, sizeof(n2n_community_t));
+
+    f = peer_cache_open_new(tmp_path);
+    if(f) {
+        if((fwrite(&hdr, sizeof(hdr), 1, f) == 1)
+           && (fwrite(recs, sizeof(edge_peer_cache_peer_t), num_peers, f) == num_peers)) {
+            ret = 0;
+        }
+        if(fclose(f) != 0)
+            ret = -1;
+    }
+
+    if(ret == 0) {
+#ifdef WIN32
+        remove(eee->conf.peer_cache_path);
+#endif
+        if(rename(tmp_path, eee->conf.peer_cache_path) == 0) {
+            traceEvent(TRACE_DEBUG, "Wrote %u peers to peer cache %s", num_peers, eee->conf.peer_cache_path);
+        } else {
+            ret = -1;
+        }
+    }
+
+    if(ret != 0)
+        traceEvent(TRACE_WARNING, "Failed to write peer cache %s: %s", eee->conf.peer_cache_path, strerror(errno));
+
+    free(recs);
+    free(tmp_path);
+
+    return ret;
+}
+
+
+/* ************************************** */
+
+
+int edge_peer_cache_load (n2n_edge_t *eee, time_t now, edge_peer_cache_restore_cb restore) {
+
+    FILE *f;
+    edge_peer_cache_header_t hdr;
+    edge_peer_cache_peer_t *recs = NULL;
+    uint32_t p, num_restored = 0;
+    int ret = -1;
+
+    if(!eee->conf.peer_cache_path)
+        return 0;
+
+    f = fopen(eee->conf.peer_cache_path, "rb");
+    if(!f) {
+        traceEvent(TRACE_NORMAL, "No peer cache to restore from at %s", eee->conf.peer_cache_path);
+        return -1;
+    }
+
+    if((fread(&hdr, sizeof(hdr), 1, f) == 1)
+       && (memcmp(hdr.magic, EDGE_PEER_CACHE_MAGIC, sizeof(hdr.magic)) == 0)
+       && (hdr.version == EDGE_PEER_CACHE_VERSION)
+       && (hdr.header_size == sizeof(edge_peer_cache_header_t))
+       && (hdr.peer_size == sizeof(edge_peer_cache_peer_t))
+       && (hdr.num_peers <= N2N_PEER_CACHE_MAX_PEERS)
+       && ((recs = (edge_peer_cache_peer_t*)calloc(hdr.num_peers + 1, sizeof(edge_peer_cache_peer_t))) != NULL)
+       && (fread(recs, sizeof(edge_peer_cache_peer_t), hdr.num_peers, f) == hdr.num_peers)
+       && (fgetc(f) == EOF)
+       && (hdr.checksum == pearson_hash_64((uint8_t*)recs, hdr.num_peers * sizeof(edge_peer_cache_peer_t)))) {
+        ret = 0;
+    }
+    fclose(f);
+
+    if(ret != 0) {
+        traceEvent(TRACE_WARNING, "Ignoring invalid or incompatible peer cache %s", eee->conf.peer_cache_path);
+        free(recs);
+        return -1;
+    }
+
+    hdr.community[N2N_COMMUNITY_SIZE - 1] = '\0';
+    if(memcmp(hdr.community, eee->conf.community_name, sizeof(n2n_community_t)) != 0) {
+        traceEvent(TRACE_NORMAL, "Not restoring peer cache %s of community '%s'", eee->conf.peer_cache_path, (char*)hdr.community);
+        free(recs);
+        return -1;
+    }
+
+    for(p = 0; p < hdr.num_peers; p++) {
+        if(recs[p].last_seen < now - N2N_PEER_CACHE_MAX_AGE)
+            continue;
+        if(memcmp(recs[p].mac_addr, eee->device.mac_addr, sizeof(n2n_mac_t)) == 0)
+            continue;
+        recs[p].dev_desc[N2N_DESC_SIZE - 1] = '\0';
+        restore(eee, recs[p].mac_addr, &(recs[p].sock), &(recs[p].dev_addr), &(recs[p].dev_desc),
+                recs[p].timeout, recs[p].last_valid_time_stamp);
+        num_restored++;
+    }
+
+    free(recs);
+
+    traceEvent(TRACE_NORMAL, "Restored %u of %u peers from peer cache %s written %d sec ago",
+               num_restored, hdr.num_peers, eee->conf.peer_cache_path, (int)(now - hdr.written));
+
+    return 0;
+}
@@ -28,6 +28,7 @@ static HEAP_ALLOC (wrkmem, LZO1X_1_MEM_COMPRESS);
 
 static const char * supernode_ip (const n2n_edge_t * eee);
 static void send_register (n2n_edge_t *eee, const n2n_sock_t *remote_peer, const n2n_mac_t peer_mac);
+static void send_register_cookie (n2n_edge_t *eee, const n2n_sock_t *remote_peer, const n2n_mac_t peer_mac, uint32_t cookie);
 
 static void check_peer_registration_needed (n2n_edge_t *eee,
                                             uint8_t from_supernode,
@@ -40,6 +41,9 @@ static int edge_init_sockets (n2n_edge_t *eee, int udp_local_port, int mgmt_port
 static int edge_init_routes (n2n_edge_t *eee, n2n_route_t *routes, uint16_t num_routes);
 static void edge_cleanup_routes (n2n_edge_t *eee);
 
+static void send_queued_frame (void *ctx, uint8_t *frame, size_t len);
+static int keepalive_interval (const n2n_edge_t *eee);
+
 static void check_known_peer_sock_change (n2n_edge_t *eee,
                                           uint8_t from_supernode,
                                           const n2n_mac_t mac,
@@ -210,6 +214,11 @@ n2n_edge_t* edge_init (const n2n_edge_conf_t *conf, int *rv) {
 
     eee->known_peers        = NULL;
     eee->pending_peers    = NULL;
+    timer_wheel_init(&(eee->known_peers_expiry), eee->start_time);
+    timer_wheel_init(&(eee->pending_peers_expiry), eee->start_time);
+    query_cache_init(&(eee->query_cache), N2N_QUERY_CACHE_SIZE);
+    if(eee->conf.arp_proxy)
+        arp_proxy_init(&(eee->arp_proxy), N2N_ARP_PROXY_SIZE, N2N_ARP_PROXY_TTL);
     eee->sup_attempts = N2N_EDGE_SUP_ATTEMPTS;
     eee->sn_last_valid_time_stamp = initial_time_stamp ();
     sn_selection_criterion_common_data_default(eee);
@@ -227,7 +236,7 @@ n2n_edge_t* edge_init (const n2n_edge_conf_t *conf, int *rv) {
 
     traceEvent(TRACE_NORMAL, "Number of supernodes in the list: %d\n", HASH_COUNT(eee->conf.supernodes));
     HASH_ITER(hh, eee->conf.supernodes, scan, tmp) {
-        traceEvent(TRACE_NORMAL, "supernode %u => %s\n", i, (scan->ip_addr));
+        traceEvent(TRACE_NORMAL, "supernode %u => %s\n", i, (scan->cold->ip_addr));
         i++;
     }
 
@@ -271,6 +280,7 @@ n2n_edge_t* edge_init (const n2n_edge_conf_t *conf, int *rv) {
     // on trying to close them (open_sockets does so for also being able to RE-open the sockets
     // if called in-between, see "Supernode not responding" in update_supernode_reg(...)
     eee->udp_sock = -1;
+    eee->nat_probe_sock = -1;
     eee->udp_mgmt_sock = -1;
 
     eee->conf.auth.scheme = n2n_auth_simple_id;
@@ -317,7 +327,8 @@ static int find_and_remove_peer (struct peer_info **head, const n2n_mac_t mac) {
     HASH_FIND_PEER(*head, mac, peer);
     if(peer) {
         HASH_DEL(*head, peer);
-        free(peer);
+        timer_wheel_disarm(&(peer->expiry));
+        peer_info_free(peer);
         return(1);
     }
 
@@ -425,6 +436,94 @@ static struct peer_info* find_peer_by_sock (const n2n_sock_t *sock, struct peer_
 
 /* ************************************** */
 
+/** hole_punch callback: probe a candidate with a REGISTER carrying the candidate's cookie. */
+static void send_hole_punch_probe (void *ctx, const n2n_mac_t mac, const n2n_sock_t *sock, uint8_t type, uint32_t cookie) {
+
+    n2n_edge_t *eee = (n2n_edge_t*)ctx;
+
+#ifndef WIN32
+    if((eee->conf.register_ttl > 1)
+       && ((type == HOLE_PUNCH_CAND_REFLEXIVE) || (type == HOLE_PUNCH_CAND_PREDICTED))) {
+        /* Setting register_ttl usually implies that the edge knows the internal net topology
+         * clearly. Some nat device drop and block ports with incoming UDP packet if out-come
+         * traffic does not exist. So the probes only punch the local UDP hole and never really
+         * reach the peer, the register_ttl is basically nat level + 1.
+         */
+        int curTTL = 0;
+        socklen_t lenTTL = sizeof(int);
+
+        getsockopt(eee->udp_sock, IPPROTO_IP, IP_TTL, (void *) (char *) &curTTL, &lenTTL);
+        setsockopt(eee->udp_sock, IPPROTO_IP, IP_TTL,
+                   (void *) (char *) &eee->conf.register_ttl,
+                   sizeof(eee->conf.register_ttl));
+        send_register_cookie(eee, sock, mac, cookie);
+        setsockopt(eee->udp_sock, IPPROTO_IP, IP_TTL, (void *) (char *) &curTTL, sizeof(curTTL));
+        return;
+    }
+#endif
+
+    send_register_cookie(eee, sock, mac, cookie);
+}
+
+/* ************************************** */
+
+/** Have the main loop run the connectivity checks by the time the given one is due. */
+static void schedule_hole_punch (n2n_edge_t *eee, const hole_punch_t *hp) {
+
+    uint64_t due = hole_punch_due(hp);
+
+    if(due && (!eee->hole_punch_due || (due < eee->hole_punch_due)))
+        eee->hole_punch_due = due;
+}
+
+/* ************************************** */
+
+/** Start a connectivity check towards a pending peer, or extend the one in progress.
+ *
+ *    If the peer socket is the one the supernode sees (reflexive), the ports next to it
+ *    become candidates, too, should the first round go unanswered, as a symmetric NAT maps
+ *    the peer's flow to us to another port. The local multicast group is a candidate in
+ *    any case.
+ */
+static void start_hole_punch (n2n_edge_t *eee, struct peer_info *peer, uint8_t reflexive) {
+
+    hole_punch_t *hp = peer->cold->hole_punch;
+
+    if(!eee->conf.allow_p2p)
+        return;
+
+    if(!hp) {
+        hp = calloc(1, sizeof(hole_punch_t));
+        if(!hp) {
+            traceEvent(TRACE_WARNING, "Out of memory, registering with peer without connectivity check");
+            send_register(eee, &(peer->sock), peer->mac_addr);
+            return;
+        }
+        hole_punch_init(hp, peer->mac_addr, (uint32_t)n2n_rand());
+        peer->cold->hole_punch = hp;
+        eee->stats.p2p_attempts++;
+    }
+
+    if(!reflexive) {
+        hole_punch_add(hp, &(peer->sock), HOLE_PUNCH_CAND_PEER);
+    } else if(eee->conf.register_ttl != 1) {
+        /* With register_ttl 1, we are DMZ host or port is directly accessible, just let the peer send back the ack */
+        hole_punch_predict(hp, &(peer->sock), eee->hole_punch_delta);
+    }
+
+#ifndef SKIP_MULTICAST_PEERS_DISCOVERY
+    if(eee->multicast_joined) {
+        hole_punch_add(hp, &(eee->multicast_peer), HOLE_PUNCH_CAND_LAN);
+    }
+#endif
+
+    hole_punch_start(hp);
+    hole_punch_probe(hp, time_usec(), send_hole_punch_probe, eee);
+    schedule_hole_punch(eee, hp);
+}
+
+/* ************************************** */
+
 /** Start the registration process.
  *
  *    If the peer is already in pending_peers, ignore the request.
@@ -452,16 +551,18 @@ static void register_with_new_peer (n2n_edge_t *eee,
 
     HASH_FIND_PEER(eee->pending_peers, mac, scan);
 
-    /* NOTE: pending_peers are purged periodically with purge_expired_registrations */
+    /* NOTE: pending_peers are purged by their expiry timer, see purge_expired_peers */
     if(scan == NULL) {
-        scan = calloc(1, sizeof(struct peer_info));
+        scan = peer_info_alloc();
 
         memcpy(scan->mac_addr, mac, N2N_MAC_SIZE);
         scan->sock = *peer;
-        scan->timeout = eee->conf.register_interval; /* TODO: should correspond to the peer supernode registration timeout */
+        scan->timeout = keepalive_interval(eee); /* TODO: should correspond to the peer supernode registration timeout */
         scan->last_valid_time_stamp = initial_time_stamp();
+        scan->cold->tx_queue_until = time_usec() + (uint64_t)eee->conf.tx_queue_window * 1000;
 
         HASH_ADD_PEER(eee->pending_peers, scan);
+        arm_peer_expiry(&(eee->pending_peers_expiry), scan, time(NULL));
 
         traceEvent(TRACE_DEBUG, "=== new pending %s -> %s",
                    macaddr_str(mac_buf, scan->mac_addr),
@@ -471,44 +572,16 @@ static void register_with_new_peer (n2n_edge_t *eee,
                    HASH_COUNT(eee->pending_peers));
         /* trace Sending REGISTER */
         if(from_supernode) {
-            /* UDP NAT hole punching through supernode. Send to peer first(punch local UDP hole)
-             * and then ask supernode to forward. Supernode then ask peer to ack. Some nat device
-             * drop and block ports with incoming UDP packet if out-come traffic does not exist.
-             * So we can alternatively set TTL so that the packet sent to peer never really reaches
-             * The register_ttl is basically nat level + 1. Set it to 1 means host like DMZ.
+            /* UDP NAT hole punching through supernode. Probe the peer's candidate sockets first
+             * (punch local UDP holes) and then ask supernode to forward. Supernode then ask peer
+             * to ack and to probe us in turn.
              */
-            if(eee->conf.register_ttl == 1) {
-                /* We are DMZ host or port is directly accessible. Just let peer to send back the ack */
-#ifndef WIN32
-            } else if(eee->conf.register_ttl > 1) {
-                /* Setting register_ttl usually implies that the edge knows the internal net topology
-                 * clearly, we can apply aggressive port prediction to support incoming Symmetric NAT
-                 */
-                int curTTL = 0;
-                socklen_t lenTTL = sizeof(int);
-                n2n_sock_t sock = scan->sock;
-                int alter = 16; /* TODO: set by command line or more reliable prediction method */
-
-                getsockopt(eee->udp_sock, IPPROTO_IP, IP_TTL, (void *) (char *) &curTTL, &lenTTL);
-                setsockopt(eee->udp_sock, IPPROTO_IP, IP_TTL,
-                           (void *) (char *) &eee->conf.register_ttl,
-                           sizeof(eee->conf.register_ttl));
-                for(; alter > 0; alter--, sock.port++) {
-                    send_register(eee, &sock, mac);
-                }
-                setsockopt(eee->udp_sock, IPPROTO_IP, IP_TTL, (void *) (char *) &curTTL, sizeof(curTTL));
-#endif
-            } else { /* eee->conf.register_ttl <= 0 */
-                /* Normal STUN */
-                send_register(eee, &(scan->sock), mac);
-            }
+            start_hole_punch(eee, scan, 1);
             send_register(eee, &(eee->supernode), mac);
         } else {
             /* P2P register, send directly */
-            send_register(eee, &(scan->sock), mac);
+            start_hole_punch(eee, scan, 0);
         }
-
-        register_with_local_peers(eee);
     } else{
         scan->sock = *peer;
     }
@@ -516,11 +589,44 @@ static void register_with_new_peer (n2n_edge_t *eee,
     if(dev_addr != NULL) {
         memcpy(&(scan->dev_addr), dev_addr, sizeof(n2n_ip_subnet_t));
     }
-    if(dev_desc) memcpy(scan->dev_desc, dev_desc, N2N_DESC_SIZE);
+    if(dev_desc) memcpy(scan->cold->dev_desc, dev_desc, N2N_DESC_SIZE);
 
 }
 
 
+/* ************************************** */
+
+/** Register directly with a peer read from the peer cache at start-up, at the socket
+ *  that worked last. If it does not anymore, the pending peer just expires. */
+static void restore_cached_peer (n2n_edge_t *eee,
+                                 const n2n_mac_t mac,
+                                 const n2n_sock_t *sock,
+                                 const n2n_ip_subnet_t *dev_addr,
+                                 const n2n_desc_t *dev_desc,
+                                 uint16_t timeout,
+                                 uint64_t last_valid_time_stamp) {
+
+    struct peer_info *scan;
+
+    if(!is_valid_peer_sock(sock))
+        return;
+
+    HASH_FIND_PEER(eee->known_peers, mac, scan);
+    if(scan)
+        return;
+
+    register_with_new_peer(eee, 0, mac, dev_addr, dev_desc, sock);
+
+    HASH_FIND_PEER(eee->pending_peers, mac, scan);
+    if(scan) {
+        if(timeout)
+            scan->timeout = timeout;
+        /* keep replay protection across the restart */
+        if(last_valid_time_stamp > scan->last_valid_time_stamp)
+            scan->last_valid_time_stamp = last_valid_time_stamp;
+    }
+}
+
 /* ************************************** */
 
 /** Update the last_seen time for this peer, or get registered. */
@@ -541,8 +647,10 @@ static void check_peer_registration_needed (n2n_edge_t *eee,
 
         if(scan) {
             HASH_DEL(eee->known_peers, scan);
+            mac_table_remove(&(eee->known_peers_index), scan->mac_addr);
             memcpy(scan->mac_addr, mac, sizeof(n2n_mac_t));
             HASH_ADD_PEER(eee->known_peers, scan);
+            mac_table_add(&(eee->known_peers_index), scan->mac_addr, scan);
         }
     }
 
@@ -553,8 +661,10 @@ static void check_peer_registration_needed (n2n_edge_t *eee,
         /* Already in known_peers. */
         time_t now = time(NULL);
 
-        if(!from_supernode)
+        if(!from_supernode) {
             scan->last_p2p = now;
+            scan->reval_probes = 0;
+        }
 
         if((now - scan->last_seen) > 0 /* >= 1 sec */) {
             /* Don't register too often */
@@ -585,10 +695,15 @@ static void peer_set_p2p_confirmed (n2n_edge_t * eee,
 
     if(scan) {
         HASH_DEL(eee->pending_peers, scan);
+        timer_wheel_disarm(&(scan->expiry));
+        free(scan->cold->hole_punch);
+        scan->cold->hole_punch = NULL;
 
         scan_tmp = find_peer_by_sock(peer, eee->known_peers);
         if(scan_tmp != NULL) {
             HASH_DEL(eee->known_peers, scan_tmp);
+            mac_table_remove(&(eee->known_peers_index), scan_tmp->mac_addr);
+            peer_info_free(scan);
             scan = scan_tmp;
             memcpy(scan->mac_addr, mac, sizeof(n2n_mac_t));
         } else {
@@ -596,7 +711,10 @@ static void peer_set_p2p_confirmed (n2n_edge_t * eee,
         }
 
         HASH_ADD_PEER(eee->known_peers, scan);
+        mac_table_add(&(eee->known_peers_index), scan->mac_addr, scan);
         scan->last_p2p = now;
+        scan->reval_probes = 0;
+        query_cache_clear(&(eee->query_cache), scan->mac_addr);
 
         traceEvent(TRACE_DEBUG, "P2P connection established: %s [%s]",
                    macaddr_str(mac_buf, mac),
@@ -613,8 +731,24 @@ static void peer_set_p2p_confirmed (n2n_edge_t * eee,
                    HASH_COUNT(eee->known_peers));
 
         scan->last_seen = now;
-    } else
-        traceEvent(TRACE_DEBUG, "Failed to find sender in pending_peers.");
+        arm_peer_expiry(&(eee->known_peers_expiry), scan, now);
+
+        // frames held for the peer can take the direct path now
+        eee->stats.tx_queue_p2p += tx_queue_flush(&(eee->tx_queue), scan->mac_addr, 0, send_queued_frame, eee);
+    } else {
+        // a known peer answering a revalidation probe, its direct path still works
+        scan = mac_table_find(&(eee->known_peers_index), mac);
+        if((scan != NULL) && sock_equal(&(scan->sock), peer)) {
+            scan->last_p2p = now;
+            scan->last_seen = now;
+            scan->reval_probes = 0;
+
+            traceEvent(TRACE_DEBUG, "P2P connection revalidated: %s [%s]",
+                       macaddr_str(mac_buf, mac),
+                       sock_to_cstr(sockbuf, peer));
+        } else
+            traceEvent(TRACE_DEBUG, "Failed to find sender in pending_peers.");
+    }
 }
 
 /* ************************************** */
@@ -685,7 +819,9 @@ static void check_known_peer_sock_change (n2n_edge_t *eee,
                        sock_to_cstr(sockbuf2, peer));
             /* The peer has changed public socket. It can no longer be assumed to be reachable. */
             HASH_DEL(eee->known_peers, scan);
-            free(scan);
+            mac_table_remove(&(eee->known_peers_index), scan->mac_addr);
+            timer_wheel_disarm(&(scan->expiry));
+            peer_info_free(scan);
 
             register_with_new_peer(eee, from_supernode, mac, dev_addr, dev_desc, peer);
         } else {
@@ -763,7 +899,41 @@ static void check_join_multicast_group (n2n_edge_t *eee) {
 
 /* ************************************** */
 
-/** Send a QUERY_PEER packet to the current supernode. */
+/** Send a PING, a QUERY_PEER for the null MAC which the supernode answers itself, and note the
+ *  time for taking an rtt sample from the answer. */
+static void send_ping (n2n_edge_t *eee, struct peer_info *sn) {
+
+    uint8_t pktbuf[N2N_PKT_BUF_SIZE];
+    size_t idx;
+    n2n_common_t cmn = {0};
+    n2n_QUERY_PEER_t query = {{0}};
+
+    cmn.ttl = N2N_DEFAULT_TTL;
+    cmn.pc = n2n_query_peer;
+    cmn.flags = 0;
+    memcpy(cmn.community, eee->conf.community_name, N2N_COMMUNITY_SIZE);
+
+    idx = 0;
+    encode_mac(query.srcMac, &idx, eee->device.mac_addr);
+
+    idx = 0;
+    encode_mac(query.targetMac, &idx, null_mac);
+
+    idx = 0;
+    encode_QUERY_PEER(pktbuf, &idx, &cmn, &query);
+
+    if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
+        packet_header_encrypt(pktbuf, idx, idx,
+                              eee->conf.header_encryption_ctx, eee->conf.header_iv_ctx,
+                              time_stamp());
+    }
+
+    sn->cold->ping_sent = time_usec();
+    sendto_sock(eee->udp_sock, pktbuf, idx, &(sn->sock));
+}
+
+
+/** Send a QUERY_PEER packet to the current supernode, or a PING to all supernodes for the null MAC. */
 static void send_query_peer (n2n_edge_t * eee,
                              const n2n_mac_t dstMac) {
 
@@ -772,7 +942,15 @@ static void send_query_peer (n2n_edge_t * eee,
     n2n_common_t cmn = {0};
     n2n_QUERY_PEER_t query = {{0}};
     struct peer_info *peer, *tmp;
-    uint8_t tmp_pkt[N2N_PKT_BUF_SIZE];
+
+    if(memcmp(dstMac, null_mac, sizeof(n2n_mac_t)) == 0) {
+        traceEvent(TRACE_DEBUG, "send PING to supernodes");
+
+        HASH_ITER(hh, eee->conf.supernodes, peer, tmp) {
+            send_ping(eee, peer);
+        }
+        return;
+    }
 
     cmn.ttl = N2N_DEFAULT_TTL;
     cmn.pc = n2n_query_peer;
@@ -788,30 +966,161 @@ static void send_query_peer (n2n_edge_t * eee,
     idx = 0;
     encode_QUERY_PEER(pktbuf, &idx, &cmn, &query);
 
-    if(memcmp(dstMac, null_mac, sizeof(n2n_mac_t)) != 0) {
+    traceEvent(TRACE_DEBUG, "send QUERY_PEER to supernode");
 
-        traceEvent(TRACE_DEBUG, "send QUERY_PEER to supernode");
+    if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
+        packet_header_encrypt(pktbuf, idx, idx,
+                              eee->conf.header_encryption_ctx, eee->conf.header_iv_ctx,
+                              time_stamp ());
+    }
 
-        if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
-            packet_header_encrypt(pktbuf, idx, idx,
-                                  eee->conf.header_encryption_ctx, eee->conf.header_iv_ctx,
-                                  time_stamp ());
-        }
+    sendto_sock(eee->udp_sock, pktbuf, idx, &(eee->supernode));
+}
 
-        sendto_sock(eee->udp_sock, pktbuf, idx, &(eee->supernode));
 
-    } else {
-        traceEvent(TRACE_DEBUG, "send PING to supernodes");
+/** Send the peers collected in the batch to the current supernode, all in one QUERY_PEER. */
+static void flush_query_batch (n2n_edge_t *eee) {
 
-        if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
-            packet_header_encrypt(pktbuf, idx, idx,
-                                  eee->conf.header_encryption_ctx, eee->conf.header_iv_ctx,
-                                  time_stamp ());
-        }
+    uint8_t pktbuf[N2N_PKT_BUF_SIZE];
+    size_t idx;
+    n2n_common_t cmn = {0};
+    n2n_QUERY_PEER_t query = {{0}};
 
-        HASH_ITER(hh, eee->conf.supernodes, peer, tmp) {
-            sendto_sock(eee->udp_sock, pktbuf, idx, &(peer->sock));
+    if(eee->query_batch_num == 0)
+        return;
+
+    cmn.ttl = N2N_DEFAULT_TTL;
+    cmn.pc = n2n_query_peer;
+    cmn.flags = 0;
+    memcpy(cmn.community, eee->conf.community_name, N2N_COMMUNITY_SIZE);
+
+    memcpy(query.srcMac, eee->device.mac_addr, N2N_MAC_SIZE);
+    memcpy(query.targetMac, eee->query_batch[0], N2N_MAC_SIZE);
+    query.num_targets = eee->query_batch_num - 1;
+    memcpy(query.targets, eee->query_batch[1], query.num_targets * N2N_MAC_SIZE);
+
+    idx = 0;
+    encode_QUERY_PEER(pktbuf, &idx, &cmn, &query);
+
+    traceEvent(TRACE_DEBUG, "send QUERY_PEER for %u peers to supernode", (unsigned int)eee->query_batch_num);
+
+    if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
+        packet_header_encrypt(pktbuf, idx, idx,
+                              eee->conf.header_encryption_ctx, eee->conf.header_iv_ctx,
+                              time_stamp());
+    }
+
+    sendto_sock(eee->udp_sock, pktbuf, idx, &(eee->supernode));
+
+    eee->stats.query_sent += eee->query_batch_num;
+    eee->stats.query_msgs++;
+    eee->query_batch_num = 0;
+    eee->query_batch_due = 0;
+}
+
+
+/** Query a peer at the supernode. If the supernode takes batches, the query waits a few
+ *  milliseconds for further ones to share its QUERY_PEER. */
+static void queue_query_peer (n2n_edge_t *eee, const n2n_mac_t mac) {
+
+    if(!(eee->sn_features & N2N_FEATURE_QUERY_BATCH)) {
+        send_query_peer(eee, mac);
+        eee->stats.query_sent++;
+        eee->stats.query_msgs++;
+        return;
+    }
+
+    memcpy(eee->query_batch[eee->query_batch_num], mac, N2N_MAC_SIZE);
+    if(eee->query_batch_num++ == 0) {
+        eee->query_batch_due = time_usec() + N2N_QUERY_BATCH_WINDOW * 1000;
+    }
+
+    if(eee->query_batch_num == N2N_QUERY_BATCH_MAX) {
+        flush_query_batch(eee);
+    }
+}
+
+
+/** Send the batch of peer queries once its time has come, called from the main loop. */
+static void run_query_batch (n2n_edge_t *eee) {
+
+    if(eee->query_batch_num && (time_usec() >= eee->query_batch_due)) {
+        flush_query_batch(eee);
+    }
+}
+
+
+/** Ask the current supernode for the next page of the community's peer list. */
+static void send_peer_list_request (n2n_edge_t *eee) {
+
+    uint8_t pktbuf[N2N_PKT_BUF_SIZE];
+    size_t idx;
+    n2n_common_t cmn = {0};
+    n2n_QUERY_PEER_t query = {{0}};
+
+    cmn.ttl = N2N_DEFAULT_TTL;
+    cmn.pc = n2n_query_peer;
+    cmn.flags = 0;
+    memcpy(cmn.community, eee->conf.community_name, N2N_COMMUNITY_SIZE);
+
+    memcpy(query.srcMac, eee->device.mac_addr, N2N_MAC_SIZE);
+    memcpy(query.targetMac, broadcast_mac, N2N_MAC_SIZE);
+    query.page = eee->peer_list_page;
+
+    idx = 0;
+    encode_QUERY_PEER(pktbuf, &idx, &cmn, &query);
+
+    traceEvent(TRACE_DEBUG, "send QUERY_PEER for page %u of the peer list to supernode", (unsigned int)query.page);
+
+    if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
+        packet_header_encrypt(pktbuf, idx, idx,
+                              eee->conf.header_encryption_ctx, eee->conf.header_iv_ctx,
+                              time_stamp());
+    }
+
+    sendto_sock(eee->udp_sock, pktbuf, idx, &(eee->supernode));
+}
+
+
+/** Register with the peers found on a page of the peer list right away and ask for the next
+ *  page. A page lists up to N2N_PEER_LIST_PAGE peers, so each of them gets probed at the socket
+ *  listed as a cached peer would, without predicted ports, and one REGISTER through the
+ *  supernode which asks the peer to punch back from its side. */
+static void peer_list_received (n2n_edge_t *eee, const n2n_PEER_INFO_t *pi) {
+
+    struct peer_info *scan;
+    uint8_t i;
+
+    if(eee->peer_list_done || (pi->page != eee->peer_list_page)) {
+        /* duplicate or late */
+        return;
+    }
+
+    for(i = 0; i < pi->num_peers; i++) {
+        if(!memcmp(pi->peer_macs[i], eee->device.mac_addr, N2N_MAC_SIZE)
+           || !is_valid_peer_sock(&(pi->peer_socks[i]))) {
+            continue;
         }
+        HASH_FIND_PEER(eee->known_peers, pi->peer_macs[i], scan);
+        if(!scan) {
+            HASH_FIND_PEER(eee->pending_peers, pi->peer_macs[i], scan);
+        }
+        if(scan) {
+            continue;
+        }
+        register_with_new_peer(eee, 0, pi->peer_macs[i], NULL, NULL, &(pi->peer_socks[i]));
+        send_register(eee, &(eee->supernode), pi->peer_macs[i]);
+        eee->stats.peer_list_peers++;
+    }
+
+    traceEvent(TRACE_INFO, "Rx PEER_INFO page %u of the peer list with %u peers",
+               (unsigned int)pi->page, (unsigned int)pi->num_peers);
+
+    if((pi->aflags & N2N_AFLAGS_PEER_LIST_MORE) && (eee->peer_list_page < UINT8_MAX)) {
+        eee->peer_list_page++;
+        send_peer_list_request(eee);
+    } else {
+        eee->peer_list_done = 1;
     }
 }
 
@@ -836,20 +1145,41 @@ static void send_register_super (n2n_edge_t *eee) {
     memcpy(cmn.community, eee->conf.community_name, N2N_COMMUNITY_SIZE);
 
     for(idx = 0; idx < N2N_COOKIE_SIZE; ++idx) {
-        eee->curr_sn->last_cookie[idx] = n2n_rand() % 0xff;
+        eee->curr_sn->cold->last_cookie[idx] = n2n_rand() % 0xff;
     }
 
-    memcpy(reg.cookie, eee->curr_sn->last_cookie, N2N_COOKIE_SIZE);
+    memcpy(reg.cookie, eee->curr_sn->cold->last_cookie, N2N_COOKIE_SIZE);
     reg.dev_addr.net_addr = ntohl(eee->device.ip_addr);
     reg.dev_addr.net_bitlen = mask2bitlen(ntohl(eee->device.device_mask));
     memcpy(reg.dev_desc, eee->conf.dev_desc, N2N_DESC_SIZE);
     memcpy(&(reg.auth), &(eee->conf.auth), sizeof(n2n_auth_t));
+    /* the compact PACKET header cannot be encrypted */
+    if(eee->conf.header_encryption != HEADER_ENCRYPTION_ENABLED) {
+        reg.features |= N2N_FEATURE_COMPACT_PACKET;
+    }
+    /* lets the supernode keep the registration for a few of the (possibly adapted) intervals */
+    reg.features |= N2N_FEATURE_KEEPALIVE | N2N_FEATURE_QUERY_BATCH | N2N_FEATURE_PEER_LIST;
+    reg.keepalive = keepalive_interval(eee);
+    if(eee->conf.allow_p2p) {
+        reg.features |= N2N_FEATURE_BCAST_P2P;
+    }
+    /* the multicast groups joined behind the tap device, none if multicast gets dropped anyway */
+    if(eee->conf.mcast_snoop && !eee->mcast_snoop.overflow) {
+        reg.features |= N2N_FEATURE_MCAST_SNOOP;
+        if(!eee->conf.drop_multicast) {
+            for(idx = 0; idx < eee->mcast_snoop.num_groups; idx++) {
+                memcpy(reg.mcast_groups[idx], eee->mcast_snoop.groups[idx].mac, sizeof(n2n_mac_t));
+            }
+            reg.num_mcast_groups = eee->mcast_snoop.num_groups;
+        }
+    }
 
     idx = 0;
     encode_mac(reg.edgeMac, &idx, eee->device.mac_addr);
 
     idx = 0;
     encode_REGISTER_SUPER(pktbuf, &idx, &cmn, &reg);
+    eee->sn_register_sent = time_usec();
 
     traceEvent(TRACE_DEBUG, "send REGISTER_SUPER to %s",
                sock_to_cstr(sockbuf, &(eee->curr_sn->sock)));
@@ -910,6 +1240,8 @@ static int sort_supernodes (n2n_edge_t *eee, time_t now) {
 
         eee->curr_sn = eee->conf.supernodes;
         memcpy(&eee->supernode, &(eee->curr_sn->sock), sizeof(n2n_sock_t));
+        eee->compact_community_id = 0; /* granted per supernode */
+        eee->sn_features = 0;
         eee->sup_attempts = N2N_EDGE_SUP_ATTEMPTS;
 
         traceEvent(TRACE_INFO, "Registering with supernode [%s][number of supernodes %d][attempts left %u]",
@@ -936,13 +1268,277 @@ static int sort_supernodes (n2n_edge_t *eee, time_t now) {
         eee->last_sweep = now;
     }
 
-    return 0; /* OK */
+    return 0; /* OK */
+}
+
+/* ************************************** */
+
+/** Find the supernode to keep warm for fast failover: the first one in selection order that
+ *  recently answered. If none did, the others get probed in turn.
+ */
+static struct peer_info* find_standby_supernode (n2n_edge_t *eee, time_t now) {
+
+    struct peer_info *scan, *tmp;
+    uint32_t num = 0, pick;
+
+    HASH_ITER(hh, eee->conf.supernodes, scan, tmp) {
+        if(scan == eee->curr_sn) {
+            continue;
+        }
+        if(scan->last_seen + N2N_EDGE_FAILOVER_FRESH >= now) {
+            return scan;
+        }
+        num++;
+    }
+
+    if(num == 0) {
+        return NULL;
+    }
+
+    pick = (eee->standby_rr++) % num;
+    HASH_ITER(hh, eee->conf.supernodes, scan, tmp) {
+        if(scan == eee->curr_sn) {
+            continue;
+        }
+        if(pick == 0) {
+            return scan;
+        }
+        pick--;
+    }
+
+    return NULL;
+}
+
+
+/** Fast failover: probe the current and a standby supernode at a sub-second interval and
+ *  switch to the standby as soon as the current one misses a few keepalives. The standby is
+ *  not registered with in advance, a registration would relocate the edge in the federation.
+ *  Regular re-registration and the slow failover in update_supernode_reg() remain in place.
+ */
+static int check_supernode_failover (n2n_edge_t *eee, time_t now) {
+
+    struct peer_info *standby;
+    uint64_t now_usec, timeout;
+
+    if(eee->conf.failover_interval == 0) {
+        return 0;
+    }
+
+    now_usec = time_usec();
+    if(now_usec - eee->keepalive_sent < (uint64_t)eee->conf.failover_interval * 1000) {
+        return 0; /* too early */
+    }
+    eee->keepalive_sent = now_usec;
+
+    if(eee->keepalive_sn != eee->curr_sn) {
+        // started or switched supernode, the new one gets the full timeout
+        eee->keepalive_sn = eee->curr_sn;
+        eee->sn_last_heard = now_usec;
+    }
+
+    standby = find_standby_supernode(eee, now);
+
+    // missed keepalives plus a retransmission timeout as in RFC 6298 (0 if not measured yet)
+    timeout = (uint64_t)eee->conf.failover_interval * 1000 * N2N_EDGE_FAILOVER_MISSED
+              + eee->curr_sn->cold->srtt + 4 * eee->curr_sn->cold->rttvar;
+
+    if((now_usec - eee->sn_last_heard > timeout)
+       && (standby != NULL) && (standby->last_seen + N2N_EDGE_FAILOVER_FRESH >= now)) {
+        traceEvent(TRACE_WARNING, "Supernode %s silent for %u ms, failing over to %s",
+                   supernode_ip(eee), (unsigned int)((now_usec - eee->sn_last_heard) / 1000), standby->cold->ip_addr);
+
+        eee->stats.sn_failover++;
+        if(eee->failover_since == 0) {
+            eee->failover_since = eee->sn_last_heard;
+        }
+
+        // move the standby to the head of the list, sort_supernodes() switches over to it
+        sn_selection_criterion_default(&(eee->curr_sn->selection_criterion));
+        standby->selection_criterion = 0;
+        sn_selection_sort(&(eee->conf.supernodes));
+
+        return 0;
+    }
+
+    send_ping(eee, eee->curr_sn);
+    if(standby != NULL) {
+        send_ping(eee, standby);
+    }
+
+    return 0; /* OK */
+}
+
+/* ************************************** */
+
+// NAT lifetime discovery: a PING carrying a delay gets answered by the supernode right away
+// and once more after the delay. Sent from a fresh socket, i.e. through a fresh NAT binding
+// without any further traffic, the delayed answer only makes it through if the binding
+// lived at least that long. The delay is doubled starting from the registration interval
+// and then bisected, the keepalives to the supernode and to the peers follow the longest
+// lifetime confirmed.
+
+/** Keepalive interval in seconds: just under the NAT binding lifetime confirmed with the
+ *  current supernode, else the configured registration interval. */
+static int keepalive_interval (const n2n_edge_t *eee) {
+
+    if(eee->conf.fixed_keepalive || (eee->nat_lifetime_lo == 0) || (eee->nat_probe_sn != eee->curr_sn))
+        return eee->conf.register_interval;
+
+    return max(eee->nat_lifetime_lo * 9 / 10, 1);
+}
+
+
+static int nat_lifetime_found (const n2n_edge_t *eee) {
+
+    return (eee->nat_lifetime_lo >= N2N_NAT_PROBE_DELAY_MAX)
+           || (eee->nat_lifetime_hi && (eee->nat_lifetime_hi - eee->nat_lifetime_lo <= N2N_NAT_PROBE_RESOLUTION));
+}
+
+
+static void close_nat_probe (n2n_edge_t *eee, time_t next) {
+
+    if(eee->nat_probe_sock >= 0)
+        closesocket(eee->nat_probe_sock);
+    eee->nat_probe_sock = -1;
+    eee->nat_probe_scheduled = 0;
+    eee->nat_probe_time = next;
+}
+
+
+/** Send the next probe, a PING with a delay, from a fresh socket. */
+static void send_nat_probe (n2n_edge_t *eee, time_t now) {
+
+    uint8_t pktbuf[N2N_PKT_BUF_SIZE];
+    size_t idx;
+    n2n_common_t cmn = {0};
+    n2n_QUERY_PEER_t query = {{0}};
+    uint16_t lo, hi;
+
+    if(nat_lifetime_found(eee)) {
+        // re-check, the NAT might have changed: search upwards again from half the lifetime
+        eee->nat_lifetime_lo /= 2;
+        eee->nat_lifetime_hi = 0;
+    }
+    lo = eee->nat_lifetime_lo;
+    hi = eee->nat_lifetime_hi;
+
+    if(hi) {
+        eee->nat_probe_delay = max((lo + hi) / 2, N2N_NAT_PROBE_DELAY_MIN);
+    } else if(lo) {
+        eee->nat_probe_delay = min(2 * lo, N2N_NAT_PROBE_DELAY_MAX);
+    } else {
+        eee->nat_probe_delay = min(max(eee->conf.register_interval, N2N_NAT_PROBE_DELAY_MIN), N2N_NAT_PROBE_DELAY_MAX);
+    }
+
+    eee->nat_probe_sock = open_socket(0, 1 /* bind ANY */);
+    if(eee->nat_probe_sock < 0) {
+        close_nat_probe(eee, now + N2N_NAT_PROBE_RETRY);
+        return;
+    }
+
+    cmn.ttl = N2N_DEFAULT_TTL;
+    cmn.pc = n2n_query_peer;
+    cmn.flags = 0;
+    memcpy(cmn.community, eee->conf.community_name, N2N_COMMUNITY_SIZE);
+
+    idx = 0;
+    encode_mac(query.srcMac, &idx, eee->device.mac_addr);
+
+    // null target: the supernode answers itself
+    idx = 0;
+    encode_mac(query.targetMac, &idx, null_mac);
+    query.delay = eee->nat_probe_delay;
+
+    idx = 0;
+    encode_QUERY_PEER(pktbuf, &idx, &cmn, &query);
+
+    if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
+        packet_header_encrypt(pktbuf, idx, idx,
+                              eee->conf.header_encryption_ctx, eee->conf.header_iv_ctx,
+                              time_stamp());
+    }
+
+    traceEvent(TRACE_DEBUG, "send NAT binding lifetime probe, %u seconds", (unsigned int)eee->nat_probe_delay);
+
+    sendto_sock(eee->nat_probe_sock, pktbuf, idx, &(eee->supernode));
+    eee->nat_probe_scheduled = 0;
+    eee->nat_probe_time = now;
+}
+
+
+/** Done with the probe in flight, the next one is due right away unless the search is over. */
+static void finish_nat_probe (n2n_edge_t *eee, time_t now) {
+
+    if(nat_lifetime_found(eee)) {
+        traceEvent(TRACE_NORMAL, "NAT binding lifetime %u to %u seconds, keepalive every %u seconds",
+                   (unsigned int)eee->nat_lifetime_lo, (unsigned int)eee->nat_lifetime_hi,
+                   (unsigned int)keepalive_interval(eee));
+        close_nat_probe(eee, now + N2N_NAT_PROBE_RECHECK);
+    } else {
+        close_nat_probe(eee, now);
+    }
+}
+
+
+/** An answer to the probe in flight arrived on its socket. */
+static void nat_probe_answered (n2n_edge_t *eee, const n2n_PEER_INFO_t *pi, time_t now) {
+
+    if(pi->aflags & N2N_AFLAGS_NAT_PROBE) {
+        // the binding survived the delay
+        eee->nat_lifetime_lo = max(eee->nat_lifetime_lo, eee->nat_probe_delay);
+        finish_nat_probe(eee, now);
+    } else if(pi->aflags & N2N_AFLAGS_NAT_PROBE_SCHEDULED) {
+        eee->nat_probe_scheduled = 1;
+    } else {
+        traceEvent(TRACE_INFO, "Supernode does not probe the NAT binding lifetime");
+        close_nat_probe(eee, now + N2N_NAT_PROBE_RECHECK);
+    }
+}
+
+
+/** Drive the NAT lifetime discovery, called from the main loop. */
+static void check_nat_lifetime (n2n_edge_t *eee, time_t now) {
+
+    if(eee->conf.fixed_keepalive)
+        return;
+
+    if(eee->nat_probe_sn != eee->curr_sn) {
+        // another supernode might be reached through another binding, start over
+        eee->nat_probe_sn = eee->curr_sn;
+        eee->nat_lifetime_lo = 0;
+        eee->nat_lifetime_hi = 0;
+        close_nat_probe(eee, now);
+    }
+
+    if(eee->nat_probe_sock >= 0) {
+        if(eee->nat_probe_scheduled) {
+            if(now <= eee->nat_probe_time + eee->nat_probe_delay + N2N_NAT_PROBE_GRACE)
+                return;
+            // the delayed answer did not make it through, the binding expired earlier
+            eee->nat_lifetime_hi = eee->nat_probe_delay;
+            finish_nat_probe(eee, now);
+            return;
+        } else {
+            if(now <= eee->nat_probe_time + N2N_NAT_PROBE_GRACE)
+                return;
+            // no answer at all, try again later
+            close_nat_probe(eee, now + N2N_NAT_PROBE_RETRY);
+            return;
+        }
+    }
+
+    // the supernode only serves registered edges
+    if(eee->sn_wait || (now < eee->nat_probe_time))
+        return;
+
+    send_nat_probe(eee, now);
 }
 
-/** Send a REGISTER packet to another edge. */
-static void send_register (n2n_edge_t * eee,
-                           const n2n_sock_t * remote_peer,
-                           const n2n_mac_t peer_mac) {
+/** Send a REGISTER packet to another edge, the cookie gets returned by its REGISTER_ACK. */
+static void send_register_cookie (n2n_edge_t * eee,
+                                  const n2n_sock_t * remote_peer,
+                                  const n2n_mac_t peer_mac,
+                                  uint32_t cookie) {
 
     uint8_t pktbuf[N2N_PKT_BUF_SIZE];
     size_t idx;
@@ -964,7 +1560,7 @@ static void send_register (n2n_edge_t * eee,
     memcpy(cmn.community, eee->conf.community_name, N2N_COMMUNITY_SIZE);
 
     idx = 0;
-    encode_uint32(reg.cookie, &idx, 123456789);
+    encode_uint32(reg.cookie, &idx, cookie);
     idx = 0;
     encode_mac(reg.srcMac, &idx, eee->device.mac_addr);
 
@@ -992,6 +1588,14 @@ static void send_register (n2n_edge_t * eee,
     /* sent = */ sendto_sock(eee->udp_sock, pktbuf, idx, remote_peer);
 }
 
+/** Send a REGISTER packet to another edge. */
+static void send_register (n2n_edge_t * eee,
+                           const n2n_sock_t * remote_peer,
+                           const n2n_mac_t peer_mac) {
+
+    send_register_cookie(eee, remote_peer, peer_mac, 123456789);
+}
+
 /* ************************************** */
 
 /** Send a REGISTER_ACK packet to a peer edge. */
@@ -1095,7 +1699,13 @@ void update_supernode_reg (n2n_edge_t * eee, time_t nowTime) {
     if(eee->sn_wait && (nowTime > (eee->last_register_req + (eee->conf.register_interval/10)))) {
         /* fall through */
         traceEvent(TRACE_DEBUG, "update_supernode_reg: doing fast retry.");
-    } else if(nowTime < (eee->last_register_req + eee->conf.register_interval))
+        if(eee->nat_lifetime_lo && (eee->sup_attempts == N2N_EDGE_SUP_ATTEMPTS - 1)) {
+            /* the NAT binding might not last as long as probed, search below -- once per missed
+             * registration, i.e. on its first retry, the retries are sent at a short interval */
+            eee->nat_lifetime_hi = eee->nat_lifetime_lo;
+            eee->nat_lifetime_lo /= 2;
+        }
+    } else if(nowTime < (eee->last_register_req + keepalive_interval(eee)))
         return; /* Too early */
 
     check_join_multicast_group(eee);
@@ -1106,6 +1716,8 @@ void update_supernode_reg (n2n_edge_t * eee, time_t nowTime) {
         sn_selection_sort(&(eee->conf.supernodes));
         eee->curr_sn = eee->conf.supernodes;
         memcpy(&eee->supernode, &(eee->curr_sn->sock), sizeof(n2n_sock_t));
+        eee->compact_community_id = 0; /* granted per supernode */
+        eee->sn_features = 0;
 
         traceEvent(TRACE_WARNING, "Supernode not responding, now trying %s", supernode_ip(eee));
 
@@ -1126,7 +1738,7 @@ void update_supernode_reg (n2n_edge_t * eee, time_t nowTime) {
         --(eee->sup_attempts);
     }
 
-    if(supernode2sock(&(eee->supernode), eee->curr_sn->ip_addr) == 0) {
+    if(supernode2sock(&(eee->supernode), eee->curr_sn->cold->ip_addr) == 0) {
         traceEvent(TRACE_INFO, "Registering with supernode [%s][number of supernodes %d][attempts left %u]",
                    supernode_ip(eee), HASH_COUNT(eee->conf.supernodes), (unsigned int)eee->sup_attempts);
 
@@ -1146,7 +1758,7 @@ void update_supernode_reg (n2n_edge_t * eee, time_t nowTime) {
 /** Return the IP address of the current supernode in the ring. */
 static const char * supernode_ip (const n2n_edge_t * eee) {
 
-    return (eee->curr_sn->ip_addr);
+    return (eee->curr_sn->cold->ip_addr);
 }
 
 /* ************************************** */
@@ -1286,6 +1898,8 @@ static int handle_PACKET (n2n_edge_t * eee,
                 eth_size = tmp_eth_size;
             }
 
+            arp_proxy_snoop(&(eee->arp_proxy), eth_payload, eth_size, now);
+
             /* Write ethernet packet to tap device. */
             traceEvent(TRACE_DEBUG, "sending to TAP %u", (unsigned int)eth_size);
             data_sent_len = tuntap_write(&(eee->device), eth_payload, eth_size);
@@ -1365,6 +1979,7 @@ static void readFromMgmtSocket (n2n_edge_t *eee, int *keep_running) {
     n2n_sock_str_t sockbuf;
     uint32_t num_pending_peers = 0;
     uint32_t num_known_peers = 0;
+    peer_pool_stats_t pool_stats;
     uint32_t num = 0;
     selection_criterion_str_t sel_buf;
 
@@ -1388,6 +2003,7 @@ static void readFromMgmtSocket (n2n_edge_t *eee, int *keep_running) {
                             "\thelp    | This help message\n"
                             "\t+verb   | Increase verbosity of logging\n"
                             "\t-verb   | Decrease verbosity of logging\n"
+                            "\tselect  | Select supernode by round trip time or by load, 'select rtt|load'\n"
                             "\t<enter> | Display statistics\n\n");
 
         sendto(eee->udp_mgmt_sock, udp_buf, msg_len, 0/*flags*/,
@@ -1435,6 +2051,37 @@ static void readFromMgmtSocket (n2n_edge_t *eee, int *keep_running) {
         return;
     }
 
+    if(0 == memcmp(udp_buf, "select ", 7)) {
+        msg_len = 0;
+
+        if(0 == memcmp(udp_buf + 7, "rtt", 3)) {
+            eee->conf.sn_selection_strategy = SN_SELECTION_STRATEGY_RTT;
+        } else if(0 == memcmp(udp_buf + 7, "load", 4)) {
+            eee->conf.sn_selection_strategy = SN_SELECTION_STRATEGY_LOAD;
+        } else {
+            msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                                "> -NOK use 'select rtt' or 'select load'\n");
+        }
+
+        if(msg_len == 0) {
+            // criteria of the other strategy are meaningless, the next sweep re-evaluates
+            HASH_ITER(hh, eee->conf.supernodes, peer, tmpPeer) {
+                sn_selection_criterion_default(&(peer->selection_criterion));
+            }
+            eee->last_sweep = 0;
+
+            traceEvent(TRACE_NORMAL, "supernode selection by %s",
+                       (eee->conf.sn_selection_strategy == SN_SELECTION_STRATEGY_RTT) ? "rtt" : "load");
+            msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                                "> +OK supernode selection by %s\n",
+                                (eee->conf.sn_selection_strategy == SN_SELECTION_STRATEGY_RTT) ? "rtt" : "load");
+        }
+
+        sendto(eee->udp_mgmt_sock, udp_buf, msg_len, 0/*flags*/,
+               (struct sockaddr *) &sender_sock, sizeof(struct sockaddr_in));
+        return;
+    }
+
     traceEvent(TRACE_DEBUG, "mgmt status rq");
 
     msg_len = 0;
@@ -1458,7 +2105,7 @@ static void readFromMgmtSocket (n2n_edge_t *eee, int *keep_running) {
                             ++num, inet_ntoa(*(struct in_addr *) &net),
                             macaddr_str(mac_buf, peer->mac_addr),
                             sock_to_cstr(sockbuf, &(peer->sock)),
-                            peer->dev_desc,
+                            peer->cold->dev_desc,
                             now - peer->last_seen);
 
         sendto(eee->udp_mgmt_sock, udp_buf, msg_len, 0/*flags*/,
@@ -1478,7 +2125,7 @@ static void readFromMgmtSocket (n2n_edge_t *eee, int *keep_running) {
                             ++num, inet_ntoa(*(struct in_addr *) &net),
                             macaddr_str(mac_buf, peer->mac_addr),
                             sock_to_cstr(sockbuf, &(peer->sock)),
-                            peer->dev_desc,
+                            peer->cold->dev_desc,
                             now - peer->last_seen);
 
         sendto(eee->udp_mgmt_sock, udp_buf, msg_len, 0/*flags*/,
@@ -1501,7 +2148,7 @@ static void readFromMgmtSocket (n2n_edge_t *eee, int *keep_running) {
                             (peer->purgeable == SN_UNPURGEABLE) ? "-l " : "    ",
                             macaddr_str(mac_buf, peer->mac_addr),
                             sock_to_cstr(sockbuf, &(peer->sock)),
-                            sn_selection_criterion_str(sel_buf, peer),
+                            sn_selection_criterion_str(eee, sel_buf, peer),
                             now - peer->last_seen);
 
         sendto(eee->udp_mgmt_sock, udp_buf, msg_len, 0,
@@ -1536,9 +2183,10 @@ static void readFromMgmtSocket (n2n_edge_t *eee, int *keep_running) {
                         (unsigned int) eee->stats.rx_sup);
 
     msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
-                        "p2p %u,%u\n",
+                        "p2p %u,%u | broadcast p2p %u\n",
                         (unsigned int) eee->stats.tx_p2p,
-                        (unsigned int) eee->stats.rx_p2p);
+                        (unsigned int) eee->stats.rx_p2p,
+                        (unsigned int) eee->stats.tx_p2p_broadcast);
 
     msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
                         "last_super %ld sec ago | ",
@@ -1548,6 +2196,80 @@ static void readFromMgmtSocket (n2n_edge_t *eee, int *keep_running) {
                         "last_p2p %ld sec ago\n",
                         (now - eee->last_p2p));
 
+    if(eee->conf.tx_queue_window) {
+        msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                            "held %u | p2p %u | relay %u | drop %u\n",
+                            (unsigned int) eee->stats.tx_queued,
+                            (unsigned int) eee->stats.tx_queue_p2p,
+                            (unsigned int) eee->stats.tx_queue_relay,
+                            (unsigned int) eee->stats.tx_queue_drop);
+    }
+
+    if(eee->conf.allow_p2p) {
+        msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                            "p2p paths %u/%u (%u%%) | reflexive %u | predicted %u | lan %u | peer %u\n",
+                            (unsigned int) eee->stats.p2p_established,
+                            (unsigned int) eee->stats.p2p_attempts,
+                            (unsigned int) (eee->stats.p2p_attempts ? (uint64_t)eee->stats.p2p_established * 100 / eee->stats.p2p_attempts : 0),
+                            (unsigned int) eee->stats.p2p_reflexive,
+                            (unsigned int) eee->stats.p2p_predicted,
+                            (unsigned int) eee->stats.p2p_lan,
+                            (unsigned int) eee->stats.p2p_peer);
+    }
+
+    msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                        "queries %u (%u msgs) | answered %u | backed off %u | peer list %u\n",
+                        (unsigned int) eee->stats.query_sent,
+                        (unsigned int) eee->stats.query_msgs,
+                        (unsigned int) eee->stats.query_answered,
+                        (unsigned int) eee->stats.query_backoff,
+                        (unsigned int) eee->stats.peer_list_peers);
+
+    if(eee->conf.arp_proxy) {
+        msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                            "arp proxy answered %u | missed %u\n",
+                            (unsigned int) eee->stats.arp_proxy_answered,
+                            (unsigned int) eee->stats.arp_proxy_missed);
+    }
+
+    if(eee->conf.mcast_snoop && !eee->conf.drop_multicast) {
+        msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                            "mcast groups %u%s | announced %u\n",
+                            (unsigned int) eee->mcast_snoop.num_groups,
+                            eee->mcast_snoop.overflow ? " (overflow)" : "",
+                            (unsigned int) eee->stats.mcast_announced);
+    }
+
+    if(!eee->conf.fixed_keepalive) {
+        msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                            "nat lifetime %u-%u sec | probing %u sec | keepalive %u sec\n",
+                            (unsigned int) eee->nat_lifetime_lo,
+                            (unsigned int) eee->nat_lifetime_hi,
+                            (unsigned int) ((eee->nat_probe_sock >= 0) ? eee->nat_probe_delay : 0),
+                            (unsigned int) keepalive_interval(eee));
+    }
+
+    if(eee->conf.failover_interval) {
+        msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                            "failover %u | last %u ms | max %u ms\n",
+                            (unsigned int) eee->stats.sn_failover,
+                            (unsigned int) eee->stats.sn_failover_last_ms,
+                            (unsigned int) eee->stats.sn_failover_max_ms);
+    }
+
+    peer_pool_get_stats(&pool_stats);
+    msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                        "mem/peer %u B (%u hot + %u cold) | ",
+                        (unsigned int) (sizeof(struct peer_info) + sizeof(struct peer_info_cold)),
+                        (unsigned int) sizeof(struct peer_info),
+                        (unsigned int) sizeof(struct peer_info_cold));
+
+    msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
+                        "peer_pool %u/%u, %u KB\n",
+                        (unsigned int) pool_stats.in_use,
+                        (unsigned int) pool_stats.capacity,
+                        (unsigned int) (pool_stats.bytes / 1024));
+
     msg_len += snprintf((char *) (udp_buf + msg_len), (N2N_PKT_BUF_SIZE - msg_len),
                         "\nType \"help\" to see more commands.\n\n");
 
@@ -1564,25 +2286,34 @@ static int check_query_peer_info (n2n_edge_t *eee, time_t now, n2n_mac_t mac) {
 
     HASH_FIND_PEER(eee->pending_peers, mac, scan);
 
+    if(scan && (now - scan->last_sent_query <= eee->conf.register_interval)) {
+        return(1);
+    }
+
+    // peers not reached get queried less and less often, also beyond their pending entry
+    if(!query_cache_admit(&(eee->query_cache), mac, eee->conf.register_interval, N2N_QUERY_BACKOFF_MAX, now)) {
+        eee->stats.query_backoff++;
+        return(1);
+    }
+
     if(!scan) {
-        scan = calloc(1, sizeof(struct peer_info));
+        scan = peer_info_alloc();
 
         memcpy(scan->mac_addr, mac, N2N_MAC_SIZE);
-        scan->timeout = eee->conf.register_interval; /* TODO: should correspond to the peer supernode registration timeout */
+        scan->timeout = keepalive_interval(eee); /* TODO: should correspond to the peer supernode registration timeout */
         scan->last_seen = now; /* Don't change this it marks the pending peer for removal. */
         scan->last_valid_time_stamp = initial_time_stamp();
+        scan->cold->tx_queue_until = time_usec() + (uint64_t)eee->conf.tx_queue_window * 1000;
 
         HASH_ADD_PEER(eee->pending_peers, scan);
+        arm_peer_expiry(&(eee->pending_peers_expiry), scan, now);
     }
 
-    if(now - scan->last_sent_query > eee->conf.register_interval) {
-        send_register(eee, &(eee->supernode), mac);
-        send_query_peer(eee, scan->mac_addr);
-        scan->last_sent_query = now;
-        return(0);
-    }
+    send_register(eee, &(eee->supernode), mac);
+    queue_query_peer(eee, scan->mac_addr);
+    scan->last_sent_query = now;
 
-    return(1);
+    return(0);
 }
 
 /* ************************************** */
@@ -1608,17 +2339,31 @@ static int find_peer_destination (n2n_edge_t * eee,
                mac_address[0] & 0xFF, mac_address[1] & 0xFF, mac_address[2] & 0xFF,
                mac_address[3] & 0xFF, mac_address[4] & 0xFF, mac_address[5] & 0xFF);
 
-    HASH_FIND_PEER(eee->known_peers, mac_address, scan);
+    scan = mac_table_find(&(eee->known_peers_index), mac_address);
 
     if(scan && (scan->last_seen > 0)) {
         if((now - scan->last_p2p) >= (scan->timeout / 2)) {
-            /* Too much time passed since we saw the peer, need to register again
-             * since the peer address may have changed. */
-            traceEvent(TRACE_DEBUG, "Refreshing idle known peer");
-            HASH_DEL(eee->known_peers, scan);
-            free(scan);
-            /* NOTE: registration will be performed upon the receival of the next response packet */
-        } else {
+            if((scan->reval_probes >= N2N_EDGE_REVAL_PROBES) && (now - scan->last_sent_query > 0)) {
+                /* The peer did not answer the direct REGISTERs, its address may have changed.
+                 * Fall back to the supernode and register again. */
+                traceEvent(TRACE_DEBUG, "Refreshing idle known peer");
+                HASH_DEL(eee->known_peers, scan);
+                mac_table_remove(&(eee->known_peers_index), scan->mac_addr);
+                timer_wheel_disarm(&(scan->expiry));
+                peer_info_free(scan);
+                scan = NULL;
+                /* NOTE: registration will be performed upon the receival of the next response packet */
+            } else if((scan->reval_probes == 0) || (now - scan->last_sent_query > 0)) {
+                /* Too much time passed since we saw the peer. Keep on using the direct path
+                 * while probing it with a REGISTER per second, the REGISTER_ACK revalidates. */
+                traceEvent(TRACE_DEBUG, "Revalidating idle known peer");
+                send_register(eee, &(scan->sock), scan->mac_addr);
+                scan->last_sent_query = now;
+                scan->reval_probes++;
+            }
+        }
+
+        if(scan != NULL) {
             /* Valid known peer found */
             memcpy(destination, &scan->sock, sizeof(n2n_sock_t));
             retval = 1;
@@ -1643,23 +2388,175 @@ static int find_peer_destination (n2n_edge_t * eee,
 
 /* ***************************************************** */
 
+/** Hold a frame to a peer whose registration is in flight rather than relaying it, for
+ *  tx_queue_window ms at most. A new destination gets registered with right away.
+ *
+ *  @return 1 if the frame got queued, 0 if it is to be sent now
+ */
+static int hold_frame (n2n_edge_t *eee, uint8_t *frame, size_t len) {
+
+    struct peer_info *scan;
+    uint64_t now;
+
+    // broadcast and multicast frames go to the supernode anyway
+    if(!eee->conf.tx_queue_window || !eee->conf.allow_p2p || (frame[0] & 0x01)) {
+        return 0;
+    }
+
+    if(mac_table_find(&(eee->known_peers_index), frame)) {
+        return 0;
+    }
+
+    HASH_FIND_PEER(eee->pending_peers, frame, scan);
+    if(scan == NULL) {
+        check_query_peer_info(eee, time(NULL), frame);
+        HASH_FIND_PEER(eee->pending_peers, frame, scan);
+        if(scan == NULL) {
+            return 0;
+        }
+    }
+
+    now = time_usec();
+    if(now >= scan->cold->tx_queue_until) {
+        // window over, do not let this frame overtake the ones held so far
+        eee->stats.tx_queue_relay += tx_queue_flush(&(eee->tx_queue), frame, 0, send_queued_frame, eee);
+        return 0;
+    }
+
+    // if full, rather send it the slow way than dropping it
+    if(tx_queue_add(&(eee->tx_queue), frame, len, now) < 0) {
+        return 0;
+    }
+    eee->stats.tx_queued++;
+
+    return 1;
+}
+
+
+/** tx_queue callback: send a held frame the way it would be sent now. */
+static void send_queued_frame (void *ctx, uint8_t *frame, size_t len) {
+
+    edge_send_packet2net((n2n_edge_t*)ctx, frame, len);
+}
+
+
+/** tx_queue callback: drop a held frame. */
+static void drop_queued_frame (void *ctx, uint8_t *frame, size_t len) {
+
+    traceEvent(TRACE_DEBUG, "DROP held packet, no registration with supernode");
+}
+
+
+/** Relay the frames which have been held for a full window without their peer getting
+ *  registered, drop them if not even registered with a supernode. */
+static void expire_held_frames (n2n_edge_t *eee) {
+
+    uint64_t before;
+
+    if(eee->tx_queue.num == 0) {
+        return;
+    }
+
+    before = time_usec() - (uint64_t)eee->conf.tx_queue_window * 1000;
+
+    if(eee->last_sup) {
+        eee->stats.tx_queue_relay += tx_queue_flush(&(eee->tx_queue), NULL, before, send_queued_frame, eee);
+    } else {
+        eee->stats.tx_queue_drop += tx_queue_flush(&(eee->tx_queue), NULL, before, drop_queued_frame, eee);
+    }
+}
+
+/* ************************************** */
+
+/** Adopt the direct path a connectivity check found for a pending peer. */
+static void nominate_hole_punch (n2n_edge_t *eee, struct peer_info *peer, int i) {
+
+    hole_punch_t *hp = peer->cold->hole_punch;
+    hole_punch_candidate_t cand = hp->cand[i];
+    n2n_mac_t mac;
+    int delta;
+    macstr_t mac_buf;
+    n2n_sock_str_t sockbuf;
+
+    switch(cand.type) {
+        case HOLE_PUNCH_CAND_REFLEXIVE:
+            eee->stats.p2p_reflexive++;
+            break;
+        case HOLE_PUNCH_CAND_PREDICTED:
+            eee->stats.p2p_predicted++;
+            break;
+        case HOLE_PUNCH_CAND_LAN:
+            eee->stats.p2p_lan++;
+            break;
+        default:
+            eee->stats.p2p_peer++;
+    }
+    eee->stats.p2p_established++;
+
+    // the peer's nat allocated the port in a step the next predictions can start from
+    delta = hole_punch_delta(hp, i);
+    if(delta) {
+        eee->hole_punch_delta = delta;
+    }
+
+    traceEvent(TRACE_INFO, "P2P path to %s nominated: %s, rtt %u.%u ms",
+               macaddr_str(mac_buf, peer->mac_addr),
+               sock_to_cstr(sockbuf, &cand.from),
+               cand.rtt / 1000, (cand.rtt % 1000) / 100);
+
+    // peer_set_p2p_confirmed() might free the peer
+    memcpy(mac, peer->mac_addr, N2N_MAC_SIZE);
+    peer_set_p2p_confirmed(eee, mac, &cand.from, time(NULL));
+}
+
+
+/** Run the connectivity checks which are due: send their next probes, nominate the direct
+ *  paths they found. */
+static void run_hole_punch (n2n_edge_t *eee) {
+
+    struct peer_info *scan, *tmp;
+    uint64_t now;
+    int i;
+
+    now = time_usec();
+    if(!eee->hole_punch_due || (now < eee->hole_punch_due)) {
+        return;
+    }
+
+    eee->hole_punch_due = 0;
+    HASH_ITER(hh, eee->pending_peers, scan, tmp) {
+        if(!scan->cold->hole_punch) {
+            continue;
+        }
+
+        i = hole_punch_nominate(scan->cold->hole_punch, now);
+        if(i >= 0) {
+            nominate_hole_punch(eee, scan, i);
+            continue;
+        }
+
+        hole_punch_probe(scan->cold->hole_punch, now, send_hole_punch_probe, eee);
+        schedule_hole_punch(eee, scan->cold->hole_punch);
+    }
+}
+
+/* ***************************************************** */
+
 /** Send an ecapsulated ethernet PACKET to a destination edge or broadcast MAC
- *    address. */
+ *    address. The destination has been determined by find_peer_destination(). */
 static int send_packet (n2n_edge_t * eee,
                         n2n_mac_t dstMac,
+                        int is_p2p,
+                        const n2n_sock_t * destination,
                         const uint8_t * pktbuf,
                         size_t pktlen) {
 
-    int is_p2p;
     /*ssize_t s; */
     n2n_sock_str_t sockbuf;
-    n2n_sock_t destination;
     macstr_t mac_buf;
 
     /* hexdump(pktbuf, pktlen); */
 
-    is_p2p = find_peer_destination(eee, dstMac, &destination);
-
     if(is_p2p)
         ++(eee->stats.tx_p2p);
     else {
@@ -1670,16 +2567,73 @@ static int send_packet (n2n_edge_t * eee,
     }
 
     traceEvent(TRACE_INFO, "Tx PACKET to %s (dest=%s) [%u B]",
-               sock_to_cstr(sockbuf, &destination),
+               sock_to_cstr(sockbuf, destination),
                macaddr_str(mac_buf, dstMac), pktlen);
 
-    /* s = */ sendto_sock(eee->udp_sock, pktbuf, pktlen, &destination);
+    /* s = */ sendto_sock(eee->udp_sock, pktbuf, pktlen, destination);
 
     return 0;
 }
 
 /* ************************************** */
 
+/** Send a broadcast PACKET to the peers heard from directly lately, N2N_BCAST_P2P_MAX of
+ *  them at most, and a BROADCAST to the supernode which spares these. pktbuf holds the
+ *  PACKET, its header not encrypted yet, the payload following at headerIdx. */
+static void send_broadcast_p2p (n2n_edge_t *eee,
+                                const n2n_common_t *cmn,
+                                const n2n_PACKET_t *pkt,
+                                uint8_t *pktbuf,
+                                size_t headerIdx,
+                                size_t pktlen) {
+
+    struct peer_info *peers[N2N_BCAST_P2P_MAX];
+    struct peer_info *scan, *tmp;
+    n2n_BROADCAST_t bcast;
+    n2n_common_t cmn2;
+    uint8_t bcastbuf[N2N_PKT_BUF_SIZE + 1 + N2N_BCAST_P2P_MAX * N2N_MAC_SIZE];
+    size_t idx = 0;
+    size_t bcastHeaderIdx;
+    time_t now = time(NULL);
+    uint8_t i;
+
+    memset(&bcast, 0, sizeof(bcast));
+    HASH_ITER(hh, eee->known_peers, scan, tmp) {
+        if(bcast.num_excluded == N2N_BCAST_P2P_MAX)
+            break;
+        // the direct path of an idle peer is in doubt, the supernode takes care of it
+        if((now - scan->last_p2p) < (scan->timeout / 2)) {
+            peers[bcast.num_excluded] = scan;
+            memcpy(bcast.excluded[bcast.num_excluded], scan->mac_addr, N2N_MAC_SIZE);
+            bcast.num_excluded++;
+        }
+    }
+
+    memcpy(&cmn2, cmn, sizeof(n2n_common_t));
+    cmn2.pc = n2n_broadcast;
+    encode_BROADCAST(bcastbuf, &idx, &cmn2, &bcast, pkt);
+    bcastHeaderIdx = idx;
+    memcpy(bcastbuf + idx, pktbuf + headerIdx, pktlen - headerIdx);
+    idx += pktlen - headerIdx;
+
+    if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
+        packet_header_encrypt(bcastbuf, bcastHeaderIdx, idx,
+                              eee->conf.header_encryption_ctx, eee->conf.header_iv_ctx,
+                              time_stamp());
+        packet_header_encrypt(pktbuf, headerIdx, pktlen,
+                              eee->conf.header_encryption_ctx, eee->conf.header_iv_ctx,
+                              time_stamp());
+    }
+
+    for(i = 0; i < bcast.num_excluded; i++) {
+        send_packet(eee, peers[i]->mac_addr, 1, &(peers[i]->sock), pktbuf, pktlen);
+        eee->stats.tx_p2p_broadcast++;
+    }
+    send_packet(eee, (uint8_t*)pkt->dstMac, 0, &(eee->supernode), bcastbuf, idx);
+}
+
+/* ************************************** */
+
 /** A layer-2 packet was received at the tunnel and needs to be sent via UDP. */
 void edge_send_packet2net (n2n_edge_t * eee,
                            uint8_t *tap_pkt, size_t len) {
@@ -1692,6 +2646,9 @@ void edge_send_packet2net (n2n_edge_t * eee,
     size_t idx = 0;
     n2n_transform_t tx_transop_idx = eee->transop.transform_id;
     ether_hdr_t eh;
+    n2n_sock_t destination;
+    int is_p2p;
+    int bcast_p2p;
 
     /* tap_pkt is not aligned so we have to copy to aligned memory */
     memcpy(&eh, tap_pkt, sizeof(ether_hdr_t));
@@ -1715,6 +2672,11 @@ void edge_send_packet2net (n2n_edge_t * eee,
         }
     }
 
+    if(hold_frame(eee, tap_pkt, len)) {
+        traceEvent(TRACE_DEBUG, "HOLD packet while registering with the peer");
+        return;
+    }
+
     /* Optionally compress then apply transforms, eg encryption. */
 
     /* Once processed, send to destination in PACKET */
@@ -1784,8 +2746,20 @@ void edge_send_packet2net (n2n_edge_t * eee,
         }
     }
 
+    /* the compact header can be used towards the supernode which granted the id only */
+    is_p2p = find_peer_destination(eee, destMac, &destination);
+
+    /* broadcasts go to the direct peers right from here if the supernode spares them */
+    bcast_p2p = !memcmp(destMac, broadcast_mac, N2N_MAC_SIZE) && eee->conf.allow_p2p
+                && (eee->sn_features & N2N_FEATURE_BCAST_P2P) && HASH_COUNT(eee->known_peers);
+
     idx = 0;
-    encode_PACKET(pktbuf, &idx, &cmn, &pkt);
+    if(!is_p2p && !bcast_p2p && (eee->compact_community_id != 0)
+       && (eee->conf.header_encryption != HEADER_ENCRYPTION_ENABLED)) {
+        encode_PACKET_compact(pktbuf, &idx, &cmn, eee->compact_community_id, &pkt);
+    } else {
+        encode_PACKET_fast(pktbuf, &idx, &cmn, &pkt);
+    }
 
     uint16_t headerIdx = idx;
 
@@ -1796,6 +2770,12 @@ void edge_send_packet2net (n2n_edge_t * eee,
     traceEvent(TRACE_DEBUG, "Encode %u B PACKET [%u B data, %u B overhead] transform %u",
                (u_int)idx, (u_int)len, (u_int)(idx - len), tx_transop_idx);
 
+    if(bcast_p2p) {
+        eee->transop.tx_cnt++; /* stats */
+        send_broadcast_p2p(eee, &cmn, &pkt, pktbuf, headerIdx, idx);
+        return;
+    }
+
     if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED)
         packet_header_encrypt(pktbuf, headerIdx, idx,
                               eee->conf.header_encryption_ctx, eee->conf.header_iv_ctx,
@@ -1812,7 +2792,7 @@ void edge_send_packet2net (n2n_edge_t * eee,
 
     eee->transop.tx_cnt++; /* stats */
 
-    send_packet(eee, destMac, pktbuf, idx); /* to peer or supernode */
+    send_packet(eee, destMac, is_p2p, &destination, pktbuf, idx); /* to peer or supernode */
 }
 
 /* ************************************** */
@@ -1846,6 +2826,10 @@ void edge_read_from_tap (n2n_edge_t * eee) {
             is_ethMulticast(eth_pkt, len))) {
                 traceEvent(TRACE_INFO, "Dropping TX multicast");
         } else {
+                if(eee->conf.mcast_snoop && mcast_snoop_report(&(eee->mcast_snoop), eth_pkt, len, time(NULL))) {
+                    eee->mcast_changed = 1;
+                }
+
                 if(eee->network_traffic_filter) {
                     if(eee->network_traffic_filter->filter_packet_from_tap(eee->network_traffic_filter, eee, eth_pkt,
                                                                            len) == N2N_DROP) {
@@ -1864,9 +2848,29 @@ void edge_read_from_tap (n2n_edge_t * eee) {
                     len = tmp_len;
                 }
 
+                if(eee->arp_proxy.entries) {
+                    uint8_t reply[N2N_PKT_BUF_SIZE];
+                    int reply_len = arp_proxy_answer(&(eee->arp_proxy), eth_pkt, len, reply, sizeof(reply), time(NULL));
+
+                    if(reply_len > 0) {
+                        /* answered locally instead of broadcasting through the supernode */
+                        eee->stats.arp_proxy_answered++;
+                        tuntap_write(&(eee->device), reply, reply_len);
+                        return;
+                    } else if(reply_len == 0) {
+                        eee->stats.arp_proxy_missed++;
+                    }
+                }
+
                 if(!eee->last_sup) {
-                    // drop packets before first registration with supernode
-                    traceEvent(TRACE_DEBUG, "DROP packet before first registration with supernode");
+                    // hold packets until the first registration with supernode, drop them if not possible
+                    if(eee->conf.tx_queue_window && (tx_queue_add(&(eee->tx_queue), eth_pkt, len, time_usec()) == 0)) {
+                        eee->stats.tx_queued++;
+                        traceEvent(TRACE_DEBUG, "HOLD packet before first registration with supernode");
+                    } else {
+                        eee->stats.tx_queue_drop++;
+                        traceEvent(TRACE_DEBUG, "DROP packet before first registration with supernode");
+                    }
                     return;
                 }
 
@@ -1896,6 +2900,7 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
     n2n_sock_t *          orig_sender = NULL;
     time_t                now = 0;
     uint64_t              stamp = 0;
+    uint32_t              community_id = 0;
     size_t                i;
 
     i = sizeof(sender_sock);
@@ -1929,6 +2934,10 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
      * hop as sender. */
     orig_sender = &sender;
 
+    if(eee->conf.failover_interval && sock_equal(&sender, &(eee->supernode))) {
+        eee->sn_last_heard = time_usec();
+    }
+
     traceEvent(TRACE_DEBUG, "### Rx N2N UDP (%d) from %s",
                (signed int)recvlen, sock_to_cstr(sockbuf1, &sender));
 
@@ -1949,7 +2958,19 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
 
     rem = recvlen; /* Counts down bytes of packet to protect against buffer overruns. */
     idx = 0; /* marches through packet header as parts are decoded. */
-    if(decode_common(&cmn, udp_buf, &rem, &idx) < 0) {
+    if((eee->conf.header_encryption != HEADER_ENCRYPTION_ENABLED)
+       && (recvlen > 0) && (udp_buf[0] == N2N_PKT_VERSION_COMPACT)) {
+        /* compact PACKETs only come from the supernode which granted the id */
+        if((decode_common_compact(&cmn, &community_id, udp_buf, &rem, &idx) < 0)
+           || (cmn.pc != MSG_TYPE_PACKET)
+           || (community_id == 0) || (community_id != eee->compact_community_id)
+           || !sock_equal(&sender, &(eee->supernode))) {
+            traceEvent(TRACE_DEBUG, "readFromIPSocket dropped unexpected compact PACKET from %s",
+                       sock_to_cstr(sockbuf1, &sender));
+            return;
+        }
+        memcpy(cmn.community, eee->conf.community_name, N2N_COMMUNITY_SIZE);
+    } else if(decode_common(&cmn, udp_buf, &rem, &idx) < 0) {
             traceEvent(TRACE_ERROR, "Failed to decode common section in N2N_UDP");
             return; /* failed to decode packet */
     }
@@ -1965,7 +2986,7 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                 /* process PACKET - most frequent so first in list. */
                 n2n_PACKET_t pkt;
 
-                decode_PACKET(&pkt, &cmn, udp_buf, &rem, &idx);
+                decode_PACKET_fast(&pkt, &cmn, udp_buf, &rem, &idx);
 
                 if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
                     if(!find_peer_time_stamp_and_verify (eee, from_supernode, pkt.srcMac, stamp, TIME_STAMP_ALLOW_JITTER)) {
@@ -2009,6 +3030,8 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                 /* Another edge is registering with us */
                 n2n_REGISTER_t reg;
                 int via_multicast;
+                struct peer_info *scan;
+                int cand;
 
                 decode_REGISTER(&reg, &cmn, udp_buf, &rem, &idx);
 
@@ -2042,7 +3065,16 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                      */
                     traceEvent(TRACE_DEBUG, "Got P2P register");
                     traceEvent(TRACE_INFO, "[P2P] Rx REGISTER from %s", sock_to_cstr(sockbuf1, &sender));
-                    find_and_remove_peer(&eee->pending_peers, reg.srcMac);
+                    HASH_FIND_PEER(eee->pending_peers, reg.srcMac, scan);
+                    if(scan && scan->cold->hole_punch
+                       && ((cand = hole_punch_add(scan->cold->hole_punch, orig_sender, HOLE_PUNCH_CAND_PEER)) >= 0)) {
+                        /* Keep the connectivity check going, the socket the peer reached us
+                         * from is a candidate worth probing right away */
+                        hole_punch_probe_now(scan->cold->hole_punch, cand, time_usec(), send_hole_punch_probe, eee);
+                        schedule_hole_punch(eee, scan->cold->hole_punch);
+                    } else {
+                        find_and_remove_peer(&eee->pending_peers, reg.srcMac);
+                    }
 
                     /* NOTE: only ACK to peers */
                     send_register_ack(eee, orig_sender, &reg);
@@ -2053,12 +3085,20 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                 }
 
                 check_peer_registration_needed(eee, from_supernode, reg.srcMac, &reg.dev_addr, (const n2n_desc_t*)&reg.dev_desc, orig_sender);
+
+                if(reg.dev_addr.net_addr != 0) {
+                    uint32_t dev_ip = htonl(reg.dev_addr.net_addr);
+                    arp_proxy_learn(&(eee->arp_proxy), 4, (uint8_t*)&dev_ip, reg.srcMac, 0xff, now);
+                }
                 break;
             }
 
             case MSG_TYPE_REGISTER_ACK: {
                 /* Peer edge is acknowledging our register request */
                 n2n_REGISTER_ACK_t ra;
+                struct peer_info *scan;
+                uint32_t cookie;
+                size_t cookie_rem = N2N_COOKIE_SIZE, cookie_idx = 0;
 
                 decode_REGISTER_ACK(&ra, &cmn, udp_buf, &rem, &idx);
 
@@ -2078,6 +3118,16 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                            sock_to_cstr(sockbuf1, &sender),
                            sock_to_cstr(sockbuf2, orig_sender));
 
+                HASH_FIND_PEER(eee->pending_peers, ra.srcMac, scan);
+                if(scan && scan->cold->hole_punch) {
+                    decode_uint32(&cookie, ra.cookie, &cookie_rem, &cookie_idx);
+                    if(hole_punch_answer(scan->cold->hole_punch, cookie, &sender, time_usec()) >= 0) {
+                        /* The direct path gets nominated once the other candidates had their chance */
+                        schedule_hole_punch(eee, scan->cold->hole_punch);
+                        break;
+                    }
+                }
+
                 peer_set_p2p_confirmed(eee, ra.srcMac, &sender, now);
                 break;
             }
@@ -2125,25 +3175,36 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                         return;
                     }
 
-                    if(0 == memcmp(ra.cookie, eee->curr_sn->last_cookie, N2N_COOKIE_SIZE)) {
+                    if(0 == memcmp(ra.cookie, eee->curr_sn->cold->last_cookie, N2N_COOKIE_SIZE)) {
                         payload = (n2n_REGISTER_SUPER_ACK_payload_t*)tmpbuf;
 
+                        // the cookie matches the latest REGISTER_SUPER, so this is a valid rtt sample
+                        sn_selection_rtt_sample(eee->curr_sn, eee->sn_register_sent);
+
+                        if(eee->failover_since) {
+                            eee->stats.sn_failover_last_ms = (uint32_t)((time_usec() - eee->failover_since) / 1000);
+                            eee->stats.sn_failover_max_ms = max(eee->stats.sn_failover_max_ms, eee->stats.sn_failover_last_ms);
+                            eee->failover_since = 0;
+                            traceEvent(TRACE_NORMAL, "Failed over to supernode %s, %u ms after losing the previous one",
+                                       supernode_ip(eee), eee->stats.sn_failover_last_ms);
+                        }
+
                         for(i = 0; i < ra.num_sn; i++) {
                             skip_add = SN_ADD;
                             sn = add_sn_to_list_by_mac_or_sock(&(eee->conf.supernodes), &(payload->sock), &(payload->mac), &skip_add);
 
                             if(skip_add == SN_ADD_ADDED) {
-                                sn->ip_addr = calloc(1,N2N_EDGE_SN_HOST_SIZE);
-                                if(sn->ip_addr != NULL) {
+                                sn->cold->ip_addr = calloc(1,N2N_EDGE_SN_HOST_SIZE);
+                                if(sn->cold->ip_addr != NULL) {
                                     inet_ntop(payload->sock.family,
                                               (payload->sock.family == AF_INET) ? (void*)&(payload->sock.addr.v4) : (void*)&(payload->sock.addr.v6),
-                                              sn->ip_addr, N2N_EDGE_SN_HOST_SIZE - 1);
-                                    sprintf (sn->ip_addr, "%s:%u", sn->ip_addr, (uint16_t)(payload->sock.port));
+                                              sn->cold->ip_addr, N2N_EDGE_SN_HOST_SIZE - 1);
+                                    sprintf (sn->cold->ip_addr, "%s:%u", sn->cold->ip_addr, (uint16_t)(payload->sock.port));
                                 }
                                 sn_selection_criterion_default(&(sn->selection_criterion));
                                 sn->last_seen = now - LAST_SEEN_SN_NEW;
                                 sn->last_valid_time_stamp = initial_time_stamp();
-                                traceEvent(TRACE_NORMAL, "Supernode '%s' added to the list of supernodes.", sn->ip_addr);
+                                traceEvent(TRACE_NORMAL, "Supernode '%s' added to the list of supernodes.", sn->cold->ip_addr);
                             }
                             // shfiting to the next payload entry
                             payload++;
@@ -2164,12 +3225,25 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                             }
                         }
 
-                        if(!eee->last_sup) // send gratuitous ARP only upon first registration with supernode
+                        if(!eee->last_sup) { // send gratuitous ARP only upon first registration with supernode
                             send_grat_arps(eee);
+                            eee->last_sup = now;
+                            // as well as packets held so far
+                            tx_queue_flush(&(eee->tx_queue), NULL, 0, send_queued_frame, eee);
+                        }
 
                         eee->last_sup = now;
                         eee->sn_wait = 0;
                         eee->sup_attempts = N2N_EDGE_SUP_ATTEMPTS; /* refresh because we got a response */
+                        eee->compact_community_id = ra.community_id;
+                        eee->sn_features = ra.features;
+
+                        if(!eee->peer_list_done && eee->conf.allow_p2p
+                           && (ra.features & N2N_FEATURE_PEER_LIST)) {
+                            // at start-up, learn about the peers at once instead of one by one,
+                            // a page that got lost is asked for again with the next ACK
+                            send_peer_list_request(eee);
+                        }
 
                         if(eee->cb.sn_registration_updated)
                             eee->cb.sn_registration_updated(eee, now, &sender);
@@ -2205,10 +3279,15 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                     HASH_FIND_PEER(eee->known_peers, nak.srcMac, peer);
                     if(peer != NULL) {
                         HASH_DEL(eee->known_peers, peer);
+                        mac_table_remove(&(eee->known_peers_index), peer->mac_addr);
+                        timer_wheel_disarm(&(peer->expiry));
+                        peer_info_free(peer);
                     }
                     HASH_FIND_PEER(eee->pending_peers, nak.srcMac, scan);
                     if(scan != NULL) {
                         HASH_DEL(eee->pending_peers, scan);
+                        timer_wheel_disarm(&(scan->expiry));
+                        peer_info_free(scan);
                     }
                 }
                 break;
@@ -2230,6 +3309,12 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                     }
                 }
 
+                if(pi.aflags & N2N_AFLAGS_PEER_LIST) {
+                    /* pi.sock, our own, is of no interest here */
+                    peer_list_received(eee, &pi);
+                    break;
+                }
+
                 if(!is_valid_peer_sock(&pi.sock)) {
                     traceEvent(TRACE_DEBUG, "Skip invalid PEER_INFO %s [%s]",
                                sock_to_cstr(sockbuf1, &pi.sock),
@@ -2237,11 +3322,28 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                     break;
                 }
 
+                if(in_sock == eee->nat_probe_sock) {
+                    nat_probe_answered(eee, &pi, now);
+                    break;
+                }
+                if(pi.aflags & N2N_AFLAGS_NAT_PROBE) {
+                    /* late answer to a probe already given up on */
+                    break;
+                }
+
                 if(memcmp(pi.mac, null_mac, sizeof(n2n_mac_t)) == 0) {
                     skip_add = SN_ADD_SKIP;
                     scan = add_sn_to_list_by_mac_or_sock(&(eee->conf.supernodes), &sender, &pi.srcMac, &skip_add);
                     if(scan != NULL) {
+                        if(scan->cold->ping_sent == 0) {
+                            /* duplicate or not asked for, neither a valid rtt sample nor a sign of life */
+                            traceEvent(TRACE_DEBUG, "Skip PONG from %s without a PING outstanding",
+                                       sock_to_cstr(sockbuf1, &sender));
+                            break;
+                        }
                         scan->last_seen = now;
+                        sn_selection_rtt_sample(scan, scan->cold->ping_sent);
+                        scan->cold->ping_sent = 0;
                         /* The data type depends on the actual selection strategy that has been chosen. */
                         sn_selection_criterion_calculate(eee, scan, &pi.data);
                         break;
@@ -2250,12 +3352,13 @@ void readFromIPSocket (n2n_edge_t * eee, int in_sock) {
                     HASH_FIND_PEER(eee->pending_peers, pi.mac, scan);
 
                     if(scan) {
+                        eee->stats.query_answered++;
                         scan->sock = pi.sock;
                         traceEvent(TRACE_INFO, "Rx PEER_INFO for %s: is at %s",
                                    macaddr_str(mac_buf1, pi.mac),
                                    sock_to_cstr(sockbuf1, &pi.sock));
 
-                        send_register(eee, &scan->sock, scan->mac_addr);
+                        start_hole_punch(eee, scan, 1);
 
                     } else {
                         traceEvent(TRACE_INFO, "Rx PEER_INFO unknown peer %s",
@@ -2293,13 +3396,60 @@ void print_edge_stats (const n2n_edge_t *eee) {
 
 /* ************************************** */
 
+/* asks the host behind the tap device for its multicast groups every now and then and
+ * announces changes to the supernode early, i.e. with a REGISTER_SUPER */
+static void check_mcast_snoop (n2n_edge_t *eee, time_t now) {
+
+    uint8_t query[128];
+    n2n_mac_t querier;
+    size_t len;
+
+    if(!eee->conf.mcast_snoop || eee->conf.drop_multicast || !eee->last_sup)
+        return;
+
+    if(!(eee->sn_features & N2N_FEATURE_MCAST_SNOOP)) {
+        // query right away once the supernode supports it
+        eee->mcast_query_sent = 0;
+        return;
+    }
+
+    if(eee->mcast_snoop.query_due || ((now - eee->mcast_query_sent) >= N2N_MCAST_QUERY_INTERVAL)) {
+        // a querier of its own, the host might not accept queries from its own addresses
+        memcpy(querier, eee->device.mac_addr, sizeof(n2n_mac_t));
+        querier[5] ^= 0xff;
+
+        len = mcast_snoop_igmp_query(query, sizeof(query), querier);
+        if(len)
+            tuntap_write(&(eee->device), query, len);
+        len = mcast_snoop_mld_query(query, sizeof(query), querier);
+        if(len)
+            tuntap_write(&(eee->device), query, len);
+
+        eee->mcast_query_sent = now;
+        eee->mcast_snoop.query_due = 0;
+    }
+
+    if(mcast_snoop_expire(&(eee->mcast_snoop), now))
+        eee->mcast_changed = 1;
+
+    // at most once a second, changes meanwhile go with the next one
+    if(eee->mcast_changed && (now != eee->mcast_announced)) {
+        traceEvent(TRACE_DEBUG, "announcing %u multicast groups", eee->mcast_snoop.num_groups);
+        send_register_super(eee);
+        eee->mcast_announced = now;
+        eee->mcast_changed = 0;
+        eee->stats.mcast_announced++;
+    }
+}
+
+/* ************************************** */
+
 int run_edge_loop (n2n_edge_t * eee, int *keep_running) {
 
     size_t numPurged;
     time_t lastIfaceCheck = 0;
     time_t lastTransop = 0;
-    time_t last_purge_known = 0;
-    time_t last_purge_pending = 0;
+    time_t lastPeerCache;
 
 #ifdef WIN32
     struct tunread_arg arg;
@@ -2311,6 +3461,11 @@ int run_edge_loop (n2n_edge_t * eee, int *keep_running) {
     *keep_running = 1;
     update_supernode_reg(eee, time(NULL));
 
+    /* register with the peers of the last run right away, in parallel to the supernode */
+    if(eee->conf.allow_p2p)
+        edge_peer_cache_load(eee, time(NULL), restore_cached_peer);
+    lastPeerCache = time(NULL);
+
     /* Main loop
      *
      * select() is used to wait for input on either the TAP fd or the UDP/TCP
@@ -2339,8 +3494,58 @@ int run_edge_loop (n2n_edge_t * eee, int *keep_running) {
         max_sock = max(max_sock, eee->device.fd);
 #endif
 
+        if(eee->nat_probe_sock >= 0) {
+            FD_SET(eee->nat_probe_sock, &socket_mask);
+            max_sock = max(max_sock, eee->nat_probe_sock);
+        }
+
         wait_time.tv_sec = (eee->sn_wait)?(SOCKET_TIMEOUT_INTERVAL_SECS / 10 + 1):(SOCKET_TIMEOUT_INTERVAL_SECS);
         wait_time.tv_usec = 0;
+        if(eee->conf.failover_interval) {
+            // wake up for the fast failover keepalives
+            wait_time.tv_sec = eee->conf.failover_interval / 1000;
+            wait_time.tv_usec = (eee->conf.failover_interval % 1000) * 1000;
+        }
+        if(eee->tx_queue.num && ((wait_time.tv_sec * 1000 + wait_time.tv_usec / 1000) > eee->conf.tx_queue_window)) {
+            // wake up to relay held frames in time
+            wait_time.tv_sec = eee->conf.tx_queue_window / 1000;
+            wait_time.tv_usec = (eee->conf.tx_queue_window % 1000) * 1000;
+        }
+        if(!eee->sn_wait) {
+            // wake up for the re-registration in time, the keepalive interval might be
+            // just under the NAT binding lifetime
+            time_t due = eee->last_register_req + keepalive_interval(eee) - time(NULL);
+
+            if(due < wait_time.tv_sec) {
+                wait_time.tv_sec = max(due, 0);
+                wait_time.tv_usec = 0;
+            }
+        }
+        if(eee->query_batch_num) {
+            // wake up to send the batch of peer queries
+            uint64_t now_usec = time_usec();
+            uint64_t wait_usec = (eee->query_batch_due > now_usec) ? (eee->query_batch_due - now_usec) : 0;
+
+            if(wait_usec < (uint64_t)wait_time.tv_sec * 1000000 + wait_time.tv_usec) {
+                wait_time.tv_sec = wait_usec / 1000000;
+                wait_time.tv_usec = wait_usec % 1000000;
+            }
+        }
+        if((eee->mcast_changed || eee->mcast_snoop.query_due) && (wait_time.tv_sec >= 1)) {
+            // wake up to announce changed multicast groups or to query for remaining members
+            wait_time.tv_sec = 1;
+            wait_time.tv_usec = 0;
+        }
+        if(eee->hole_punch_due) {
+            // wake up for the next probes or nomination of the connectivity checks
+            uint64_t now_usec = time_usec();
+            uint64_t wait_usec = (eee->hole_punch_due > now_usec) ? (eee->hole_punch_due - now_usec) : 0;
+
+            if(wait_usec < (uint64_t)wait_time.tv_sec * 1000000 + wait_time.tv_usec) {
+                wait_time.tv_sec = wait_usec / 1000000;
+                wait_time.tv_usec = wait_usec % 1000000;
+            }
+        }
 
         rc = select(max_sock + 1, &socket_mask, NULL, NULL, &wait_time);
         nowTime = time(NULL);
@@ -2361,6 +3566,11 @@ int run_edge_loop (n2n_edge_t * eee, int *keep_running) {
                 readFromIPSocket(eee, eee->udp_sock);
             }
 
+            if((eee->nat_probe_sock >= 0) && FD_ISSET(eee->nat_probe_sock, &socket_mask)) {
+                /* An answer to the NAT binding lifetime probe */
+                readFromIPSocket(eee, eee->nat_probe_sock);
+            }
+
 
 #ifndef SKIP_MULTICAST_PEERS_DISCOVERY
             if(FD_ISSET(eee->udp_multicast_sock, &socket_mask)) {
@@ -2392,8 +3602,8 @@ int run_edge_loop (n2n_edge_t * eee, int *keep_running) {
         /* Finished processing select data. */
         update_supernode_reg(eee, nowTime);
 
-        numPurged =  purge_expired_registrations(&eee->known_peers, &last_purge_known, PURGE_REGISTRATION_FREQUENCY);
-        numPurged += purge_expired_registrations(&eee->pending_peers, &last_purge_pending, PURGE_REGISTRATION_FREQUENCY);
+        numPurged =  purge_expired_peers(&eee->known_peers_expiry, &eee->known_peers_index, &eee->known_peers, nowTime);
+        numPurged += purge_expired_peers(&eee->pending_peers_expiry, NULL, &eee->pending_peers, nowTime);
 
         if(numPurged > 0) {
             traceEvent(TRACE_INFO, "%u peers removed. now: pending=%u, operational=%u",
@@ -2414,10 +3624,21 @@ int run_edge_loop (n2n_edge_t * eee, int *keep_running) {
                 eee->cb.ip_address_changed(eee, old_ip, eee->device.ip_addr);
         }
 
+        if(eee->conf.peer_cache_path && ((nowTime - lastPeerCache) >= N2N_PEER_CACHE_INTERVAL)) {
+            edge_peer_cache_write(eee, nowTime);
+            lastPeerCache = nowTime;
+        }
+
         if(eee->cb.main_loop_period)
             eee->cb.main_loop_period(eee, nowTime);
 
+        check_supernode_failover(eee, nowTime);
         sort_supernodes(eee, nowTime);
+        run_hole_punch(eee);
+        expire_held_frames(eee);
+        check_nat_lifetime(eee, nowTime);
+        run_query_batch(eee);
+        check_mcast_snoop(eee, nowTime);
 
     } /* while */
 
@@ -2437,6 +3658,10 @@ int run_edge_loop (n2n_edge_t * eee, int *keep_running) {
 /** Deinitialise the edge and deallocate any owned memory. */
 void edge_term (n2n_edge_t * eee) {
 
+    edge_peer_cache_write(eee, time(NULL));
+    free(eee->conf.peer_cache_path);
+    eee->conf.peer_cache_path = NULL;
+
     if(eee->udp_sock >= 0)
         closesocket(eee->udp_sock);
 
@@ -2448,8 +3673,15 @@ void edge_term (n2n_edge_t * eee) {
         closesocket(eee->udp_multicast_sock);
 #endif
 
+    if(eee->nat_probe_sock >= 0)
+        closesocket(eee->nat_probe_sock);
+
     clear_peer_list(&eee->pending_peers);
     clear_peer_list(&eee->known_peers);
+    mac_table_free(&eee->known_peers_index);
+    tx_queue_free(&eee->tx_queue);
+    query_cache_free(&eee->query_cache);
+    arp_proxy_free(&eee->arp_proxy);
 
     eee->transop.deinit(&eee->transop);
 
@@ -2812,7 +4044,7 @@ static int edge_init_routes_linux (n2n_edge_t *eee, n2n_route_t *routes, uint16_
                 return(-1);
             }
 
-            if(supernode2sock(&sn, eee->conf.supernodes->ip_addr) < 0)
+            if(supernode2sock(&sn, eee->conf.supernodes->cold->ip_addr) < 0)
                 return(-1);
 
             if(sn.family != AF_INET) {
@@ -2940,9 +4172,17 @@ void edge_init_conf_defaults (n2n_edge_conf_t *conf) {
     conf->compression = N2N_COMPRESSION_ID_NONE;
     conf->drop_multicast = 1;
     conf->allow_p2p = 1;
+    conf->arp_proxy = 1;
+    conf->mcast_snoop = 1;
     conf->disable_pmtu_discovery = 1;
     conf->register_interval = REGISTER_SUPER_INTERVAL_DFL;
+    conf->tx_queue_window = TX_QUEUE_WINDOW_DFL;
     conf->tuntap_ip_mode = TUNTAP_IP_MODE_SN_ASSIGN;
+#ifndef SN_SELECTION_RTT
+    conf->sn_selection_strategy = SN_SELECTION_STRATEGY_LOAD;
+#else
+    conf->sn_selection_strategy = SN_SELECTION_STRATEGY_RTT;
+#endif
     /* reserve possible last char as null terminator. */
     gethostname((char*)conf->dev_desc, N2N_DESC_SIZE-1);
 
@@ -2997,10 +4237,10 @@ int edge_conf_add_supernode (n2n_edge_conf_t *conf, const char *ip_and_port) {
     sn = add_sn_to_list_by_mac_or_sock(&(conf->supernodes), sock, (n2n_mac_t *)null_mac, &skip_add);
 
     if(sn != NULL) {
-        sn->ip_addr = calloc(1,N2N_EDGE_SN_HOST_SIZE);
+        sn->cold->ip_addr = calloc(1,N2N_EDGE_SN_HOST_SIZE);
 
-        if(sn->ip_addr != NULL) {
-            strncpy(sn->ip_addr, ip_and_port, N2N_EDGE_SN_HOST_SIZE - 1);
+        if(sn->cold->ip_addr != NULL) {
+            strncpy(sn->cold->ip_addr, ip_and_port, N2N_EDGE_SN_HOST_SIZE - 1);
             memcpy(&(sn->sock), sock, sizeof(n2n_sock_t));
             memcpy(&(sn->mac_addr), null_mac, sizeof(n2n_mac_t));
             sn->purgeable = SN_UNPURGEABLE;
@@ -3010,7 +4250,7 @@ int edge_conf_add_supernode (n2n_edge_conf_t *conf, const char *ip_and_port) {
 
     free(sock);
 
-    traceEvent(TRACE_NORMAL, "Adding supernode = %s", sn->ip_addr);
+    traceEvent(TRACE_NORMAL, "Adding supernode = %s", sn->cold->ip_addr);
     conf->sn_num++;
 
     return(0);
@@ -0,0 +1,269 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+
+#include "hole_punch.h"
+
+
+// connectivity check towards a new peer
+//
+// an edge gathers the sockets it might reach a new peer at: the socket the supernode
+// sees the peer at (reflexive), ports next to it where the peer's nat would likely map
+// a new outbound flow to (predicted, see below), the local multicast group in case the
+// peer shares the lan, and the sockets the peer's own REGISTERs arrive from. all of them
+// get probed by REGISTERs in paced rounds, the cookie of each probe names its candidate.
+// the predicted ports join only after a round went unanswered: most peers answer at the
+// reflexive socket or on the lan, and probing a range of ports looks like a port scan to
+// firewalls and intrusion detection next to the peer.
+// the REGISTER_ACK returns the cookie, so the edge learns which candidates work, where
+// the answer came from and the round trip time. once the first answer arrived, the
+// others get a short while to come in, then the fastest one is nominated.
+//
+// nats which map each new outbound flow to a new port usually allocate ports in steps,
+// often of 1. the ports predicted are the reflexive one plus and minus multiples of that
+// step. if the step is not known, 1 is assumed. the caller can learn it from the port a
+// nominated candidate answered from, see hole_punch_delta().
+//
+// a check is initialized by hole_punch_init(), a zeroed check has no candidates
+
+
+void hole_punch_init (hole_punch_t *hp, const n2n_mac_t mac, uint32_t nonce) {
+
+    memset(hp, 0, sizeof(hole_punch_t));
+    memcpy(hp->mac, mac, N2N_MAC_SIZE);
+    hp->nonce = nonce & 0x00ffffff;
+}
+
+
+// add a candidate, a known one is not added again, return its index or -1 if full
+int hole_punch_add (hole_punch_t *hp, const n2n_sock_t *sock, uint8_t type) {
+
+    int i;
+
+    for(i = 0; i < hp->num; i++) {
+        if(sock_equal(&(hp->cand[i].sock), sock))
+            return i;
+    }
+
+    if(hp->num >= HOLE_PUNCH_CANDIDATES)
+        return -1;
+
+    memset(&(hp->cand[i]), 0, sizeof(hole_punch_candidate_t));
+    hp->cand[i].sock = *sock;
+    hp->cand[i].type = type;
+    hp->num++;
+
+    return i;
+}
+
+
+// add the candidates predicted around the reflexive one
+static void add_predicted (hole_punch_t *hp) {
+
+    n2n_sock_t sock = hp->reflexive;
+    int k, sign, port;
+
+    if(!hp->delta)
+        return;
+
+    // closest first, alternating sides, the side of the step first
+    for(k = 1; k <= HOLE_PUNCH_PREDICT; k++) {
+        for(sign = 1; sign >= -1; sign -= 2) {
+            port = (int)hp->reflexive.port + sign * k * hp->delta;
+            if((port <= 0) || (port > 0xffff))
+                continue;
+            sock.port = (uint16_t)port;
+            hole_punch_add(hp, &sock, HOLE_PUNCH_CAND_PREDICTED);
+        }
+    }
+}
+
+
+// add the reflexive candidate and, once a round went unanswered, the ports predicted around
+// it, delta is the nat's port allocation step (0 if not known), return the number of
+// candidates added
+int hole_punch_predict (hole_punch_t *hp, const n2n_sock_t *reflexive, int delta) {
+
+    int num = hp->num;
+
+    hole_punch_add(hp, reflexive, HOLE_PUNCH_CAND_REFLEXIVE);
+
+    hp->reflexive = *reflexive;
+    hp->delta = delta ? delta : 1;
+    if(hp->predicted)
+        add_predicted(hp);
+
+    return hp->num - num;
+}
+
+
+// (re-)start the rounds over the unanswered candidates, a round in progress goes on
+void hole_punch_start (hole_punch_t *hp) {
+
+    if((hp->round == 0) || (hp->next >= hp->num)) {
+        hp->round = 0;
+        hp->next = hp->num;
+        hp->due = 0;
+    }
+}
+
+
+static void probe (hole_punch_t *hp, int i, uint64_t now, hole_punch_send_f send, void *ctx) {
+
+    hp->cand[i].sent = now;
+    send(ctx, hp->mac, &(hp->cand[i].sock), hp->cand[i].type, (hp->nonce << 8) | (uint32_t)i);
+}
+
+
+// send the probes due by now, return their number
+int hole_punch_probe (hole_punch_t *hp, uint64_t now, hole_punch_send_f send, void *ctx) {
+
+    int num = 0;
+
+    if(!hp->num || (now < hp->due))
+        return 0;
+
+    if((hp->round == 0) || (hp->next >= hp->num)) {
+        // no more rounds once a candidate answered or all got their chance
+        if(hp->answered || (hp->round >= HOLE_PUNCH_ROUNDS))
+            return 0;
+        if(hp->round && !hp->predicted) {
+            hp->predicted = 1;
+            add_predicted(hp);
+        }
+        hp->round++;
+        hp->next = 0;
+        hp->round_start = now;
+    }
+
+    while((num < HOLE_PUNCH_BURST) && (hp->next < hp->num)) {
+        if(!hp->cand[hp->next].rtt) {
+            probe(hp, hp->next, now, send, ctx);
+            num++;
+        }
+        hp->next++;
+    }
+
+    if(hp->next < hp->num)
+        hp->due = now + HOLE_PUNCH_PACING * 1000;
+    else
+        hp->due = hp->round_start + HOLE_PUNCH_ROUND_INTERVAL * 1000;
+
+    return num;
+}
+
+
+// probe candidate i right away, e.g. a socket the peer just reached us from
+int hole_punch_probe_now (hole_punch_t *hp, int i, uint64_t now, hole_punch_send_f send, void *ctx) {
+
+    if((i < 0) || (i >= hp->num))
+        return -1;
+
+    probe(hp, i, now, send, ctx);
+
+    return 0;
+}
+
+
+// take an answer to a probe, return the index of the candidate or -1 if the cookie
+// does not belong to this check
+int hole_punch_answer (hole_punch_t *hp, uint32_t cookie, const n2n_sock_t *from, uint64_t now) {
+
+    hole_punch_candidate_t *cand;
+    uint32_t rtt;
+    int i = cookie & 0xff;
+
+    if(((cookie >> 8) != hp->nonce) || (i >= hp->num))
+        return -1;
+
+    cand = &(hp->cand[i]);
+    if(!cand->sent)
+        return -1;
+
+    rtt = (uint32_t)min(now - cand->sent, (uint64_t)UINT32_MAX);
+    rtt = max(rtt, 1);
+    if(!cand->rtt || (rtt < cand->rtt)) {
+        cand->rtt = rtt;
+        cand->from = *from;
+    }
+
+    if(!hp->answered)
+        hp->answered = now;
+
+    return i;
+}
+
+
+// return the index of the candidate answered with the lowest round trip time once the
+// others had their time to answer, else -1
+int hole_punch_nominate (const hole_punch_t *hp, uint64_t now) {
+
+    int i, best = -1;
+
+    if(!hp->answered || (now < hp->answered + HOLE_PUNCH_SETTLE * 1000))
+        return -1;
+
+    for(i = 0; i < hp->num; i++) {
+        if(hp->cand[i].rtt && ((best < 0) || (hp->cand[i].rtt < hp->cand[best].rtt)))
+            best = i;
+    }
+
+    return best;
+}
+
+
+// the port allocation step candidate i suggests, i.e. the difference between the port its
+// answer came from and the reflexive one if on the same address, 0 if it does not tell
+int hole_punch_delta (const hole_punch_t *hp, int i) {
+
+    const n2n_sock_t *from = &(hp->cand[i].from);
+    int j, delta;
+
+    for(j = 0; j < hp->num; j++) {
+        if(hp->cand[j].type != HOLE_PUNCH_CAND_REFLEXIVE)
+            continue;
+        if(hp->cand[j].sock.family != from->family)
+            return 0;
+        if(memcmp(&(hp->cand[j].sock.addr), &(from->addr),
+                  (from->family == AF_INET) ? IPV4_SIZE : IPV6_SIZE))
+            return 0;
+        delta = (int)from->port - (int)hp->cand[j].sock.port;
+        return (abs(delta) <= HOLE_PUNCH_DELTA_MAX) ? delta : 0;
+    }
+
+    return 0;
+}
+
+
+// time_usec() hole_punch_probe() or hole_punch_nominate() has something to do next,
+// 0 if nothing is left to do
+uint64_t hole_punch_due (const hole_punch_t *hp) {
+
+    uint64_t due = 0;
+
+    // no more rounds once a candidate answered or all got their chance
+    if(hp->num && !(((hp->round == 0) || (hp->next >= hp->num))
+                    && (hp->answered || (hp->round >= HOLE_PUNCH_ROUNDS))))
+        due = max(hp->due, 1);
+
+    if(hp->answered && (!due || (hp->answered + HOLE_PUNCH_SETTLE * 1000 < due)))
+        due = hp->answered + HOLE_PUNCH_SETTLE * 1000;
+
+    return due;
+}
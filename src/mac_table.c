@@ -0,0 +1,343 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#include "mac_table.h"
+
+
+// open addressing hash table mapping MAC addresses to peers
+//
+// the MAC gets packed into a uint64_t key and hashed using a randomly keyed mixer so
+// remote parties cannot craft colliding addresses. the slots are organized in groups
+// of MAC_TABLE_GROUP_SIZE, each slot has a control byte telling 'empty', 'deleted' or
+// carrying the 7 upper bits of the hash. a lookup checks all control bytes of a group
+// at once (SSE2 if available) and only compares keys of slots with matching bits; it
+// ends at the first group holding an empty slot. groups are probed triangularly.
+//
+// a zeroed table is a valid, empty table
+
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+#define MAC_TABLE_EMPTY      0x80
+#define MAC_TABLE_DELETED    0xfe
+
+
+static uint64_t mac_table_key (const n2n_mac_t mac) {
+
+    return ((uint64_t)mac[0] << 40) | ((uint64_t)mac[1] << 32) | ((uint64_t)mac[2] << 24) |
+           ((uint64_t)mac[3] << 16) | ((uint64_t)mac[4] <<  8) |  (uint64_t)mac[5];
+}
+
+
+// the mixer is shared with the modules keeping fixed-size arrays of entries indexed by a
+// randomly keyed hash (token bucket table, query cache, arp proxy). in these, a key
+// colliding with another one takes over its entry, there is no chaining. that keeps them
+// at a few bytes per entry and at constant cost per lookup no matter how many keys show
+// up, while the random key keeps remote parties from crafting colliding keys.
+
+
+uint64_t hash_mix (uint64_t h) {
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+
+    return h;
+}
+
+
+/* allocates a zeroed array of at least 'size' entries, rounded up to a power of two, and
+ * sets the index mask and a random hash key; returns NULL if allocation failed */
+void* hash_array_alloc (uint32_t size, size_t entry_size, uint32_t *mask, uint64_t *seed) {
+
+    uint32_t capacity = 1;
+    void     *entries;
+
+    while(capacity < size)
+        capacity <<= 1;
+
+    entries = calloc(capacity, entry_size);
+    if(!entries)
+        return NULL;
+
+    *mask = capacity - 1;
+    *seed = n2n_rand();
+
+    return entries;
+}
+
+
+static uint64_t mac_table_hash (const mac_table_t *table, uint64_t key) {
+
+    return hash_mix(hash_mix(key ^ table->seed[0]) + table->seed[1]);
+}
+
+
+#if defined (__SSE2__) // SSE2 -----------------------------------------------------------------------------------
+
+
+// bit i set if control byte i of the group equals 'value'
+static uint32_t mac_table_match (const uint8_t *group, uint8_t value) {
+
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)value)));
+}
+
+
+// bit i set if slot i of the group is empty or deleted, i.e. its control byte's msb is set
+static uint32_t mac_table_match_free (const uint8_t *group) {
+
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+
+
+#else // plain C -------------------------------------------------------------------------------------------------
+
+
+static uint32_t mac_table_match (const uint8_t *group, uint8_t value) {
+
+    uint32_t mask = 0;
+    int i;
+
+    for(i = 0; i < MAC_TABLE_GROUP_SIZE; i++)
+        mask |= (uint32_t)(group[i] == value) << i;
+
+    return mask;
+}
+
+
+static uint32_t mac_table_match_free (const uint8_t *group) {
+
+    uint32_t mask = 0;
+    int i;
+
+    for(i = 0; i < MAC_TABLE_GROUP_SIZE; i++)
+        mask |= (uint32_t)(group[i] >> 7) << i;
+
+    return mask;
+}
+
+
+#endif // SSE2 ---------------------------------------------------------------------------------------------------
+
+
+static int mac_table_lowest_bit (uint32_t mask) {
+
+#if defined (__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+
+    while(!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+
+    return i;
+#endif
+}
+
+
+// returns the slot index of 'key' or -1 if not found
+static int64_t mac_table_find_slot (const mac_table_t *table, uint64_t key) {
+
+    uint64_t h;
+    uint32_t group_mask, group, step = 0;
+    uint32_t match;
+    uint8_t h2;
+    int i;
+
+    if(table->capacity == 0)
+        return -1;
+
+    h = mac_table_hash(table, key);
+    h2 = h >> 57;
+    group_mask = table->capacity / MAC_TABLE_GROUP_SIZE - 1;
+    group = h & group_mask;
+
+    for(;;) {
+        const uint8_t *ctrl = table->ctrl + group * MAC_TABLE_GROUP_SIZE;
+
+        match = mac_table_match(ctrl, h2);
+        while(match) {
+            i = mac_table_lowest_bit(match);
+            if(table->slots[group * MAC_TABLE_GROUP_SIZE + i].key == key)
+                return group * MAC_TABLE_GROUP_SIZE + i;
+            match &= match - 1;
+        }
+
+        if(mac_table_match(ctrl, MAC_TABLE_EMPTY))
+            return -1;
+
+        step++;
+        group = (group + step) & group_mask;
+    }
+}
+
+
+// places a key known to be absent, there must be a free slot
+static void mac_table_place (mac_table_t *table, uint64_t key, struct peer_info *peer) {
+
+    uint64_t h;
+    uint32_t group_mask, group, step = 0;
+    uint32_t match;
+    uint32_t idx;
+
+    h = mac_table_hash(table, key);
+    group_mask = table->capacity / MAC_TABLE_GROUP_SIZE - 1;
+    group = h & group_mask;
+
+    while(!(match = mac_table_match_free(table->ctrl + group * MAC_TABLE_GROUP_SIZE))) {
+        step++;
+        group = (group + step) & group_mask;
+    }
+
+    idx = group * MAC_TABLE_GROUP_SIZE + mac_table_lowest_bit(match);
+    if(table->ctrl[idx] == MAC_TABLE_DELETED)
+        table->deleted--;
+    table->ctrl[idx] = h >> 57;
+    table->slots[idx].key = key;
+    table->slots[idx].peer = peer;
+    table->size++;
+}
+
+
+static int mac_table_resize (mac_table_t *table, uint32_t capacity) {
+
+    uint8_t *old_ctrl = table->ctrl;
+    mac_table_slot_t *old_slots = table->slots;
+    uint32_t old_capacity = table->capacity;
+    uint32_t i;
+
+    table->ctrl = (uint8_t*)malloc(capacity);
+    table->slots = (mac_table_slot_t*)malloc(capacity * sizeof(mac_table_slot_t));
+    if(!table->ctrl || !table->slots) {
+        free(table->ctrl);
+        free(table->slots);
+        table->ctrl = old_ctrl;
+        table->slots = old_slots;
+        traceEvent(TRACE_ERROR, "mac_table_resize failed to allocate %u slots", capacity);
+        return -1;
+    }
+
+    memset(table->ctrl, MAC_TABLE_EMPTY, capacity);
+    table->capacity = capacity;
+    table->size = 0;
+    table->deleted = 0;
+
+    if((table->seed[0] == 0) && (table->seed[1] == 0)) {
+        table->seed[0] = n2n_rand();
+        table->seed[1] = n2n_rand();
+    }
+
+    for(i = 0; i < old_capacity; i++) {
+        if(!(old_ctrl[i] & 0x80))
+            mac_table_place(table, old_slots[i].key, old_slots[i].peer);
+    }
+
+    free(old_ctrl);
+    free(old_slots);
+
+    return 0;
+}
+
+
+/* ************************************** */
+
+
+void mac_table_init (mac_table_t *table) {
+
+    memset(table, 0, sizeof(mac_table_t));
+}
+
+
+void mac_table_free (mac_table_t *table) {
+
+    free(table->ctrl);
+    free(table->slots);
+    table->ctrl = NULL;
+    table->slots = NULL;
+    table->capacity = 0;
+    table->size = 0;
+    table->deleted = 0;
+}
+
+
+struct peer_info* mac_table_find (const mac_table_t *table, const n2n_mac_t mac) {
+
+    int64_t idx = mac_table_find_slot(table, mac_table_key(mac));
+
+    return (idx < 0) ? NULL : table->slots[idx].peer;
+}
+
+
+// adds or replaces the entry for 'mac', returns 0 on success
+int mac_table_add (mac_table_t *table, const n2n_mac_t mac, struct peer_info *peer) {
+
+    uint64_t key = mac_table_key(mac);
+    int64_t idx = mac_table_find_slot(table, key);
+    uint32_t capacity;
+
+    if(idx >= 0) {
+        table->slots[idx].peer = peer;
+        return 0;
+    }
+
+    if((uint64_t)(table->size + table->deleted + 1) * 8 > (uint64_t)table->capacity * 7) {
+        // grow if more than half full, otherwise just get rid of the tombstones
+        capacity = (table->capacity < MAC_TABLE_MIN_CAPACITY) ? MAC_TABLE_MIN_CAPACITY : table->capacity;
+        if((table->size + 1) * 2 > capacity)
+            capacity *= 2;
+        if(mac_table_resize(table, capacity))
+            return -1;
+    }
+
+    mac_table_place(table, key, peer);
+
+    return 0;
+}
+
+
+// returns 1 if removed, 0 if not found
+int mac_table_remove (mac_table_t *table, const n2n_mac_t mac) {
+
+    int64_t idx = mac_table_find_slot(table, mac_table_key(mac));
+    const uint8_t *group;
+
+    if(idx < 0)
+        return 0;
+
+    // no probe sequence ever passed a group that still has an empty slot
+    group = table->ctrl + (idx - idx % MAC_TABLE_GROUP_SIZE);
+    if(mac_table_match(group, MAC_TABLE_EMPTY)) {
+        table->ctrl[idx] = MAC_TABLE_EMPTY;
+    } else {
+        table->ctrl[idx] = MAC_TABLE_DELETED;
+        table->deleted++;
+    }
+    table->size--;
+
+    return 1;
+}
@@ -0,0 +1,389 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+#include "mcast_snoop.h"
+
+
+// igmp and mld snooping
+//
+// the supernode replicates a multicast frame to every edge of the community. as it cannot
+// look into the (encrypted) frames, it is the edges which snoop: an edge reads the igmp
+// and mld membership reports of its host from the tap device and announces the groups,
+// i.e. their multicast mac addresses, with its REGISTER_SUPER. to an edge which does so,
+// the supernode sends multicast frames of these groups only -- and of the groups which
+// cannot be pruned, see mcast_snoop_prunable(). a group not reported again within the
+// membership interval gets dropped, the edge sends general queries into the tap device
+// regularly to have its host report. a leave makes the group expire shortly unless some
+// other member (behind a bridged tap) reports it in answer to the query sent right away.
+//
+// the groups are kept in a small array, if it runs full the edge stops snooping and gets
+// all multicast frames again
+
+
+#define IGMP_QUERY_SIZE     (ETH_FRAMESIZE + 24 + 12)       /* ipv4 header with router alert and igmpv3 query */
+#define MLD_QUERY_SIZE      (ETH_FRAMESIZE + 40 + 8 + 28)   /* ipv6 header, hop-by-hop router alert and mldv2 query */
+
+#define IGMP_V1_REPORT      0x12
+#define IGMP_V2_REPORT      0x16
+#define IGMP_V2_LEAVE       0x17
+#define IGMP_V3_REPORT      0x22
+#define MLD_V1_REPORT       131
+#define MLD_V1_DONE         132
+#define MLD_V2_REPORT       143
+
+/* igmpv3 and mldv2 group record types */
+#define MODE_IS_INCLUDE     1
+#define MODE_IS_EXCLUDE     2
+#define CHANGE_TO_INCLUDE   3
+#define CHANGE_TO_EXCLUDE   4
+#define ALLOW_NEW_SOURCES   5
+
+
+static const uint8_t all_nodes_ip6[IPV6_SIZE] = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01};
+
+
+static uint16_t inet_checksum (uint32_t sum, const uint8_t *data, size_t len) {
+
+    size_t i;
+
+    for(i = 0; i + 1 < len; i += 2) {
+        sum += (data[i] << 8) | data[i + 1];
+    }
+    if(len & 1) {
+        sum += data[len - 1] << 8;
+    }
+
+    while(sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return ~sum;
+}
+
+
+static void group_mac4 (n2n_mac_t mac, const uint8_t *group) {
+
+    mac[0] = 0x01; mac[1] = 0x00; mac[2] = 0x5e;
+    mac[3] = group[1] & 0x7f;
+    mac[4] = group[2];
+    mac[5] = group[3];
+}
+
+
+static void group_mac6 (n2n_mac_t mac, const uint8_t *group) {
+
+    mac[0] = 0x33; mac[1] = 0x33;
+    memcpy(mac + 2, group + 12, 4);
+}
+
+
+/* returns 1 if the membership changed */
+static int group_join (mcast_snoop_t *snoop, const n2n_mac_t mac, uint32_t expires) {
+
+    uint8_t i;
+
+    if(!mcast_snoop_prunable(mac))
+        return 0;
+
+    for(i = 0; i < snoop->num_groups; i++) {
+        if(memcmp(snoop->groups[i].mac, mac, sizeof(n2n_mac_t)) == 0) {
+            snoop->groups[i].expires = expires;
+            return 0;
+        }
+    }
+
+    if(snoop->num_groups == N2N_MCAST_GROUPS_MAX) {
+        if(snoop->overflow)
+            return 0;
+        traceEvent(TRACE_INFO, "Too many multicast groups to snoop, receiving all of them");
+        snoop->overflow = 1;
+        return 1;
+    }
+
+    memcpy(snoop->groups[snoop->num_groups].mac, mac, sizeof(n2n_mac_t));
+    snoop->groups[snoop->num_groups].expires = expires;
+    snoop->num_groups++;
+
+    return 1;
+}
+
+
+/* a leaving member might not have been the only one, the group expires shortly unless reported again */
+static void group_leave (mcast_snoop_t *snoop, const n2n_mac_t mac, time_t now) {
+
+    uint8_t i;
+
+    for(i = 0; i < snoop->num_groups; i++) {
+        if(memcmp(snoop->groups[i].mac, mac, sizeof(n2n_mac_t)) == 0) {
+            snoop->groups[i].expires = min(snoop->groups[i].expires, (uint32_t)now + N2N_MCAST_LEAVE_WAIT);
+            snoop->query_due = 1;
+        }
+    }
+}
+
+
+static int snoop_group_record (mcast_snoop_t *snoop, uint8_t type, uint16_t num_sources, const n2n_mac_t mac, time_t now) {
+
+    if((type == MODE_IS_EXCLUDE) || (type == CHANGE_TO_EXCLUDE)
+       || (((type == MODE_IS_INCLUDE) || (type == CHANGE_TO_INCLUDE) || (type == ALLOW_NEW_SOURCES)) && num_sources)) {
+        return group_join(snoop, mac, (uint32_t)now + N2N_MCAST_MEMBERSHIP);
+    }
+    if(((type == MODE_IS_INCLUDE) || (type == CHANGE_TO_INCLUDE)) && !num_sources) {
+        group_leave(snoop, mac, now);
+    }
+
+    return 0;
+}
+
+
+static int snoop_igmp (mcast_snoop_t *snoop, const uint8_t *igmp, size_t len, time_t now) {
+
+    n2n_mac_t mac;
+    uint16_t num_records, num_sources, r;
+    size_t pos;
+    int changed = 0;
+
+    if(len < 8)
+        return 0;
+
+    switch(igmp[0]) {
+        case IGMP_V1_REPORT:
+        case IGMP_V2_REPORT:
+            group_mac4(mac, igmp + 4);
+            return group_join(snoop, mac, (uint32_t)now + N2N_MCAST_MEMBERSHIP);
+
+        case IGMP_V2_LEAVE:
+            group_mac4(mac, igmp + 4);
+            group_leave(snoop, mac, now);
+            return 0;
+
+        case IGMP_V3_REPORT:
+            num_records = (igmp[6] << 8) | igmp[7];
+            pos = 8;
+            for(r = 0; (r < num_records) && (pos + 8 <= len); r++) {
+                num_sources = (igmp[pos + 2] << 8) | igmp[pos + 3];
+                group_mac4(mac, igmp + pos + 4);
+                changed |= snoop_group_record(snoop, igmp[pos], num_sources, mac, now);
+                pos += 8 + 4 * num_sources + 4 * igmp[pos + 1];
+            }
+            return changed;
+    }
+
+    return 0;
+}
+
+
+static int snoop_mld (mcast_snoop_t *snoop, const uint8_t *mld, size_t len, time_t now) {
+
+    n2n_mac_t mac;
+    uint16_t num_records, num_sources, r;
+    size_t pos;
+    int changed = 0;
+
+    if(len < 24)
+        return 0;
+
+    switch(mld[0]) {
+        case MLD_V1_REPORT:
+            group_mac6(mac, mld + 8);
+            return group_join(snoop, mac, (uint32_t)now + N2N_MCAST_MEMBERSHIP);
+
+        case MLD_V1_DONE:
+            group_mac6(mac, mld + 8);
+            group_leave(snoop, mac, now);
+            return 0;
+
+        case MLD_V2_REPORT:
+            num_records = (mld[6] << 8) | mld[7];
+            pos = 8;
+            for(r = 0; (r < num_records) && (pos + 20 <= len); r++) {
+                num_sources = (mld[pos + 2] << 8) | mld[pos + 3];
+                group_mac6(mac, mld + pos + 4);
+                changed |= snoop_group_record(snoop, mld[pos], num_sources, mac, now);
+                pos += 20 + 16 * num_sources + 4 * mld[pos + 1];
+            }
+            return changed;
+    }
+
+    return 0;
+}
+
+
+/* ************************************** */
+
+
+/* returns 1 if frames to the multicast mac address may go to the group's members only. all-hosts,
+ * all-routers, report and solicited-node groups (neighbor discovery) keep getting flooded, so
+ * does broadcast */
+int mcast_snoop_prunable (const n2n_mac_t mac) {
+
+    if((mac[0] == 0x01) && (mac[1] == 0x00) && (mac[2] == 0x5e)) {
+        /* 224.0.0.1, 224.0.0.2, 224.0.0.22 */
+        return !((mac[3] == 0) && (mac[4] == 0) && ((mac[5] == 0x01) || (mac[5] == 0x02) || (mac[5] == 0x16)));
+    }
+    if((mac[0] == 0x33) && (mac[1] == 0x33)) {
+        /* ff02::1, ff02::2, ff02::16, ff02::1:ffxx:xxxx */
+        if((mac[2] == 0) && (mac[3] == 0) && (mac[4] == 0) && ((mac[5] == 0x01) || (mac[5] == 0x02) || (mac[5] == 0x16)))
+            return 0;
+        return (mac[2] != 0xff);
+    }
+
+    return 0;
+}
+
+
+/* snoops igmp and mld membership reports read from the tap device, returns 1 if the groups changed */
+int mcast_snoop_report (mcast_snoop_t *snoop, const uint8_t *frame, size_t len, time_t now) {
+
+    const uint8_t *ip = frame + ETH_FRAMESIZE;
+    size_t ihl, pos;
+    uint8_t next;
+
+    if(len < ETH_FRAMESIZE + IP4_MIN_SIZE)
+        return 0;
+
+    if((frame[12] == 0x08) && (frame[13] == 0x00)) {
+        ihl = (ip[0] & 0x0f) * 4;
+        if(((ip[0] >> 4) != 4) || (ip[9] != 2) || (len < ETH_FRAMESIZE + ihl))
+            return 0;
+        return snoop_igmp(snoop, ip + ihl, len - ETH_FRAMESIZE - ihl, now);
+    }
+
+    if((frame[12] == 0x86) && (frame[13] == 0xdd) && (len >= ETH_FRAMESIZE + 40) && ((ip[0] >> 4) == 6)) {
+        /* mld comes behind a hop-by-hop options header carrying the router alert */
+        next = ip[6];
+        pos = ETH_FRAMESIZE + 40;
+        if((next == 0) && (pos + 8 <= len)) {
+            next = frame[pos];
+            pos += (frame[pos + 1] + 1) * 8;
+        }
+        if((next != 58) || (pos > len))
+            return 0;
+        return snoop_mld(snoop, frame + pos, len - pos, now);
+    }
+
+    return 0;
+}
+
+
+/* drops the groups not reported again in time, returns 1 if the groups changed */
+int mcast_snoop_expire (mcast_snoop_t *snoop, time_t now) {
+
+    uint8_t i = 0;
+    int changed = 0;
+
+    while(i < snoop->num_groups) {
+        if((int32_t)((uint32_t)now - snoop->groups[i].expires) >= 0) {
+            snoop->groups[i] = snoop->groups[--snoop->num_groups];
+            changed = 1;
+        } else {
+            i++;
+        }
+    }
+
+    if(snoop->overflow && (snoop->num_groups < N2N_MCAST_GROUPS_MAX)) {
+        /* a group that did not fit gets reported with the next query */
+        snoop->overflow = 0;
+        changed = 1;
+    }
+
+    return changed;
+}
+
+
+/* builds an igmpv3 general query from 0.0.0.0 which hosts answer within a second. older hosts
+ * take it for a query of their version, newer ones do not fall back to an older version */
+size_t mcast_snoop_igmp_query (uint8_t *buf, size_t size, const n2n_mac_t querier) {
+
+    uint8_t *ip = buf + ETH_FRAMESIZE;
+    uint16_t csum;
+
+    if(size < IGMP_QUERY_SIZE)
+        return 0;
+
+    memset(buf, 0, IGMP_QUERY_SIZE);
+    buf[0] = 0x01; buf[1] = 0x00; buf[2] = 0x5e; buf[5] = 0x01;
+    memcpy(buf + 6, querier, sizeof(n2n_mac_t));
+    buf[12] = 0x08; buf[13] = 0x00;
+
+    ip[0] = 0x46;                                  /* with options ... */
+    ip[1] = 0xc0;
+    ip[3] = 36;
+    ip[8] = 1;                                     /* ttl */
+    ip[9] = 2;                                     /* igmp */
+    ip[16] = 224; ip[19] = 1;
+    ip[20] = 0x94; ip[21] = 0x04;                  /* ... router alert */
+    csum = inet_checksum(0, ip, 24);
+    ip[10] = csum >> 8; ip[11] = csum & 0xff;
+
+    ip[24] = 0x11;                                 /* membership query ... */
+    ip[25] = 10;                                   /* ... max response time in 1/10 sec ... */
+    ip[32] = 2;                                    /* ... robustness variable ... */
+    ip[33] = N2N_MCAST_QUERY_INTERVAL;             /* ... and query interval */
+    csum = inet_checksum(0, ip + 24, 12);
+    ip[26] = csum >> 8; ip[27] = csum & 0xff;
+
+    return IGMP_QUERY_SIZE;
+}
+
+
+/* builds an mldv2 general query from the querier mac's link-local address */
+size_t mcast_snoop_mld_query (uint8_t *buf, size_t size, const n2n_mac_t querier) {
+
+    uint8_t *ip6 = buf + ETH_FRAMESIZE;
+    uint8_t *mld = ip6 + 48;
+    uint32_t sum = 0;
+    uint16_t csum;
+    int i;
+
+    if(size < MLD_QUERY_SIZE)
+        return 0;
+
+    memset(buf, 0, MLD_QUERY_SIZE);
+    buf[0] = 0x33; buf[1] = 0x33; buf[5] = 0x01;
+    memcpy(buf + 6, querier, sizeof(n2n_mac_t));
+    buf[12] = 0x86; buf[13] = 0xdd;
+
+    ip6[0] = 0x60;
+    ip6[5] = 36;                                   /* payload length */
+    ip6[6] = 0;                                    /* hop-by-hop options follow */
+    ip6[7] = 1;
+    ip6[8] = 0xfe; ip6[9] = 0x80;                  /* link-local, modified eui-64 */
+    ip6[16] = querier[0] ^ 0x02; ip6[17] = querier[1]; ip6[18] = querier[2];
+    ip6[19] = 0xff; ip6[20] = 0xfe;
+    ip6[21] = querier[3]; ip6[22] = querier[4]; ip6[23] = querier[5];
+    memcpy(ip6 + 24, all_nodes_ip6, IPV6_SIZE);
+
+    ip6[40] = 58;
+    ip6[42] = 0x05; ip6[43] = 0x02;                /* router alert: mld */
+    ip6[46] = 0x01;                                /* padn */
+
+    mld[0] = 130;                                  /* multicast listener query ... */
+    mld[4] = 0x03; mld[5] = 0xe8;                  /* ... max response code in ms ... */
+    mld[24] = 2;                                   /* ... robustness variable ... */
+    mld[25] = N2N_MCAST_QUERY_INTERVAL;            /* ... and query interval */
+
+    /* pseudo header: source and destination address, length and next header */
+    for(i = 8; i < 40; i += 2) {
+        sum += (ip6[i] << 8) | ip6[i + 1];
+    }
+    sum += 28 + 58;
+    csum = inet_checksum(sum, mld, 28);
+    mld[2] = csum >> 8; mld[3] = csum & 0xff;
+
+    return MLD_QUERY_SIZE;
+}
@@ -341,7 +341,7 @@ struct peer_info* add_sn_to_list_by_mac_or_sock (struct peer_info **sn_list, n2n
         }
 
         if((peer == NULL) && (*skip_add == SN_ADD)) {
-            peer = (struct peer_info*)calloc(1, sizeof(struct peer_info));
+            peer = peer_info_alloc();
             if(peer) {
                 sn_selection_criterion_default(&(peer->selection_criterion));
                 memcpy(&(peer->sock), sock, sizeof(n2n_sock_t));
@@ -382,6 +382,7 @@ char* msg_type2str (uint16_t msg_type) {
         case MSG_TYPE_REGISTER_SUPER_ACK: return("MSG_TYPE_REGISTER_SUPER_ACK");
         case MSG_TYPE_REGISTER_SUPER_NAK: return("MSG_TYPE_REGISTER_SUPER_NAK");
         case MSG_TYPE_FEDERATION: return("MSG_TYPE_FEDERATION");
+        case MSG_TYPE_BROADCAST: return("MSG_TYPE_BROADCAST");
         default: return("???");
     }
 
@@ -451,8 +452,9 @@ size_t purge_peer_list (struct peer_info ** peer_list,
     HASH_ITER(hh, *peer_list, scan, tmp) {
         if((scan->purgeable == SN_PURGEABLE) && (scan->last_seen < purge_before)) {
             HASH_DEL(*peer_list, scan);
+            timer_wheel_disarm(&(scan->expiry));
             retval++;
-            free(scan);
+            peer_info_free(scan);
         }
     }
 
@@ -467,13 +469,80 @@ size_t clear_peer_list (struct peer_info ** peer_list) {
 
     HASH_ITER(hh, *peer_list, scan, tmp) {
         HASH_DEL(*peer_list, scan);
+        timer_wheel_disarm(&(scan->expiry));
         retval++;
-        free(scan);
+        peer_info_free(scan);
     }
 
     return retval;
 }
 
+/* ************************************** */
+
+typedef struct peer_expiry_ctx {
+    n2n_timer_wheel_t *wheel;
+    mac_table_t       *index;
+    struct peer_info  **peer_list;
+    time_t            now;
+    size_t            num_purged;
+} peer_expiry_ctx_t;
+
+/** Arm the peer's expiry timer so it fires once the peer has not been seen for
+ *  REGISTRATION_TIMEOUT. Updates of last_seen do not need to re-arm: a timer firing
+ *  early just moves itself to the new deadline. */
+void arm_peer_expiry (n2n_timer_wheel_t *wheel, struct peer_info *peer, time_t now) {
+
+    /* peers announcing a longer keepalive interval get granted several of them */
+    time_t expires = peer->last_seen + max(REGISTRATION_TIMEOUT, N2N_KEEPALIVE_MISSED * peer->timeout) + 1;
+
+    if(peer->purgeable != SN_PURGEABLE) {
+        timer_wheel_disarm(&(peer->expiry));
+        return;
+    }
+
+    /* never seen peers are granted one purge interval, as with the periodic sweep */
+    if(peer->last_seen == 0)
+        expires = now + PURGE_REGISTRATION_FREQUENCY;
+
+    timer_wheel_arm(wheel, &(peer->expiry), expires);
+}
+
+static void peer_expiry_cb (n2n_timer_t *timer, void *data) {
+
+    peer_expiry_ctx_t *ctx = (peer_expiry_ctx_t*)data;
+    struct peer_info *peer = TIMER_CONTAINER(timer, struct peer_info, expiry);
+
+    if(peer->purgeable != SN_PURGEABLE)
+        return;
+
+    if(peer->last_seen < ctx->now - REGISTRATION_TIMEOUT) {
+        HASH_DEL(*(ctx->peer_list), peer);
+        if(ctx->index)
+            mac_table_remove(ctx->index, peer->mac_addr);
+        ctx->num_purged++;
+        peer_info_free(peer);
+    } else
+        arm_peer_expiry(ctx->wheel, peer, ctx->now);
+}
+
+/** Purge the peers whose expiry timer has fired and return the number of items that
+ *  were removed. Unlike purge_peer_list, this only touches peers actually due. The
+ *  optional index gets updated as well. */
+size_t purge_expired_peers (n2n_timer_wheel_t *wheel, mac_table_t *index, struct peer_info ** peer_list, time_t now) {
+
+    peer_expiry_ctx_t ctx;
+
+    ctx.wheel = wheel;
+    ctx.index = index;
+    ctx.peer_list = peer_list;
+    ctx.now = now;
+    ctx.num_purged = 0;
+
+    timer_wheel_advance(wheel, now, peer_expiry_cb, &ctx);
+
+    return ctx.num_purged;
+}
+
 static uint8_t hex2byte (const char * s) {
 
     char tmp[3];
@@ -618,6 +687,25 @@ uint64_t time_stamp (void) {
 }
 
 
+// returns microseconds from some arbitrary but fixed point in time, for measuring
+// time intervals such as round trip times; uses a monotonic clock if available
+uint64_t time_usec (void) {
+
+#if defined(CLOCK_MONOTONIC) && !defined(WIN32)
+    struct timespec ts;
+
+    if(0 == clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+    }
+#endif
+    struct timeval tod;
+
+    gettimeofday(&tod, NULL);
+
+    return (uint64_t)tod.tv_sec * 1000000ULL + tod.tv_usec;
+}
+
+
 // returns an initial time stamp for use with replay protection
 uint64_t initial_time_stamp (void) {
 
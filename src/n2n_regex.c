@@ -236,8 +236,19 @@ re_t re_compile (const char* pattern) {
     /* 'UNUSED' is a sentinel used to indicate end-of-pattern */
     re_compiled[j].type = UNUSED;
 
-    re_p = (re_t)calloc(1, sizeof(re_compiled));
+    /* keep the character classes along with the compiled pattern as the static
+       buffer gets overwritten by the next compilation */
+    re_p = (re_t)calloc(1, sizeof(re_compiled) + ccl_bufidx);
+    if(re_p == NULL) {
+        return 0;
+    }
     memcpy (re_p, re_compiled, sizeof(re_compiled));
+    memcpy ((unsigned char*)re_p + sizeof(re_compiled), ccl_buf, ccl_bufidx);
+    for(i = 0; i < j; i++) {
+        if((re_p[i].type == CHAR_CLASS) || (re_p[i].type == INV_CHAR_CLASS)) {
+            re_p[i].ccl = (unsigned char*)re_p + sizeof(re_compiled) + (re_compiled[i].ccl - ccl_buf);
+        }
+    }
 
     return (re_t) re_p;
 }
@@ -484,3 +495,377 @@ static int matchpattern (regex_t* pattern, const char* text, int* matchlength) {
 }
 
 #endif
+
+
+/* Compiled sets of patterns (n2n): ---------------------------------------------------------------------------
+
+   All patterns of a set get merged into one automaton. Each pattern contributes a chain of NFA states, one
+   per element ('x+' is expanded to 'x x*') plus a final accepting one. The DFA is built lazily while matching:
+   each DFA state represents an epsilon-closed set of NFA states and its transitions are indexed by byte class.
+   So, once warmed up, a text is decided in a single pass over its characters regardless of the number of
+   patterns in the set.
+
+   Other than re_matchp() which might settle for a shorter prefix match (and thus miss a full match, e.g. 'a?'
+   on "a"), the automaton exactly decides about full matches.
+*/
+
+#define RE_SET_MAX_DFA_STATES         4096      /* DFA states cached, the cache is flushed if exceeded */
+
+
+enum { RE_SET_ONE, RE_SET_STAR, RE_SET_QUESTION, RE_SET_ACCEPT };
+
+typedef struct re_set_nfa_state {
+    uint8_t                    kind;     /* RE_SET_ONE, RE_SET_STAR, ... */
+    uint32_t                   bitmap;   /* index of the element's character bitmap */
+} re_set_nfa_state_t;
+
+typedef struct re_set_dfa_state {
+    uint32_t                   *nfa;     /* sorted NFA state ids, the hash key */
+    uint32_t                   num_nfa;
+    uint8_t                    accept;
+    struct re_set_dfa_state    **next;   /* by byte class, NULL if not computed yet */
+
+    UT_hash_handle             hh;
+} re_set_dfa_state_t;
+
+typedef struct re_set_bitmap {
+    uint8_t                    map[32];
+    uint32_t                   idx;
+
+    UT_hash_handle             hh;
+} re_set_bitmap_t;
+
+typedef struct regex_set_t {
+    re_set_nfa_state_t         *nfa;
+    uint32_t                   num_nfa;
+    uint8_t                    (*bitmaps)[32];
+    uint32_t                   num_bitmaps;
+    uint8_t                    byte_class[256];
+    uint8_t                    class_rep[256];  /* one representative byte per class */
+    uint32_t                   num_classes;
+    uint32_t                   *start_nfa;
+    uint32_t                   num_start_nfa;
+    re_set_dfa_state_t         *start;
+    re_set_dfa_state_t         *states;
+    uint32_t                   num_states;
+    uint32_t                   *scratch;        /* NFA state set under construction */
+    uint32_t                   *mark;           /* generation per NFA state to dedupe the scratch set */
+    uint32_t                   generation;
+} regex_set_t;
+
+
+static int re_set_cmp_nfa (const void *a, const void *b) {
+
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* add an NFA state and the states reachable from it without consuming a character */
+static void re_set_closure (regex_set_t *set, uint32_t s, uint32_t *num) {
+
+    for(;;) {
+        if(set->mark[s] != set->generation) {
+            set->mark[s] = set->generation;
+            set->scratch[(*num)++] = s;
+        }
+        if((set->nfa[s].kind != RE_SET_STAR) && (set->nfa[s].kind != RE_SET_QUESTION)) {
+            break;
+        }
+        s++;
+    }
+}
+
+
+static void re_set_next_generation (regex_set_t *set) {
+
+    set->generation++;
+    if(set->generation == 0) {
+        memset(set->mark, 0, set->num_nfa * sizeof(uint32_t));
+        set->generation = 1;
+    }
+}
+
+
+static void re_set_free_states (regex_set_t *set) {
+
+    re_set_dfa_state_t *state, *tmp;
+
+    HASH_ITER(hh, set->states, state, tmp) {
+        HASH_DEL(set->states, state);
+        free(state->nfa);
+        free(state->next);
+        free(state);
+    }
+    set->num_states = 0;
+    set->start = NULL;
+}
+
+
+/* find or create the DFA state for the NFA state set in scratch */
+static re_set_dfa_state_t* re_set_intern (regex_set_t *set, uint32_t num) {
+
+    re_set_dfa_state_t *state;
+    uint32_t i;
+
+    qsort(set->scratch, num, sizeof(uint32_t), re_set_cmp_nfa);
+
+    HASH_FIND(hh, set->states, set->scratch, num * sizeof(uint32_t), state);
+    if(state) {
+        return state;
+    }
+
+    state = (re_set_dfa_state_t*)calloc(1, sizeof(re_set_dfa_state_t));
+    if(state == NULL) {
+        return NULL;
+    }
+    state->nfa = (uint32_t*)malloc(num * sizeof(uint32_t) + 1 /* no zero size */);
+    state->next = (re_set_dfa_state_t**)calloc(set->num_classes, sizeof(re_set_dfa_state_t*));
+    if((state->nfa == NULL) || (state->next == NULL)) {
+        free(state->nfa);
+        free(state->next);
+        free(state);
+        return NULL;
+    }
+    memcpy(state->nfa, set->scratch, num * sizeof(uint32_t));
+    state->num_nfa = num;
+    for(i = 0; i < num; i++) {
+        if(set->nfa[state->nfa[i]].kind == RE_SET_ACCEPT) {
+            state->accept = 1;
+            break;
+        }
+    }
+
+    HASH_ADD_KEYPTR(hh, set->states, state->nfa, num * sizeof(uint32_t), state);
+    set->num_states++;
+
+    return state;
+}
+
+
+static re_set_dfa_state_t* re_set_start (regex_set_t *set) {
+
+    re_set_next_generation(set);
+    memcpy(set->scratch, set->start_nfa, set->num_start_nfa * sizeof(uint32_t));
+
+    set->start = re_set_intern(set, set->num_start_nfa);
+
+    return set->start;
+}
+
+
+static re_set_dfa_state_t* re_set_step (regex_set_t *set, re_set_dfa_state_t *state, uint8_t byte_class) {
+
+    re_set_dfa_state_t *next;
+    re_set_nfa_state_t *n;
+    uint8_t c = set->class_rep[byte_class];
+    uint32_t num = 0;
+    uint32_t i;
+
+    re_set_next_generation(set);
+
+    for(i = 0; i < state->num_nfa; i++) {
+        n = &(set->nfa[state->nfa[i]]);
+        if(n->kind == RE_SET_ACCEPT) {
+            continue;
+        }
+        if(!(set->bitmaps[n->bitmap][c >> 3] & (1 << (c & 7)))) {
+            continue;
+        }
+        re_set_closure(set, (n->kind == RE_SET_STAR) ? state->nfa[i] : state->nfa[i] + 1, &num);
+    }
+
+    if(set->num_states >= RE_SET_MAX_DFA_STATES) {
+        /* the set just computed is kept in scratch, 'state' is gone after flushing */
+        re_set_free_states(set);
+        next = re_set_intern(set, num);
+        memcpy(set->scratch, set->start_nfa, set->num_start_nfa * sizeof(uint32_t));
+        set->start = re_set_intern(set, set->num_start_nfa);
+        return next;
+    }
+
+    next = re_set_intern(set, num);
+    state->next[byte_class] = next;
+
+    return next;
+}
+
+
+static uint32_t re_set_add_bitmap (regex_set_t *set, re_set_bitmap_t **unique, regex_t element) {
+
+    re_set_bitmap_t *bm, *found;
+    int c;
+
+    bm = (re_set_bitmap_t*)calloc(1, sizeof(re_set_bitmap_t));
+    if(bm == NULL) {
+        return 0;
+    }
+    /* the NUL byte terminates the text and never gets matched */
+    for(c = 1; c < 256; c++) {
+        if(matchone(element, (char)c)) {
+            bm->map[c >> 3] |= 1 << (c & 7);
+        }
+    }
+
+    HASH_FIND(hh, *unique, bm->map, sizeof(bm->map), found);
+    if(found) {
+        free(bm);
+        return found->idx;
+    }
+
+    bm->idx = set->num_bitmaps++;
+    HASH_ADD(hh, *unique, map, sizeof(bm->map), bm);
+
+    return bm->idx;
+}
+
+
+re_set_t re_set_compile (const re_t* patterns, int num_patterns) {
+
+    regex_set_t *set;
+    re_set_bitmap_t *unique = NULL, *bm, *tmp;
+    uint16_t refine[256][2];
+    uint32_t num_nfa = 0;
+    uint32_t s = 0;
+    int p, i, c, bit, num_classes;
+    uint8_t quantifier;
+
+    set = (regex_set_t*)calloc(1, sizeof(regex_set_t));
+    if(set == NULL) {
+        return 0;
+    }
+
+    /* upper bound of NFA states: two per element ('+') and an accepting one per pattern */
+    for(p = 0; p < num_patterns; p++) {
+        for(i = 0; (patterns[p] != 0) && (i < MAX_REGEXP_OBJECTS) && (patterns[p][i].type != UNUSED); i++);
+        num_nfa += 2 * i + 1;
+    }
+
+    set->nfa = (re_set_nfa_state_t*)calloc(num_nfa + 1, sizeof(re_set_nfa_state_t));
+    set->start_nfa = (uint32_t*)calloc(num_nfa + 1, sizeof(uint32_t)); /* will hold the closure */
+    set->scratch = (uint32_t*)calloc(num_nfa + 1, sizeof(uint32_t));
+    set->mark = (uint32_t*)calloc(num_nfa + 1, sizeof(uint32_t));
+    if(!set->nfa || !set->start_nfa || !set->scratch || !set->mark) {
+        goto re_set_compile_error;
+    }
+    set->num_nfa = num_nfa + 1;
+
+    /* build the NFA chains */
+    for(p = 0; p < num_patterns; p++) {
+        if(patterns[p] == 0) {
+            continue;
+        }
+        set->start_nfa[set->num_start_nfa++] = s;
+        for(i = 0; (i < MAX_REGEXP_OBJECTS) && (patterns[p][i].type != UNUSED);) {
+            quantifier = ((i + 1) < MAX_REGEXP_OBJECTS) ? patterns[p][i + 1].type : UNUSED;
+            set->nfa[s].bitmap = re_set_add_bitmap(set, &unique, patterns[p][i]);
+            switch(quantifier) {
+                case STAR:         set->nfa[s++].kind = RE_SET_STAR;     i += 2; break;
+                case QUESTIONMARK: set->nfa[s++].kind = RE_SET_QUESTION; i += 2; break;
+                case PLUS:         set->nfa[s].kind = RE_SET_ONE;
+                                   set->nfa[s + 1] = set->nfa[s];
+                                   set->nfa[++s].kind = RE_SET_STAR;
+                                   s++;                                  i += 2; break;
+                default:           set->nfa[s++].kind = RE_SET_ONE;      i += 1; break;
+            }
+        }
+        set->nfa[s++].kind = RE_SET_ACCEPT;
+    }
+
+    /* character bitmaps, the byte classes get refined by each of them */
+    set->bitmaps = calloc(set->num_bitmaps + 1, 32);
+    if(set->bitmaps == NULL) {
+        goto re_set_compile_error;
+    }
+    set->num_classes = 1;
+    HASH_ITER(hh, unique, bm, tmp) {
+        memcpy(set->bitmaps[bm->idx], bm->map, 32);
+        memset(refine, 0xff, sizeof(refine));
+        num_classes = 0;
+        for(c = 0; c < 256; c++) {
+            bit = (bm->map[c >> 3] >> (c & 7)) & 1;
+            if(refine[set->byte_class[c]][bit] == 0xffff) {
+                refine[set->byte_class[c]][bit] = num_classes++;
+            }
+            set->byte_class[c] = refine[set->byte_class[c]][bit];
+        }
+        set->num_classes = num_classes;
+        HASH_DEL(unique, bm);
+        free(bm);
+    }
+    for(c = 255; c >= 0; c--) {
+        set->class_rep[set->byte_class[c]] = c;
+    }
+
+    /* the start state is computed upfront, with no patterns at all it is the empty (dead) state */
+    set->generation = 0;
+    re_set_next_generation(set);
+    num_nfa = 0;
+    for(p = 0; p < set->num_start_nfa; p++) {
+        re_set_closure(set, set->start_nfa[p], &num_nfa);
+    }
+    memcpy(set->start_nfa, set->scratch, num_nfa * sizeof(uint32_t));
+    set->num_start_nfa = num_nfa;
+    if(re_set_start(set) == NULL) {
+        goto re_set_compile_error;
+    }
+
+    return (re_set_t)set;
+
+ re_set_compile_error:
+    HASH_ITER(hh, unique, bm, tmp) {
+        HASH_DEL(unique, bm);
+        free(bm);
+    }
+    re_set_free(set);
+
+    return 0;
+}
+
+
+int re_set_matchp (re_set_t set, const char* text) {
+
+    re_set_dfa_state_t *state, *next;
+    const unsigned char *t = (const unsigned char*)text;
+    uint8_t byte_class;
+
+    if((set == 0) || (set->start == NULL) || (t[0] == '\0')) {
+        return 0;
+    }
+
+    state = set->start;
+    for(; *t != '\0'; t++) {
+        byte_class = set->byte_class[*t];
+        next = state->next[byte_class];
+        if(next == NULL) {
+            next = re_set_step(set, state, byte_class);
+            if(next == NULL) {
+                return 0;
+            }
+        }
+        state = next;
+        if(state->num_nfa == 0) {
+            return 0;
+        }
+    }
+
+    return state->accept;
+}
+
+
+void re_set_free (re_set_t set) {
+
+    if(set == 0) {
+        return;
+    }
+
+    re_set_free_states(set);
+    free(set->nfa);
+    free(set->bitmaps);
+    free(set->start_nfa);
+    free(set->scratch);
+    free(set->mark);
+    free(set);
+}
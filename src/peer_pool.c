@@ -0,0 +1,127 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#include "peer_pool.h"
+
+
+// pooled allocation of peer entries
+//
+// peers get carved from slabs of PEER_POOL_SLAB_SIZE entries. a slab keeps all the hot
+// records (struct peer_info) next to each other and the cold ones (struct peer_info_cold)
+// in a separate array so walking or looking up peers does not drag registration and
+// management data through the cache. freed entries go to a free list and get handed
+// out again first; slabs are kept for re-use which avoids heap fragmentation from
+// the churn of registrations.
+//
+// the pool is shared by all the peer lists of the process and not thread-safe
+
+
+typedef struct peer_pool_slab {
+    struct peer_pool_slab   *next;
+    struct peer_info        hot[PEER_POOL_SLAB_SIZE];
+    struct peer_info_cold   cold[PEER_POOL_SLAB_SIZE];
+} peer_pool_slab_t;
+
+
+static struct {
+    peer_pool_slab_t   *slabs;
+    struct peer_info   *free_list;              /* chained through the hash handle's next */
+    size_t             in_use;
+    size_t             num_slabs;
+} peer_pool;
+
+
+static int peer_pool_grow (void) {
+
+    peer_pool_slab_t *slab;
+    int i;
+
+    slab = (peer_pool_slab_t*)calloc(1, sizeof(peer_pool_slab_t));
+    if(!slab) {
+        traceEvent(TRACE_ERROR, "peer_pool_grow failed to allocate a slab");
+        return -1;
+    }
+
+    // hot and cold record stay paired for the life time of the slab
+    for(i = PEER_POOL_SLAB_SIZE - 1; i >= 0; i--) {
+        slab->hot[i].cold = &(slab->cold[i]);
+        slab->hot[i].hh.next = peer_pool.free_list;
+        peer_pool.free_list = &(slab->hot[i]);
+    }
+
+    slab->next = peer_pool.slabs;
+    peer_pool.slabs = slab;
+    peer_pool.num_slabs++;
+
+    return 0;
+}
+
+
+/* ************************************** */
+
+
+/** Get a zeroed peer entry with its cold record attached, NULL if out of memory. */
+struct peer_info* peer_info_alloc (void) {
+
+    struct peer_info *peer;
+    struct peer_info_cold *cold;
+
+    if(!peer_pool.free_list) {
+        if(peer_pool_grow())
+            return NULL;
+    }
+
+    peer = peer_pool.free_list;
+    peer_pool.free_list = (struct peer_info*)peer->hh.next;
+    peer_pool.in_use++;
+
+    cold = peer->cold;
+    memset(peer, 0, sizeof(struct peer_info));
+    memset(cold, 0, sizeof(struct peer_info_cold));
+    peer->cold = cold;
+
+    return peer;
+}
+
+
+/** Return a peer entry to the pool, it must not be part of any list anymore. */
+void peer_info_free (struct peer_info *peer) {
+
+    if(!peer)
+        return;
+
+    free(peer->cold->ip_addr);
+    peer->cold->ip_addr = NULL;
+    free(peer->cold->hole_punch);
+    peer->cold->hole_punch = NULL;
+    free(peer->cold->mcast_groups);
+    peer->cold->mcast_groups = NULL;
+
+    peer->hh.next = peer_pool.free_list;
+    peer_pool.free_list = peer;
+    peer_pool.in_use--;
+}
+
+
+void peer_pool_get_stats (peer_pool_stats_t *stats) {
+
+    stats->in_use = peer_pool.in_use;
+    stats->capacity = peer_pool.num_slabs * PEER_POOL_SLAB_SIZE;
+    stats->bytes = peer_pool.num_slabs * sizeof(peer_pool_slab_t);
+}
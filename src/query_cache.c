@@ -0,0 +1,99 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+#include "query_cache.h"
+
+
+// negative cache for peer queries
+//
+// an edge asks the supernode for a peer it wants to reach directly. if that does not lead
+// to a direct path, e.g. the peer is gone or unreachable, there is no point in asking again
+// at the same pace. this cache remembers, per mac address, when the next query may be sent
+// and doubles that backoff with each query until the peer gets reached. it is a fixed-size
+// array indexed by a keyed hash of the mac address, see hash_array_alloc(); a mac address
+// pushed out of its entry by a colliding one just gets queried a bit early.
+//
+// without entries, i.e. if allocation failed, every query gets admitted
+
+
+static query_cache_entry_t* query_cache_entry (query_cache_t *cache, const n2n_mac_t mac) {
+
+    uint64_t key = 0;
+
+    memcpy(&key, mac, sizeof(n2n_mac_t));
+
+    return &(cache->entries[hash_mix(key ^ cache->seed) & cache->mask]);
+}
+
+
+/* size gets rounded up to a power of two */
+int query_cache_init (query_cache_t *cache, uint32_t size) {
+
+    memset(cache, 0, sizeof(query_cache_t));
+    cache->entries = (query_cache_entry_t*)hash_array_alloc(size, sizeof(query_cache_entry_t),
+                                                            &(cache->mask), &(cache->seed));
+    if(!cache->entries)
+        return -1;
+
+    return 0;
+}
+
+
+void query_cache_free (query_cache_t *cache) {
+
+    free(cache->entries);
+    memset(cache, 0, sizeof(query_cache_t));
+}
+
+
+/* returns 1 if a query for mac may be sent now and accounts for it; the first query of a mac
+ * address is followed by a pause of 'backoff' seconds, doubling up to 'backoff_max' */
+int query_cache_admit (query_cache_t *cache, const n2n_mac_t mac, uint16_t backoff, uint16_t backoff_max, time_t now) {
+
+    query_cache_entry_t *entry;
+
+    if(!cache->entries)
+        return 1;
+
+    entry = query_cache_entry(cache, mac);
+
+    if(memcmp(entry->mac, mac, sizeof(n2n_mac_t)) != 0) {
+        memcpy(entry->mac, mac, sizeof(n2n_mac_t));
+        entry->backoff = backoff;
+    } else if((int32_t)((uint32_t)now - entry->next_query) < 0) {
+        return 0;
+    }
+
+    entry->next_query = (uint32_t)now + entry->backoff;
+    entry->backoff = min(2 * entry->backoff, backoff_max);
+
+    return 1;
+}
+
+
+/* the peer got reached, the next query may be sent right away */
+void query_cache_clear (query_cache_t *cache, const n2n_mac_t mac) {
+
+    query_cache_entry_t *entry;
+
+    if(!cache->entries)
+        return;
+
+    entry = query_cache_entry(cache, mac);
+    if(memcmp(entry->mac, mac, sizeof(n2n_mac_t)) == 0)
+        memset(entry, 0, sizeof(query_cache_entry_t));
+}
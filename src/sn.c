@@ -52,7 +52,7 @@ static int load_allowed_sn_community (n2n_sn_t *sss, char *path) {
         if(s->is_federation) {
             continue;
         }
-        HASH_DEL(sss->communities, s);
+        sn_community_del(sss, s);
         if(NULL != s->header_encryption_ctx) {
             free(s->header_encryption_ctx);
         }
@@ -61,8 +61,13 @@ static int load_allowed_sn_community (n2n_sn_t *sss, char *path) {
 
     HASH_ITER(hh, sss->rules, re, tmp_re) {
         HASH_DEL(sss->rules, re);
+        if(NULL != re->rule) {
+            free(re->rule);
+        }
         free(re);
     }
+    re_set_free(sss->rule_set);
+    sss->rule_set = NULL;
 
     while((line = fgets(buffer, sizeof(buffer), fd)) != NULL) {
         int len = strlen(line);
@@ -109,7 +114,13 @@ static int load_allowed_sn_community (n2n_sn_t *sss, char *path) {
              * first packet will show. just in case, setup the key. */
             s->header_encryption = HEADER_ENCRYPTION_UNKNOWN;
             packet_header_setup_key (s->community, &(s->header_encryption_ctx), &(s->header_iv_ctx));
-            HASH_ADD_STR(sss->communities, community, s);
+            if(sn_community_add(sss, s) != 0) {
+                free(s->header_encryption_ctx);
+                free(s->header_iv_ctx);
+                free(s);
+                free(cmn_str);
+                continue;
+            }
 
             num_communities++;
             traceEvent(TRACE_INFO, "Added allowed community '%s' [total: %u]",
@@ -165,6 +176,23 @@ static int load_allowed_sn_community (n2n_sn_t *sss, char *path) {
     traceEvent(TRACE_NORMAL, "Loaded %u regular expressions for community name matching from %s",
 	             num_regex, path);
 
+    // compile all of the regular expressions into one automaton
+    if(num_regex > 0) {
+        re_t *patterns = (re_t*)calloc(num_regex, sizeof(re_t));
+        uint32_t i = 0;
+
+        if(patterns) {
+            HASH_ITER(hh, sss->rules, re, tmp_re) {
+                patterns[i++] = re->rule;
+            }
+            sss->rule_set = re_set_compile(patterns, i);
+            free(patterns);
+        }
+        if(NULL == sss->rule_set) {
+            traceEvent(TRACE_WARNING, "Could not compile the regular expressions into one automaton, matching them one by one");
+        }
+    }
+
     /* No new communities will be allowed */
     sss->lock_communities = 1;
 
@@ -191,6 +219,9 @@ static void help () {
     printf("[-f] ");
 #endif
     printf("[-F <federation_name>] ");
+    printf("[-H <homes>] ");
+    printf("[-S <snapshot file>] ");
+    printf("[-R <rates>] ");
 #if 0
     printf("[-m <mac_address>] ");
 #endif
@@ -209,6 +240,16 @@ static void help () {
     printf("-f                | Run in foreground.\n");
 #endif /* #if defined(N2N_HAVE_DAEMON) */
     printf("-F <fed_name>     | Name of the supernodes federation (otherwise use '%s' by default)\n", (char *)FEDERATION_NAME);
+    printf("-H <homes>        | Home each community on <homes> supernodes of the federation, max %u.\n"
+           "                  | Edges get steered to their community's home so relaying stays local;\n"
+           "                  | all federation members need the same setting. Defaults to 0 (off)\n", SN_COMMUNITY_HOMES_MAX);
+    printf("-S <path>         | Save state to this file periodically and restore it at start-up, so a\n"
+           "                  | restarted supernode keeps on serving its edges right away. Needs to be\n"
+           "                  | writable after privileges are dropped\n");
+    printf("-R <src:comm:tot> | Control plane messages (registrations, queries) admitted per second per\n"
+           "                  | source ip address, per community and overall, 0 for no limit. Defaults\n"
+           "                  | to %u:%u:%u, i.e. %u messages per edge and registration interval\n",
+           SN_CTRL_RATE_PER_SOURCE, SN_CTRL_RATE_PER_COMMUNITY, SN_CTRL_RATE_TOTAL, SN_CTRL_MSGS_PER_EDGE);
 #if 0
     printf("-m <mac_addr>     | Fix MAC address for the supernode (otherwise it may be random)\n"
            "                  | eg. -m 01:02:03:04:05:06\n");
@@ -288,9 +329,9 @@ static int setOption (int optkey, char *_optarg, n2n_sn_t *sss) {
                 anchor_sn = add_sn_to_list_by_mac_or_sock(&(sss->federation->edges), socket, (n2n_mac_t*) null_mac, &skip_add);
 
                 if(anchor_sn != NULL) {
-                    anchor_sn->ip_addr = calloc(1, N2N_EDGE_SN_HOST_SIZE);
-                    if(anchor_sn->ip_addr) {
-                        strncpy(anchor_sn->ip_addr, _optarg, N2N_EDGE_SN_HOST_SIZE - 1);
+                    anchor_sn->cold->ip_addr = calloc(1, N2N_EDGE_SN_HOST_SIZE);
+                    if(anchor_sn->cold->ip_addr) {
+                        strncpy(anchor_sn->cold->ip_addr, _optarg, N2N_EDGE_SN_HOST_SIZE - 1);
 	                      memcpy(&(anchor_sn->sock), socket, sizeof(n2n_sock_t));
                         memcpy(&(anchor_sn->mac_addr), null_mac, sizeof(n2n_mac_t));
                         anchor_sn->purgeable = SN_UNPURGEABLE;
@@ -364,6 +405,43 @@ static int setOption (int optkey, char *_optarg, n2n_sn_t *sss) {
             break;
         }
 
+        case 'H': { /* community homing */
+            int homes = atoi(_optarg);
+
+            if((homes < 0) || (homes > SN_COMMUNITY_HOMES_MAX)) {
+                traceEvent(TRACE_WARNING, "Number of community homes out of range [0..%u], homing disabled", SN_COMMUNITY_HOMES_MAX);
+                homes = 0;
+            }
+            sss->community_homes = homes;
+
+            break;
+        }
+
+        case 'S': /* state snapshot */
+            free(sss->snapshot_path);
+            sss->snapshot_path = strdup(_optarg);
+            break;
+
+        case 'R': { /* control plane admission rates, fields left out keep their defaults */
+            uint32_t *rates[3] = {&(sss->ctrl_rate_by_source), &(sss->ctrl_rate_by_community), &(sss->ctrl_rate_total)};
+            unsigned long rate;
+            char *p = _optarg;
+            int i;
+
+            for(i = 0; (i < 3) && *p; i++) {
+                if(*p != ':') {
+                    rate = strtoul(p, &p, 10);
+                    *rates[i] = (uint32_t)min(rate, UINT32_MAX / SN_CTRL_BURST_SECS);
+                }
+                if(*p == ':')
+                    p++;
+                else if(*p)
+                    break;
+            }
+
+            break;
+        }
+
 #if 0
         case 'm': {/* MAC address */
             str2mac(sss->mac_addr,_optarg);
@@ -404,6 +482,9 @@ static const struct option long_options[] = {
     {"local-port",  required_argument, NULL, 'p'},
     {"mgmt-port",   required_argument, NULL, 't'},
     {"autoip",      required_argument, NULL, 'a'},
+    {"community-homes", required_argument, NULL, 'H'},
+    {"snapshot",    required_argument, NULL, 'S'},
+    {"ctrl-rates",  required_argument, NULL, 'R'},
     {"help",        no_argument,       NULL, 'h'},
     {"verbose",     no_argument,       NULL, 'v'},
     {NULL,          0,                 NULL, 0}
@@ -416,7 +497,7 @@ static int loadFromCLI (int argc, char * const argv[], n2n_sn_t *sss) {
 
     u_char c;
 
-    while((c = getopt_long(argc, argv, "fp:l:u:g:t:a:c:F:m:vh",
+    while((c = getopt_long(argc, argv, "fp:l:u:g:t:a:c:F:H:S:R:m:vh",
 			     long_options, NULL)) != '?') {
         if(c == 255) {
             break;
@@ -505,7 +586,8 @@ static int add_federation_to_communities (n2n_sn_t *sss) {
     uint32_t    num_communities = 0;
 
     if(sss->federation != NULL) {
-        HASH_ADD_STR(sss->communities, community, sss->federation);
+        if(sn_community_add(sss, sss->federation) != 0)
+            return -1;
 
         num_communities = HASH_COUNT(sss->communities);
 
@@ -22,6 +22,7 @@
 
 static SN_SELECTION_CRITERION_DATA_TYPE sn_selection_criterion_common_read (n2n_edge_t *eee);
 static int sn_selection_criterion_sort (peer_info_t *a, peer_info_t *b);
+static int sn_selection_criterion_rtt (n2n_edge_t *eee, peer_info_t *peer);
 
 
 /* Initialize selection_criterion field in peer_info structure*/
@@ -54,20 +55,77 @@ int sn_selection_criterion_calculate (n2n_edge_t *eee, peer_info_t *peer, SN_SEL
 
     common_data = sn_selection_criterion_common_read(eee);
 
-#ifndef SN_SELECTION_RTT
-    peer->selection_criterion = (SN_SELECTION_CRITERION_DATA_TYPE)(be32toh(*data) + common_data);
+    if(eee->conf.sn_selection_strategy != SN_SELECTION_STRATEGY_RTT) {
+        peer->selection_criterion = (SN_SELECTION_CRITERION_DATA_TYPE)(be32toh(*data) + common_data);
+
+        /* Mitigation of the real supernode load in order to see less oscillations.
+         * Edges jump from a supernode to another back and forth due to purging.
+         * Because this behavior has a cost of switching, the real load is mitigated with a stickyness factor.
+         * This factor is dynamically calculated basing on network size and prevent that unnecessary switching */
+        if(peer == eee->curr_sn) {
+            sum = HASH_COUNT(eee->known_peers) + HASH_COUNT(eee->pending_peers);
+            peer->selection_criterion = peer->selection_criterion * sum / (sum + 1);
+        }
+    } else {
+        sn_selection_criterion_rtt(eee, peer);
+    }
+
+    return 0; /* OK */
+}
+
+
+/* Feed a round trip time sample into the supernode's smoothed rtt and rtt variation,
+ * the way RFC 6298 does for TCP's retransmission timer. sent is the time_usec() the
+ * request was sent at; the sample gets taken now, on arrival of the matching answer.
+ */
+int sn_selection_rtt_sample (peer_info_t *peer, uint64_t sent) {
+
+    uint64_t now = time_usec();
+    uint32_t sample, delta;
+
+    if((sent == 0) || (now < sent) || (now - sent > SN_SELECTION_RTT_SAMPLE_MAX)) {
+        return -1;
+    }
+    sample = (uint32_t)(now - sent);
+
+    if(peer->cold->srtt == 0) {
+        // first sample
+        peer->cold->srtt = sample;
+        peer->cold->rttvar = sample / 2;
+    } else {
+        delta = (peer->cold->srtt > sample) ? peer->cold->srtt - sample : sample - peer->cold->srtt;
+        // rttvar = 3/4 rttvar + 1/4 |srtt - sample|, srtt = 7/8 srtt + 1/8 sample
+        peer->cold->rttvar = peer->cold->rttvar - (peer->cold->rttvar >> 2) + (delta >> 2);
+        peer->cold->srtt = peer->cold->srtt - (peer->cold->srtt >> 3) + (sample >> 3);
+    }
+    // never let it drop to 0 which means "not measured yet"
+    peer->cold->srtt = max(peer->cold->srtt, 1);
+
+    return 0; /* OK */
+}
+
+
+/* Turn the smoothed rtt into a selection_criterion: an unsteady supernode looks slower by
+ * its rtt variation, and the current supernode gets preferred unless another one is faster
+ * by some hysteresis, so that edges do not switch over for a few microseconds of difference.
+ */
+static int sn_selection_criterion_rtt (n2n_edge_t *eee, peer_info_t *peer) {
+
+    uint32_t score, hysteresis;
+
+    if(peer->cold->srtt == 0) {
+        sn_selection_criterion_default(&(peer->selection_criterion));
+        return 0;
+    }
+
+    score = peer->cold->srtt + peer->cold->rttvar;
 
-    /* Mitigation of the real supernode load in order to see less oscillations.
-     * Edges jump from a supernode to another back and forth due to purging.
-     * Because this behavior has a cost of switching, the real load is mitigated with a stickyness factor.
-     * This factor is dynamically calculated basing on network size and prevent that unnecessary switching */
     if(peer == eee->curr_sn) {
-        sum = HASH_COUNT(eee->known_peers) + HASH_COUNT(eee->pending_peers);
-        peer->selection_criterion = peer->selection_criterion * sum / (sum + 1);
+        hysteresis = max(score >> SN_SELECTION_RTT_HYSTERESIS_SHIFT, SN_SELECTION_RTT_HYSTERESIS);
+        score = (score > hysteresis) ? score - hysteresis : 0;
     }
-#else
-    peer->selection_criterion = (SN_SELECTION_CRITERION_DATA_TYPE)(time_stamp() >> 22) - common_data;
-#endif
+
+    peer->selection_criterion = (SN_SELECTION_CRITERION_DATA_TYPE)score;
 
     return 0; /* OK */
 }
@@ -76,17 +134,17 @@ int sn_selection_criterion_calculate (n2n_edge_t *eee, peer_info_t *peer, SN_SEL
 /* Set sn_selection_criterion_common_data field to default value. */
 int sn_selection_criterion_common_data_default (n2n_edge_t *eee) {
 
-#ifndef SN_SELECTION_RTT
     SN_SELECTION_CRITERION_DATA_TYPE tmp = 0;
 
-    tmp = HASH_COUNT(eee->pending_peers);
-    if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
-        tmp *= 2;
+    // only the load based strategy makes use of common data, rtt is kept per supernode
+    if(eee->conf.sn_selection_strategy != SN_SELECTION_STRATEGY_RTT) {
+        tmp = HASH_COUNT(eee->pending_peers);
+        if(eee->conf.header_encryption == HEADER_ENCRYPTION_ENABLED) {
+            tmp *= 2;
+        }
+        tmp /= HASH_COUNT(eee->conf.supernodes);
     }
-    eee->sn_selection_criterion_common_data = tmp / HASH_COUNT(eee->conf.supernodes);
-#else
-    eee->sn_selection_criterion_common_data = (SN_SELECTION_CRITERION_DATA_TYPE)(time_stamp() >> 22);
-#endif
+    eee->sn_selection_criterion_common_data = tmp;
 
     return 0; /* OK */
 }
@@ -117,7 +175,7 @@ int sn_selection_sort (peer_info_t **peer_list) {
 
 
 /* Function that gathers requested data on a supernode.
- * it remains unaffected by SN_SELECT_RTT macro because it refers to edge behaviour only
+ * it remains unaffected by the edges' selection strategy because it refers to edge behaviour only
  */
 SN_SELECTION_CRITERION_DATA_TYPE sn_selection_criterion_gather_data (n2n_sn_t *sss) {
 
@@ -138,24 +196,44 @@ SN_SELECTION_CRITERION_DATA_TYPE sn_selection_criterion_gather_data (n2n_sn_t *s
 }
 
 
+/* Adjust the gathered data for community homing: supernodes not homing the community
+ * look busier than any of its homes, secondary homes a bit busier than the primary
+ * one. So, edges sorting their supernodes move to the primary home and keep the others
+ * as fallback. home_rank is the supernode's rank among the community's homes, or -1 if
+ * it is none of them.
+ */
+SN_SELECTION_CRITERION_DATA_TYPE sn_selection_criterion_homing (SN_SELECTION_CRITERION_DATA_TYPE data, int home_rank) {
+
+    SN_SELECTION_CRITERION_DATA_TYPE load = be32toh(data);
+
+    if(home_rank < 0) {
+        load += SN_SELECTION_CRITERION_NOT_HOME;
+    } else {
+        load += home_rank * SN_SELECTION_CRITERION_HOME_RANK;
+    }
+
+    return htobe32(load);
+}
+
+
 /* Convert selection_criterion field in a string for management port output. */
-extern char * sn_selection_criterion_str (selection_criterion_str_t out, peer_info_t *peer) {
+extern char * sn_selection_criterion_str (n2n_edge_t *eee, selection_criterion_str_t out, peer_info_t *peer) {
 
     if(NULL == out) {
         return NULL;
     }
     memset(out, 0, SN_SELECTION_CRITERION_BUF_SIZE);
 
-#ifndef SN_SELECTION_RTT
-    snprintf(out, SN_SELECTION_CRITERION_BUF_SIZE - 1,
-                  (int16_t)(peer->selection_criterion) != -1 ? "ld = %7d" :
-                                                               "ld = _______", peer->selection_criterion);
-#else
-    snprintf(out, SN_SELECTION_CRITERION_BUF_SIZE - 1,
-                  (int16_t)(peer->selection_criterion) != -1 ? "rtt %5d ms" :
-                                                               "rtt _____ ms", peer->selection_criterion);
-
-#endif
+    if(eee->conf.sn_selection_strategy != SN_SELECTION_STRATEGY_RTT) {
+        snprintf(out, SN_SELECTION_CRITERION_BUF_SIZE - 1,
+                      (int16_t)(peer->selection_criterion) != -1 ? "ld = %7d" :
+                                                                   "ld = _______", peer->selection_criterion);
+    } else {
+        // smoothed rtt in ms, one decimal
+        snprintf(out, SN_SELECTION_CRITERION_BUF_SIZE - 1,
+                      peer->cold->srtt != 0 ? "rtt %3u.%u ms" :
+                                              "rtt ___._ ms", (peer->cold->srtt + 50) / 1000, ((peer->cold->srtt + 50) / 100) % 10);
+    }
 
     return out;
 }
@@ -0,0 +1,482 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#include "sn_snapshot.h"
+
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+
+// supernode state snapshot for warm restarts
+//
+// the communities with their edges and the federation's supernodes get written to a
+// file on shutdown, SN_SNAPSHOT_INTERVAL seconds after they changed, and every
+// SN_SNAPSHOT_REFRESH_INTERVAL seconds otherwise. a restarted supernode reads
+// them back before handling the first packet and just keeps on forwarding -- instead of
+// failing until each and every edge has registered again. community ids, auto ip
+// sub-networks and the edges' addresses, auth tokens and last valid time stamps stay
+// the same. so do the supernode's MAC address and auth token which the federation and
+// the edges know the supernode by
+//
+// the snapshot gets filled in through a shared memory mapping of a temporary file
+// (plain file i/o on windows) which then is renamed over the previous one, a crash
+// while writing leaves the last complete snapshot in place. the file holds the records
+// below as they are in memory, i.e. in host byte order: it is meant for restarting on
+// the same machine, not for moving state elsewhere. snapshots of different layout or
+// with checksum mismatch get ignored
+
+
+#define SN_SNAPSHOT_MAGIC     "n2nS"
+#define SN_SNAPSHOT_VERSION   2
+
+
+typedef struct sn_snapshot_header {
+    char                  magic[4];
+    uint32_t              version;
+    uint32_t              header_size;      /* record sizes, a mismatch indicates a different layout */
+    uint32_t              community_size;
+    uint32_t              peer_size;
+    uint32_t              num_communities;
+    uint64_t              body_size;
+    uint64_t              checksum;         /* pearson_hash_64 of everything following the header */
+    int64_t               written;
+    n2n_mac_t             mac_addr;
+    n2n_auth_t            auth;
+} sn_snapshot_header_t;
+
+/* followed by num_peers peer records */
+typedef struct sn_snapshot_community {
+    char                  community[N2N_COMMUNITY_SIZE];
+    uint32_t              id;
+    uint32_t              num_peers;
+    uint8_t               is_federation;
+    uint8_t               purgeable;
+    uint8_t               header_encryption;
+    n2n_ip_subnet_t       auto_ip_net;
+} sn_snapshot_community_t;
+
+typedef struct sn_snapshot_peer {
+    n2n_mac_t             mac_addr;
+    uint8_t               purgeable;
+    uint8_t               compact_packets;
+    uint16_t              timeout;
+    n2n_ip_subnet_t       dev_addr;
+    n2n_sock_t            sock;
+    int64_t               last_seen;
+    uint64_t              last_valid_time_stamp;
+    n2n_desc_t            dev_desc;
+    n2n_auth_t            auth;
+} sn_snapshot_peer_t;
+
+typedef struct sn_snapshot_file {
+    uint8_t               *base;
+    size_t                size;
+#ifndef WIN32
+    int                   fd;
+#else
+    FILE                  *fd;
+#endif
+} sn_snapshot_file_t;
+
+
+/* ************************************** */
+
+
+static int snapshot_map_new (sn_snapshot_file_t *f, const char *path, size_t size) {
+
+    f->size = size;
+
+#ifndef WIN32
+    f->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if(f->fd < 0)
+        return -1;
+
+    if(ftruncate(f->fd, size) == 0) {
+        f->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+        if(f->base != MAP_FAILED)
+            return 0;
+    }
+    close(f->fd);
+#else
+    f->fd = fopen(path, "wb");
+    if(f->fd == NULL)
+        return -1;
+
+    f->base = (uint8_t*)calloc(1, size);
+    if(f->base)
+        return 0;
+    fclose(f->fd);
+#endif
+
+    return -1;
+}
+
+
+static int snapshot_map_existing (sn_snapshot_file_t *f, const char *path) {
+
+#ifndef WIN32
+    struct stat st;
+
+    f->fd = open(path, O_RDONLY);
+    if(f->fd < 0)
+        return -1;
+
+    if((fstat(f->fd, &st) == 0) && (st.st_size >= sizeof(sn_snapshot_header_t))) {
+        f->size = st.st_size;
+        f->base = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+        if(f->base != MAP_FAILED)
+            return 0;
+    }
+    close(f->fd);
+#else
+    long size;
+
+    f->fd = fopen(path, "rb");
+    if(f->fd == NULL)
+        return -1;
+
+    if((fseek(f->fd, 0, SEEK_END) == 0) && ((size = ftell(f->fd)) >= (long)sizeof(sn_snapshot_header_t))) {
+        f->size = size;
+        f->base = (uint8_t*)malloc(f->size);
+        if(f->base) {
+            rewind(f->fd);
+            if(fread(f->base, 1, f->size, f->fd) == f->size)
+                return 0;
+            free(f->base);
+        }
+    }
+    fclose(f->fd);
+#endif
+
+    return -1;
+}
+
+
+/* unmaps the file, a new one gets written out (which mmap does already) */
+static int snapshot_unmap (sn_snapshot_file_t *f, int write_out) {
+
+    int ret = 0;
+
+#ifndef WIN32
+    munmap(f->base, f->size);
+    close(f->fd);
+#else
+    if(write_out && (fwrite(f->base, 1, f->size, f->fd) != f->size))
+        ret = -1;
+    free(f->base);
+    fclose(f->fd);
+#endif
+
+    return ret;
+}
+
+
+/* ************************************** */
+
+
+int sn_snapshot_write (n2n_sn_t *sss, time_t now) {
+
+    sn_snapshot_file_t f;
+    sn_snapshot_header_t hdr;
+    sn_snapshot_community_t rec;
+    sn_snapshot_peer_t peer_rec;
+    struct sn_community *comm, *tmp_comm;
+    struct peer_info *peer, *tmp_peer;
+    char *tmp_path;
+    size_t size, pos;
+    uint32_t num_communities = 0;
+
+    if(!sss->snapshot_path)
+        return 0;
+
+    size = sizeof(hdr);
+    HASH_ITER(hh, sss->communities, comm, tmp_comm) {
+        size += sizeof(rec) + HASH_COUNT(comm->edges) * sizeof(peer_rec);
+        num_communities++;
+    }
+
+    tmp_path = (char*)malloc(strlen(sss->snapshot_path) + 5);
+    if(!tmp_path)
+        return -1;
+    sprintf(tmp_path, "%s.tmp", sss->snapshot_path);
+
+    if(snapshot_map_new(&f, tmp_path, size)) {
+        traceEvent(TRACE_WARNING, "Failed to create snapshot %s: %s", tmp_path, strerror(errno));
+        free(tmp_path);
+        return -1;
+    }
+
+    pos = sizeof(hdr);
+    HASH_ITER(hh, sss->communities, comm, tmp_comm) {
+        memset(&rec, 0, sizeof(rec));
+        memcpy(rec.community, comm->community, N2N_COMMUNITY_SIZE);
+        rec.id = comm->id;
+        rec.num_peers = HASH_COUNT(comm->edges);
+        rec.is_federation = comm->is_federation;
+        rec.purgeable = comm->purgeable;
+        rec.header_encryption = comm->header_encryption;
+        rec.auto_ip_net = comm->auto_ip_net;
+        memcpy(f.base + pos, &rec, sizeof(rec));
+        pos += sizeof(rec);
+
+        HASH_ITER(hh, comm->edges, peer, tmp_peer) {
+            memset(&peer_rec, 0, sizeof(peer_rec));
+            memcpy(peer_rec.mac_addr, peer->mac_addr, sizeof(n2n_mac_t));
+            peer_rec.purgeable = peer->purgeable;
+            peer_rec.compact_packets = peer->compact_packets;
+            peer_rec.timeout = peer->timeout;
+            peer_rec.dev_addr = peer->dev_addr;
+            peer_rec.sock = peer->sock;
+            peer_rec.last_seen = peer->last_seen;
+            peer_rec.last_valid_time_stamp = peer->last_valid_time_stamp;
+            memcpy(peer_rec.dev_desc, peer->cold->dev_desc, sizeof(n2n_desc_t));
+            peer_rec.auth = peer->cold->auth;
+            memcpy(f.base + pos, &peer_rec, sizeof(peer_rec));
+            pos += sizeof(peer_rec);
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SN_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SN_SNAPSHOT_VERSION;
+    hdr.header_size = sizeof(sn_snapshot_header_t);
+    hdr.community_size = sizeof(sn_snapshot_community_t);
+    hdr.peer_size = sizeof(sn_snapshot_peer_t);
+    hdr.num_communities = num_communities;
+    hdr.body_size = size - sizeof(hdr);
+    hdr.checksum = pearson_hash_64(f.base + sizeof(hdr), hdr.body_size);
+    hdr.written = now;
+    memcpy(hdr.mac_addr, sss->mac_addr, sizeof(n2n_mac_t));
+    hdr.auth = sss->auth;
+    memcpy(f.base, &hdr, sizeof(hdr));
+
+    if(snapshot_unmap(&f, 1) == 0) {
+#ifdef WIN32
+        remove(sss->snapshot_path);
+#endif
+        if(rename(tmp_path, sss->snapshot_path) == 0) {
+            traceEvent(TRACE_DEBUG, "Wrote snapshot of %u communities to %s", num_communities, sss->snapshot_path);
+            free(tmp_path);
+            return 0;
+        }
+    }
+
+    traceEvent(TRACE_WARNING, "Failed to write snapshot %s: %s", sss->snapshot_path, strerror(errno));
+    free(tmp_path);
+
+    return -1;
+}
+
+
+/* ************************************** */
+
+
+/* finds or sets up the community the record describes, returns NULL if it is not allowed (anymore)
+ * and sets *same_id if the community id the edges know is still valid */
+static struct sn_community* snapshot_restore_community (n2n_sn_t *sss, sn_snapshot_community_t *rec, int *same_id) {
+
+    struct sn_community *comm;
+
+    rec->community[N2N_COMMUNITY_SIZE - 1] = '\0';
+
+    if(rec->is_federation == IS_FEDERATION) {
+        *same_id = 0;
+        return sss->federation;
+    }
+
+    HASH_FIND_STR(sss->communities, rec->community, comm);
+    if(comm) {
+        /* fixed-name community loaded from file, take over whether it uses header encryption */
+        if(comm->header_encryption == HEADER_ENCRYPTION_UNKNOWN)
+            comm->header_encryption = rec->header_encryption;
+        *same_id = (comm->id == rec->id);
+        return comm;
+    }
+
+    /* communities with encrypted header need a key, i.e. are fixed-name ones */
+    if(rec->header_encryption == HEADER_ENCRYPTION_ENABLED)
+        return NULL;
+
+    if(sss->lock_communities && (community_allowed_by_rules(sss, rec->community) != 1))
+        return NULL;
+
+    comm = (struct sn_community*)calloc(1, sizeof(struct sn_community));
+    if(!comm)
+        return NULL;
+
+    comm_init(comm, rec->community);
+    comm->header_encryption = HEADER_ENCRYPTION_NONE;
+    comm->header_encryption_ctx = NULL;
+    comm->purgeable = COMMUNITY_PURGEABLE;
+    if(sn_community_add_with_id(sss, comm, rec->id) != 0) {
+        free(comm);
+        return NULL;
+    }
+    *same_id = (comm->id == rec->id);
+
+    if((rec->auto_ip_net.net_bitlen != 0)
+       && subnet_available(sss, comm, rec->auto_ip_net.net_addr, bitlen2mask(rec->auto_ip_net.net_bitlen))) {
+        comm->auto_ip_net = rec->auto_ip_net;
+    } else {
+        assign_one_ip_subnet(sss, comm);
+    }
+
+    return comm;
+}
+
+
+/* returns 1 if the peer got restored */
+static int snapshot_restore_peer (n2n_sn_t *sss, struct sn_community *comm, const sn_snapshot_peer_t *rec,
+                                  int same_id, time_t written, time_t now) {
+
+    struct peer_info *peer;
+    time_t last_seen;
+    int skip_add;
+
+    /* a peer listed was still registered when the snapshot got written, last seen times
+     * might be older as they alone do not make the supernode write a new snapshot */
+    last_seen = max(rec->last_seen, written);
+
+    if(comm == sss->federation) {
+        if(memcmp(rec->mac_addr, sss->mac_addr, sizeof(n2n_mac_t)) == 0)
+            return 0;
+        if((rec->purgeable == SN_PURGEABLE) && (last_seen < now - LAST_SEEN_SN_INACTIVE))
+            return 0;
+
+        /* anchor supernodes from the command line get their MAC address back */
+        skip_add = SN_ADD;
+        peer = add_sn_to_list_by_mac_or_sock(&(comm->edges), (n2n_sock_t*)&(rec->sock), (n2n_mac_t*)&(rec->mac_addr), &skip_add);
+        if(!peer)
+            return 0;
+        if(skip_add == SN_ADD_ADDED) {
+            peer->purgeable = rec->purgeable;
+            peer->last_valid_time_stamp = rec->last_valid_time_stamp;
+        }
+        if(last_seen > peer->last_seen)
+            peer->last_seen = last_seen;
+        arm_peer_expiry(&(comm->edges_expiry), peer, now);
+
+        return 1;
+    }
+
+    if((rec->purgeable == SN_PURGEABLE) && (last_seen < now - REGISTRATION_TIMEOUT))
+        return 0;
+
+    HASH_FIND_PEER(comm->edges, rec->mac_addr, peer);
+    if(peer)
+        return 0;
+
+    peer = peer_info_alloc(); /* deallocated in purge_expired_peers */
+    if(!peer)
+        return 0;
+
+    memcpy(peer->mac_addr, rec->mac_addr, sizeof(n2n_mac_t));
+    peer->purgeable = rec->purgeable;
+    /* compact PACKETs carry the community id, the edge falls back to regular ones with its next registration */
+    peer->compact_packets = same_id ? rec->compact_packets : 0;
+    peer->timeout = rec->timeout;
+    peer->dev_addr = rec->dev_addr;
+    peer->sock = rec->sock;
+    peer->last_seen = last_seen;
+    peer->last_valid_time_stamp = rec->last_valid_time_stamp;
+    memcpy(peer->cold->dev_desc, rec->dev_desc, sizeof(n2n_desc_t));
+    peer->cold->auth = rec->auth;
+
+    HASH_ADD_PEER(comm->edges, peer);
+    mac_table_add(&(comm->edges_index), peer->mac_addr, peer);
+    arm_peer_expiry(&(comm->edges_expiry), peer, now);
+
+    return 1;
+}
+
+
+int sn_snapshot_load (n2n_sn_t *sss, time_t now) {
+
+    sn_snapshot_file_t f;
+    sn_snapshot_header_t hdr;
+    sn_snapshot_community_t rec;
+    sn_snapshot_peer_t peer_rec;
+    struct sn_community *comm;
+    size_t pos;
+    uint32_t c, p;
+    uint32_t num_communities = 0, num_edges = 0, num_sn = 0;
+    int same_id;
+
+    if(!sss->snapshot_path)
+        return 0;
+
+    if(snapshot_map_existing(&f, sss->snapshot_path)) {
+        traceEvent(TRACE_NORMAL, "No snapshot to restore from at %s", sss->snapshot_path);
+        return -1;
+    }
+
+    memcpy(&hdr, f.base, sizeof(hdr));
+    if((memcmp(hdr.magic, SN_SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0)
+       || (hdr.version != SN_SNAPSHOT_VERSION)
+       || (hdr.header_size != sizeof(sn_snapshot_header_t))
+       || (hdr.community_size != sizeof(sn_snapshot_community_t))
+       || (hdr.peer_size != sizeof(sn_snapshot_peer_t))
+       || (hdr.body_size != f.size - sizeof(hdr))
+       || (hdr.checksum != pearson_hash_64(f.base + sizeof(hdr), hdr.body_size))) {
+        traceEvent(TRACE_WARNING, "Ignoring invalid or incompatible snapshot %s", sss->snapshot_path);
+        snapshot_unmap(&f, 0);
+        return -1;
+    }
+
+    memcpy(sss->mac_addr, hdr.mac_addr, sizeof(n2n_mac_t));
+    sss->auth = hdr.auth;
+
+    pos = sizeof(hdr);
+    for(c = 0; c < hdr.num_communities; c++) {
+        if(f.size - pos < sizeof(rec))
+            break;
+        memcpy(&rec, f.base + pos, sizeof(rec));
+        pos += sizeof(rec);
+        if((f.size - pos) / sizeof(peer_rec) < rec.num_peers)
+            break;
+
+        comm = snapshot_restore_community(sss, &rec, &same_id);
+        if(!comm) {
+            traceEvent(TRACE_INFO, "Not restoring community '%s' from snapshot", rec.community);
+            pos += rec.num_peers * sizeof(peer_rec);
+            continue;
+        }
+        if(comm != sss->federation)
+            num_communities++;
+
+        for(p = 0; p < rec.num_peers; p++) {
+            memcpy(&peer_rec, f.base + pos, sizeof(peer_rec));
+            pos += sizeof(peer_rec);
+            if(snapshot_restore_peer(sss, comm, &peer_rec, same_id, hdr.written, now)) {
+                if(comm == sss->federation)
+                    num_sn++;
+                else
+                    num_edges++;
+            }
+        }
+    }
+
+    snapshot_unmap(&f, 0);
+
+    traceEvent(TRACE_NORMAL, "Restored %u communities with %u edges and %u federated supernodes from snapshot %s taken %d sec ago",
+               num_communities, num_edges, num_sn, sss->snapshot_path, (int)(now - hdr.written));
+
+    return 0;
+}
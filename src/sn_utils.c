@@ -21,12 +21,19 @@
 #define HASH_FIND_COMMUNITY(head, name, out) HASH_FIND_STR(head, name, out)
 
 static int try_forward (n2n_sn_t * sss,
-                        const struct sn_community *comm,
+                        struct sn_community *comm,
                         const n2n_common_t * cmn,
                         const n2n_mac_t dstMac,
                         uint8_t from_supernode,
                         const uint8_t * pktbuf,
-                        size_t pktsize);
+                        size_t pktsize,
+                        time_t now);
+
+static void learn_remote_edge (n2n_sn_t *sss,
+                               struct sn_community *comm,
+                               const n2n_mac_t mac,
+                               const n2n_sock_t *sn_sock,
+                               time_t now);
 
 static ssize_t sendto_sock (n2n_sn_t *sss,
                             const n2n_sock_t *sock,
@@ -42,6 +49,8 @@ static int try_broadcast (n2n_sn_t * sss,
                           const struct sn_community *comm,
                           const n2n_common_t * cmn,
                           const n2n_mac_t srcMac,
+                          const n2n_mac_t dstMac,
+                          const n2n_BROADCAST_t *bcast,
                           uint8_t from_supernode,
                           const uint8_t * pktbuf,
                           size_t pktsize);
@@ -63,6 +72,12 @@ static int sort_communities (n2n_sn_t *sss,
                              time_t* p_last_sort,
                              time_t now);
 
+static int write_snapshot (n2n_sn_t *sss,
+                           time_t* p_last_snapshot,
+                           time_t now);
+
+static void drop_nat_probe (n2n_timer_t *timer, void *data);
+
 static int process_mgmt (n2n_sn_t *sss,
                          const struct sockaddr_in *sender_sock,
                          const uint8_t *mgmt_buf,
@@ -76,22 +91,30 @@ static int process_udp (n2n_sn_t *sss,
                         time_t now);
 
 static const n2n_mac_t null_mac = {0, 0, 0, 0, 0, 0};
+static const n2n_mac_t broadcast_mac = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 
 /* ************************************** */
 
 static int try_forward (n2n_sn_t * sss,
-                        const struct sn_community *comm,
+                        struct sn_community *comm,
                         const n2n_common_t * cmn,
                         const n2n_mac_t dstMac,
                         uint8_t from_supernode,
                         const uint8_t * pktbuf,
-                        size_t pktsize) {
+                        size_t pktsize,
+                        time_t now) {
 
     struct peer_info *    scan;
+    struct peer_info *    remote;
     macstr_t              mac_buf;
     n2n_sock_str_t        sockbuf;
 
-    HASH_FIND_PEER(comm->edges, dstMac, scan);
+    /* the federation's list is also fed by add_sn_to_list_by_mac_or_sock and thus not indexed */
+    if(comm->is_federation == IS_FEDERATION) {
+        HASH_FIND_PEER(comm->edges, dstMac, scan);
+    } else {
+        scan = mac_table_find(&(comm->edges_index), dstMac);
+    }
 
     if(NULL != scan) {
         int data_sent_len;
@@ -99,6 +122,7 @@ static int try_forward (n2n_sn_t * sss,
 
         if(data_sent_len == pktsize) {
             ++(sss->stats.fwd);
+            ++(sss->community_ids.stats[comm->id].fwd);
             traceEvent(TRACE_DEBUG, "unicast %lu to [%s] %s",
                        pktsize,
                        sock_to_cstr(sockbuf, &(scan->sock)),
@@ -113,9 +137,50 @@ static int try_forward (n2n_sn_t * sss,
         }
     } else {
         if(!from_supernode) {
-            /* Forwarding packet to all federated supernodes. */
-            traceEvent(TRACE_DEBUG, "Unknown MAC. Broadcasting packet to all federated supernodes.");
-            try_broadcast(sss, NULL, cmn, sss->mac_addr, from_supernode, pktbuf, pktsize);
+            remote = mac_table_find(&(comm->remote_index), dstMac);
+            if(remote && (remote->sock.family == AF_INET)) {
+                /* Located at a federated supernode */
+                if(sendto_sock(sss, &(remote->sock), pktbuf, pktsize) == pktsize) {
+                    ++(sss->stats.fed_unicast);
+                    traceEvent(TRACE_DEBUG, "unicast %lu to supernode [%s] of %s",
+                               pktsize,
+                               sock_to_cstr(sockbuf, &(remote->sock)),
+                               macaddr_str(mac_buf, dstMac));
+                } else {
+                    ++(sss->stats.errors);
+                    traceEvent(TRACE_ERROR, "unicast %lu to supernode [%s] of %s FAILED (%d: %s)",
+                               pktsize,
+                               sock_to_cstr(sockbuf, &(remote->sock)),
+                               macaddr_str(mac_buf, dstMac),
+                               errno, strerror(errno));
+                }
+            } else if(remote && (now - remote->last_seen < REMOTE_EDGE_ABSENT_TIMEOUT)) {
+                /* Recently asked for, nobody in the federation has it */
+                ++(sss->stats.fed_absent);
+                traceEvent(TRACE_DEBUG, "try_forward %s absent from federation. Dropping the packet.",
+                           macaddr_str(mac_buf, dstMac));
+                return(-2);
+            } else {
+                /* Forwarding packet to all federated supernodes. */
+                traceEvent(TRACE_DEBUG, "Unknown MAC. Broadcasting packet to all federated supernodes.");
+                try_broadcast(sss, NULL, cmn, sss->mac_addr, NULL, NULL, from_supernode, pktbuf, pktsize);
+                ++(sss->stats.fed_broadcast);
+
+                /* Until the edge gets located, this is not repeated for each packet */
+                if(!remote && (comm->is_federation == IS_NO_FEDERATION)) {
+                    remote = peer_info_alloc(); /* deallocated in purge_expired_peers */
+                    if(remote) {
+                        memcpy(remote->mac_addr, dstMac, sizeof(n2n_mac_t));
+                        remote->purgeable = SN_PURGEABLE;
+                        HASH_ADD_PEER(comm->remote_edges, remote);
+                        mac_table_add(&(comm->remote_index), remote->mac_addr, remote);
+                        arm_peer_expiry(&(comm->remote_expiry), remote, now);
+                    }
+                }
+                if(remote) {
+                    remote->last_seen = now;
+                }
+            }
         } else {
             traceEvent(TRACE_DEBUG, "try_forward unknown MAC. Dropping the packet.");
             /* Not a known MAC so drop. */
@@ -126,6 +191,113 @@ static int try_forward (n2n_sn_t * sss,
     return(0);
 }
 
+/** Check if the socket belongs to one of the federated supernodes. */
+static int is_federation_member (n2n_sn_t *sss, const n2n_sock_t *sock) {
+
+    struct peer_info *sn, *tmp;
+
+    HASH_ITER(hh, sss->federation->edges, sn, tmp) {
+        if(sock_equal(&(sn->sock), sock))
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/** Control plane admission: registrations and queries are charged against token buckets per
+ *  source ip address, per community and overall before any of the costly work (setting up
+ *  communities, matching rules, assigning addresses, assembling the ACK payload) is done.
+ *  That leaves processing time for forwarding PACKETs which are not limited, even if a big
+ *  site behind a single NAT comes back online and all of its edges register at once. The
+ *  federation is not limited, nor are supernodes by source. Returns 1 if admitted. */
+static int admit_control_msg (n2n_sn_t *sss,
+                              const struct sockaddr_in *sender_sock,
+                              const n2n_common_t *cmn,
+                              const struct sn_community *comm,
+                              uint8_t from_supernode,
+                              time_t now) {
+
+    n2n_sock_t sender;
+    size_t     len;
+    uint64_t   source = sender_sock->sin_addr.s_addr;
+    uint64_t   community;
+    int        by_source = 1;
+
+    if(comm == sss->federation)
+        return 1;
+
+    if(from_supernode) {
+        sender.family = AF_INET;
+        sender.port = ntohs(sender_sock->sin_port);
+        memcpy(sender.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
+        by_source = !is_federation_member(sss, &sender);
+    }
+
+    for(len = 0; (len < N2N_COMMUNITY_SIZE) && cmn->community[len]; len++);
+    community = pearson_hash_64(cmn->community, len);
+
+    /* check all buckets before charging any so a dropped message does not use up tokens */
+    if((by_source && !token_bucket_table_ready(&(sss->ctrl_by_source), source, now))
+       || !token_bucket_table_ready(&(sss->ctrl_by_community), community, now)
+       || !token_bucket_ready(&(sss->ctrl_total), sss->ctrl_rate_total, sss->ctrl_rate_total * SN_CTRL_BURST_SECS, now))
+        return 0;
+
+    if(by_source)
+        token_bucket_table_charge(&(sss->ctrl_by_source), source);
+    token_bucket_table_charge(&(sss->ctrl_by_community), community);
+    token_bucket_charge(&(sss->ctrl_total), sss->ctrl_rate_total);
+
+    return 1;
+}
+
+
+/** Note that an edge can be reached through a federated supernode, as learned from
+ *  REGISTER_SUPERs and PACKETs the supernode forwarded. Senders not belonging to the
+ *  federation are ignored. */
+static void learn_remote_edge (n2n_sn_t *sss,
+                               struct sn_community *comm,
+                               const n2n_mac_t mac,
+                               const n2n_sock_t *sn_sock,
+                               time_t now) {
+
+    struct peer_info *remote;
+    macstr_t         mac_buf;
+    n2n_sock_str_t   sockbuf;
+
+    if(comm->is_federation == IS_FEDERATION)
+        return;
+
+    remote = mac_table_find(&(comm->remote_index), mac);
+    if(remote && sock_equal(&(remote->sock), sn_sock)) {
+        remote->last_seen = now;
+        return;
+    }
+
+    if(!is_federation_member(sss, sn_sock))
+        return;
+
+    if(!remote) {
+        remote = peer_info_alloc(); /* deallocated in purge_expired_peers */
+        if(!remote)
+            return;
+        memcpy(remote->mac_addr, mac, sizeof(n2n_mac_t));
+        remote->purgeable = SN_PURGEABLE;
+        HASH_ADD_PEER(comm->remote_edges, remote);
+        mac_table_add(&(comm->remote_index), remote->mac_addr, remote);
+        /* an absent entry turning into a located one does not need to re-arm as
+         * last_seen only moves forward */
+        arm_peer_expiry(&(comm->remote_expiry), remote, now);
+    }
+
+    memcpy(&(remote->sock), sn_sock, sizeof(n2n_sock_t));
+    remote->last_seen = now;
+
+    traceEvent(TRACE_DEBUG, "learn_remote_edge %s at [%s]",
+               macaddr_str(mac_buf, mac),
+               sock_to_cstr(sockbuf, sn_sock));
+}
+
 /** Send a datagram to the destination embodied in a n2n_sock_t.
  *
  *    @return -1 on error otherwise number of bytes sent
@@ -144,9 +316,12 @@ static ssize_t sendto_sock (n2n_sn_t *sss,
         udpsock.sin_port = htons(sock->port);
         memcpy(&(udpsock.sin_addr.s_addr), &(sock->addr.v4), IPV4_SIZE);
 
-        traceEvent(TRACE_DEBUG, "sendto_sock %lu to [%s]",
-                   pktsize,
-                   sock_to_cstr(sockbuf, sock));
+        // spare the formatting on the forwarding path if it does not get logged anyway
+        if(getTraceLevel() >= 4 /* TRACE_DEBUG */) {
+            traceEvent(TRACE_DEBUG, "sendto_sock %lu to [%s]",
+                       pktsize,
+                       sock_to_cstr(sockbuf, sock));
+        }
 
         return sendto(sss->sock, pktbuf, pktsize, 0,
                       (const struct sockaddr *)&udpsock, sizeof(struct sockaddr_in));
@@ -157,15 +332,74 @@ static ssize_t sendto_sock (n2n_sn_t *sss,
     }
 }
 
+/** Keeps the multicast groups an edge announced with its REGISTER_SUPER, edges not
+ *  snooping (or with too many groups to announce) get all multicast frames. */
+static void update_edge_mcast_groups (struct peer_info *scan, const n2n_REGISTER_SUPER_t *reg) {
+
+    n2n_mac_t *groups = NULL;
+
+    scan->mcast_snoop = 0;
+    if(!(reg->features & N2N_FEATURE_MCAST_SNOOP)) {
+        return;
+    }
+
+    if(reg->num_mcast_groups) {
+        groups = (n2n_mac_t*)realloc(scan->cold->mcast_groups, reg->num_mcast_groups * sizeof(n2n_mac_t));
+        if(!groups) {
+            return;
+        }
+        memcpy(groups, reg->mcast_groups, reg->num_mcast_groups * sizeof(n2n_mac_t));
+    } else {
+        free(scan->cold->mcast_groups);
+    }
+
+    scan->cold->mcast_groups = groups;
+    scan->cold->num_mcast_groups = reg->num_mcast_groups;
+    scan->mcast_snoop = 1;
+}
+
+
+static int edge_in_mcast_group (const struct peer_info *scan, const n2n_mac_t dstMac) {
+
+    uint8_t i;
+
+    for(i = 0; i < scan->cold->num_mcast_groups; i++) {
+        if(memcmp(scan->cold->mcast_groups[i], dstMac, sizeof(n2n_mac_t)) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int mac_excluded (const n2n_BROADCAST_t *bcast, const n2n_mac_t mac) {
+
+    uint8_t i;
+
+    for(i = 0; i < bcast->num_excluded; i++) {
+        if(memcmp(bcast->excluded[i], mac, sizeof(n2n_mac_t)) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
 /** Try and broadcast a message to all edges in the community.
  *
  *    This will send the exact same datagram to zero or more edges registered to
- *    the supernode.
+ *    the supernode. Multicast data (dstMac, NULL for control messages) skips the
+ *    edges which announced their groups but not this one, a BROADCAST (bcast, else
+ *    NULL) the edges the sender reached directly already.
  */
 static int try_broadcast (n2n_sn_t * sss,
                           const struct sn_community *comm,
                           const n2n_common_t * cmn,
                           const n2n_mac_t srcMac,
+                          const n2n_mac_t dstMac,
+                          const n2n_BROADCAST_t *bcast,
                           uint8_t from_supernode,
                           const uint8_t * pktbuf,
                           size_t pktsize) {
@@ -205,11 +439,22 @@ static int try_broadcast (n2n_sn_t * sss,
     }
 
     if(comm) {
+        int prunable = dstMac && mcast_snoop_prunable(dstMac);
+
         HASH_ITER(hh, comm->edges, scan, tmp) {
             if(memcmp(srcMac, scan->mac_addr, sizeof(n2n_mac_t)) != 0) {
                 /* REVISIT: exclude if the destination socket is where the packet came from. */
                 int data_sent_len;
 
+                if(prunable && scan->mcast_snoop && !edge_in_mcast_group(scan, dstMac)) {
+                    ++(sss->stats.mcast_pruned);
+                    continue;
+                }
+                if(bcast && mac_excluded(bcast, scan->mac_addr)) {
+                    ++(sss->stats.bcast_p2p);
+                    continue;
+                }
+
                 data_sent_len = sendto_sock(sss, &(scan->sock), pktbuf, pktsize);
 
                 if(data_sent_len != pktsize) {
@@ -221,6 +466,7 @@ static int try_broadcast (n2n_sn_t * sss,
                                strerror(errno));
                 } else {
                     ++(sss->stats.broadcast);
+                    ++(sss->community_ids.stats[comm->id].broadcast);
                     traceEvent(TRACE_DEBUG, "multicast %lu to [%s] %s",
                                pktsize,
                                sock_to_cstr(sockbuf, &(scan->sock)),
@@ -244,6 +490,291 @@ int comm_init (struct sn_community *comm, char *cmn) {
 }
 
 
+static int community_ids_grow (sn_community_ids_t *ids) {
+
+    uint32_t capacity = (ids->capacity == 0) ? SN_COMMUNITY_IDS_MIN_CAPACITY : ids->capacity * 2;
+    struct sn_community **by_id;
+    sn_community_stats_t *stats;
+    uint32_t *free_ids;
+
+    by_id = (struct sn_community**)realloc(ids->by_id, capacity * sizeof(struct sn_community*));
+    if(by_id)
+        ids->by_id = by_id;
+    stats = (sn_community_stats_t*)realloc(ids->stats, capacity * sizeof(sn_community_stats_t));
+    if(stats)
+        ids->stats = stats;
+    free_ids = (uint32_t*)realloc(ids->free_ids, capacity * sizeof(uint32_t));
+    if(free_ids)
+        ids->free_ids = free_ids;
+
+    if(!by_id || !stats || !free_ids) {
+        traceEvent(TRACE_ERROR, "community_ids_grow failed to allocate %u ids", capacity);
+        return -1;
+    }
+
+    memset(ids->by_id + ids->capacity, 0, (capacity - ids->capacity) * sizeof(struct sn_community*));
+    ids->capacity = capacity;
+
+    return 0;
+}
+
+
+/** Intern the community to a dense id and add it to the list of communities, returns 0 on success. */
+int sn_community_add (n2n_sn_t *sss, struct sn_community *comm) {
+
+    sn_community_ids_t *ids = &(sss->community_ids);
+    uint32_t id;
+
+    if(ids->num_free > 0) {
+        id = ids->free_ids[--(ids->num_free)];
+    } else {
+        if(ids->next_id == 0)
+            ids->next_id = 1; /* 0 means 'none' */
+        if(ids->next_id >= ids->capacity) {
+            if(community_ids_grow(ids))
+                return -1;
+        }
+        id = ids->next_id++;
+    }
+
+    comm->id = id;
+    ids->by_id[id] = comm;
+    memset(&(ids->stats[id]), 0, sizeof(sn_community_stats_t));
+
+    HASH_ADD_STR(sss->communities, community, comm);
+    sss->snapshot_dirty = 1;
+
+    return 0;
+}
+
+
+/** Same as sn_community_add() but the community gets the given id if it is still available, e.g.
+ *    to keep the ids restored from a snapshot valid for the edges. Otherwise, a new id is handed out. */
+int sn_community_add_with_id (n2n_sn_t *sss, struct sn_community *comm, uint32_t id) {
+
+    sn_community_ids_t *ids = &(sss->community_ids);
+    uint32_t i;
+
+    if((id == 0) || (id > SN_COMMUNITY_IDS_MAX_RESTORE))
+        return sn_community_add(sss, comm);
+
+    if(ids->next_id == 0)
+        ids->next_id = 1; /* 0 means 'none' */
+    while(id >= ids->capacity) {
+        if(community_ids_grow(ids))
+            return -1;
+    }
+
+    if(ids->by_id[id] != NULL)
+        return sn_community_add(sss, comm);
+
+    if(id >= ids->next_id) {
+        /* ids skipped on the way are released to keep them in use */
+        for(i = ids->next_id; i < id; i++)
+            ids->free_ids[(ids->num_free)++] = i;
+        ids->next_id = id + 1;
+    } else {
+        for(i = 0; (i < ids->num_free) && (ids->free_ids[i] != id); i++);
+        if(i == ids->num_free)
+            return sn_community_add(sss, comm);
+        ids->free_ids[i] = ids->free_ids[--(ids->num_free)];
+    }
+
+    comm->id = id;
+    ids->by_id[id] = comm;
+    memset(&(ids->stats[id]), 0, sizeof(sn_community_stats_t));
+
+    HASH_ADD_STR(sss->communities, community, comm);
+    sss->snapshot_dirty = 1;
+
+    return 0;
+}
+
+
+/** Remove the community from the list of communities and release its id, it does not get freed. */
+void sn_community_del (n2n_sn_t *sss, struct sn_community *comm) {
+
+    sn_community_ids_t *ids = &(sss->community_ids);
+
+    HASH_DEL(sss->communities, comm);
+    sss->snapshot_dirty = 1;
+
+    if((comm->id != 0) && (comm->id < ids->capacity) && (ids->by_id[comm->id] == comm)) {
+        ids->by_id[comm->id] = NULL;
+        ids->free_ids[(ids->num_free)++] = comm->id;
+    }
+    comm->id = 0;
+}
+
+
+struct sn_community* sn_community_by_id (const n2n_sn_t *sss, uint32_t id) {
+
+    if(id >= sss->community_ids.capacity)
+        return NULL;
+
+    return sss->community_ids.by_id[id];
+}
+
+
+/* ************************************** */
+
+
+/* community homing: each community is homed on sss->community_homes supernodes of the
+ * federation (this one included), chosen by rendezvous hashing -- every supernode gets
+ * scored by hashing the community name together with the supernode's MAC and the
+ * highest scores win. all federation members come to the same result without any
+ * coordination and a supernode joining or leaving only moves the communities it ranks
+ * in. only supernodes seen recently are considered */
+static uint64_t community_home_score (const char *community, const n2n_mac_t sn_mac) {
+
+    uint8_t key[N2N_COMMUNITY_SIZE + N2N_MAC_SIZE];
+
+    memset(key, 0, N2N_COMMUNITY_SIZE);
+    strncpy((char*)key, community, N2N_COMMUNITY_SIZE);
+    memcpy(key + N2N_COMMUNITY_SIZE, sn_mac, N2N_MAC_SIZE);
+
+    return pearson_hash_64(key, sizeof(key));
+}
+
+
+/* returns this supernode's rank among the community's homes (0 = primary home) or -1
+ * if it is none of them; 'homes' (if not NULL) receives the other homes in order of
+ * their rank, 'num_homes' their number */
+static int community_home_rank (n2n_sn_t *sss, const char *community,
+                                struct peer_info **homes, int *num_homes, time_t now) {
+
+    struct peer_info *ranked[SN_COMMUNITY_HOMES_MAX]; /* NULL stands for this supernode */
+    uint64_t         score[SN_COMMUNITY_HOMES_MAX];
+    struct peer_info *sn, *tmp;
+    uint64_t         s;
+    int              num = 0, rank = -1;
+    int              i, j;
+
+    ranked[num] = NULL;
+    score[num++] = community_home_score(community, sss->mac_addr);
+
+    HASH_ITER(hh, sss->federation->edges, sn, tmp) {
+        if((now - sn->last_seen) >= (2 * LAST_SEEN_SN_ACTIVE))
+            continue; /* as for the REGISTER_SUPER_ACK payload */
+        if(memcmp(sn->mac_addr, sss->mac_addr, sizeof(n2n_mac_t)) == 0)
+            continue;
+        s = community_home_score(community, sn->mac_addr);
+        // insert into the ordered list of the best scores so far, the last one drops out if full
+        for(i = num; (i > 0) && (score[i - 1] < s); i--);
+        if(i >= sss->community_homes)
+            continue;
+        if(num < sss->community_homes)
+            num++;
+        for(j = num - 1; j > i; j--) {
+            ranked[j] = ranked[j - 1];
+            score[j] = score[j - 1];
+        }
+        ranked[i] = sn;
+        score[i] = s;
+    }
+
+    if(num_homes)
+        *num_homes = 0;
+    for(i = 0; i < num; i++) {
+        if(ranked[i] == NULL) {
+            rank = i;
+        } else if(homes) {
+            homes[(*num_homes)++] = ranked[i];
+        }
+    }
+
+    return rank;
+}
+
+
+/* ************************************** */
+
+
+/* the federation part of the REGISTER_SUPER_ACK payload is kept ready to be copied: an array of
+ * the active federated supernodes. it gets rebuilt when the number of federation members
+ * changes, when one of the listed supernodes is due to turn inactive and at least every
+ * SN_ACK_PAYLOAD_REFRESH_INTERVAL seconds to catch up with supernodes turning active again
+ * or changing their socket */
+static void refresh_ack_payload (n2n_sn_t *sss, time_t now) {
+
+    sn_ack_payload_t *cache = &(sss->ack_payload);
+    n2n_REGISTER_SUPER_ACK_payload_t *entries;
+    struct peer_info *peer, *tmp;
+    uint32_t num_members = HASH_COUNT(sss->federation->edges);
+    time_t inactive_at;
+
+    if((num_members == cache->num_members) && (now < cache->refresh_at))
+        return;
+
+    if(num_members > cache->capacity) {
+        entries = (n2n_REGISTER_SUPER_ACK_payload_t*)realloc(cache->entries, num_members * sizeof(n2n_REGISTER_SUPER_ACK_payload_t));
+        if(!entries) {
+            traceEvent(TRACE_ERROR, "refresh_ack_payload failed to allocate %u entries", num_members);
+            cache->num = 0;
+            return;
+        }
+        cache->entries = entries;
+        cache->capacity = num_members;
+    }
+
+    cache->num = 0;
+    cache->num_members = num_members;
+    cache->refresh_at = now + SN_ACK_PAYLOAD_REFRESH_INTERVAL;
+
+    HASH_ITER(hh, sss->federation->edges, peer, tmp) {
+        /* skip long-time-not-seen supernodes. We need to allow for a little extra time because
+         * supernodes sometimes exceed their SN_ACTIVE time before they get re-registred to. */
+        inactive_at = peer->last_seen + 2 * LAST_SEEN_SN_ACTIVE;
+        if(now >= inactive_at)
+            continue;
+        if(inactive_at < cache->refresh_at)
+            cache->refresh_at = inactive_at;
+
+        memcpy(&(cache->entries[cache->num].sock), &(peer->sock), sizeof(n2n_sock_t));
+        memcpy(&(cache->entries[cache->num].mac), &(peer->mac_addr), sizeof(n2n_mac_t));
+        cache->num++;
+    }
+}
+
+
+/* copies up to max_num active federated supernodes to the REGISTER_SUPER_ACK payload, starting
+ * from a random one so all of them get a chance to be propagated. the supernode the ACK goes to
+ * (if it is one) and the already listed community homes are left out. returns the number of
+ * entries copied */
+static int copy_ack_payload (n2n_sn_t *sss, n2n_REGISTER_SUPER_ACK_payload_t *payload, int max_num,
+                             const n2n_sock_t *dst, struct peer_info **homes, int num_homes, time_t now) {
+
+    sn_ack_payload_t *cache = &(sss->ack_payload);
+    uint32_t start, first, window;
+    int i, h, num = 0;
+
+    refresh_ack_payload(sss, now);
+
+    if((cache->num == 0) || (max_num <= 0))
+        return 0;
+
+    window = ((uint32_t)max_num < cache->num) ? (uint32_t)max_num : cache->num;
+    start = n2n_rand() % cache->num;
+    first = ((cache->num - start) < window) ? (cache->num - start) : window;
+
+    memcpy(payload, cache->entries + start, first * sizeof(n2n_REGISTER_SUPER_ACK_payload_t));
+    memcpy(payload + first, cache->entries, (window - first) * sizeof(n2n_REGISTER_SUPER_ACK_payload_t));
+
+    for(i = 0; i < window; i++) {
+        if(memcmp(&(payload[i].sock), dst, sizeof(n2n_sock_t)) == 0)
+            continue; /* a supernode doesn't add itself to the payload */
+        for(h = 0; (h < num_homes) && memcmp(payload[i].mac, homes[h]->mac_addr, sizeof(n2n_mac_t)); h++);
+        if(h < num_homes)
+            continue; /* already listed as home */
+        if(num != i)
+            payload[num] = payload[i];
+        num++;
+    }
+
+    return num;
+}
+
+
 /** Initialise the supernode structure */
 int sn_init(n2n_sn_t *sss) {
 
@@ -303,6 +834,13 @@ int sn_init(n2n_sn_t *sss) {
     sss->mac_addr[0] &= ~0x01; /* Clear multicast bit */
     sss->mac_addr[0] |= 0x02;    /* Set locally-assigned bit */
 
+    /* Control plane admission, the tables get set up in run_sn_loop() as the rates are options */
+    sss->ctrl_rate_by_source = SN_CTRL_RATE_PER_SOURCE;
+    sss->ctrl_rate_by_community = SN_CTRL_RATE_PER_COMMUNITY;
+    sss->ctrl_rate_total = SN_CTRL_RATE_TOTAL;
+
+    timer_wheel_init(&(sss->nat_probes), time(NULL));
+
     return 0; /* OK */
 }
 
@@ -325,13 +863,22 @@ void sn_term (n2n_sn_t *sss) {
 
     HASH_ITER(hh, sss->communities, community, tmp) {
         clear_peer_list(&community->edges);
+        mac_table_free(&community->edges_index);
+        clear_peer_list(&community->remote_edges);
+        mac_table_free(&community->remote_index);
         if(NULL != community->header_encryption_ctx) {
             free(community->header_encryption_ctx);
         }
-        HASH_DEL(sss->communities, community);
+        sn_community_del(sss, community);
+        free(community->peer_list);
         free(community);
     }
 
+    free(sss->community_ids.by_id);
+    free(sss->community_ids.stats);
+    free(sss->community_ids.free_ids);
+    memset(&(sss->community_ids), 0, sizeof(sn_community_ids_t));
+
     HASH_ITER(hh, sss->rules, re, tmp_re) {
         HASH_DEL(sss->rules, re);
         if (NULL != re->rule) {
@@ -339,6 +886,20 @@ void sn_term (n2n_sn_t *sss) {
         }
         free(re);
     }
+    re_set_free(sss->rule_set);
+    sss->rule_set = NULL;
+
+    free(sss->snapshot_path);
+    sss->snapshot_path = NULL;
+
+    free(sss->ack_payload.entries);
+    memset(&(sss->ack_payload), 0, sizeof(sn_ack_payload_t));
+
+    token_bucket_table_free(&(sss->ctrl_by_source));
+    token_bucket_table_free(&(sss->ctrl_by_community));
+
+    // pending delayed PINGs are due within the maximum delay
+    timer_wheel_advance(&(sss->nat_probes), time(NULL) + N2N_NAT_PROBE_DELAY_MAX, drop_nat_probe, sss);
 
 #ifdef WIN32
     destroyWin32();
@@ -366,6 +927,32 @@ static int auth_edge (const n2n_auth_t *auth1, const n2n_auth_t *auth2) {
     return (memcmp(auth1, auth2, sizeof(n2n_auth_t)));
 }
 
+/** Check a community name against the loaded regular expressions, returns 1 if allowed.
+ *    Uses the automaton compiled from all of the rules and only falls back to trying
+ *    one rule after another if that could not be built. */
+int community_allowed_by_rules (n2n_sn_t *sss, const char *community) {
+
+    struct sn_community_regular_expression *re, *tmp_re;
+    int allowed_match;
+    int match_length;
+
+    if(sss->rule_set) {
+        return re_set_matchp(sss->rule_set, community);
+    }
+
+    HASH_ITER(hh, sss->rules, re, tmp_re) {
+        allowed_match = re_matchp(re->rule, community, &match_length);
+
+        if((allowed_match != -1)
+           && (match_length == strlen(community)) // --- only full matches allowed (remove, if also partial matches wanted)
+           && (allowed_match == 0)) { // --- only full matches allowed (remove, if also partial matches wanted)
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 /** Update the edge table with the details of the edge which contacted the
  *    supernode. */
 static int update_edge (n2n_sn_t *sss,
@@ -393,8 +980,11 @@ static int update_edge (n2n_sn_t *sss,
             if(iter->dev_addr.net_addr == reg->dev_addr.net_addr) {
                 scan = iter;
                 HASH_DEL(comm->edges, scan);
+                mac_table_remove(&(comm->edges_index), scan->mac_addr);
                 memcpy(&(scan->mac_addr), reg->edgeMac, sizeof(n2n_mac_t));
                 HASH_ADD_PEER(comm->edges, scan);
+                mac_table_add(&(comm->edges_index), scan->mac_addr, scan);
+                sss->snapshot_dirty = 1;
                 break;
             }
         }
@@ -403,17 +993,19 @@ static int update_edge (n2n_sn_t *sss,
     if(NULL == scan) {
     /* Not known */
         if(skip_add == SN_ADD) {
-            scan = (struct peer_info *) calloc(1, sizeof(struct peer_info)); /* deallocated in purge_expired_registrations */
+            scan = peer_info_alloc(); /* deallocated in purge_expired_peers */
             memcpy(&(scan->mac_addr), reg->edgeMac, sizeof(n2n_mac_t));
             scan->dev_addr.net_addr = reg->dev_addr.net_addr;
             scan->dev_addr.net_bitlen = reg->dev_addr.net_bitlen;
-            memcpy((char*)scan->dev_desc, reg->dev_desc, N2N_DESC_SIZE);
+            memcpy((char*)scan->cold->dev_desc, reg->dev_desc, N2N_DESC_SIZE);
             memcpy(&(scan->sock), sender_sock, sizeof(n2n_sock_t));
-            memcpy(&(scan->last_cookie), reg->cookie, sizeof(N2N_COOKIE_SIZE));
-            memcpy(&(scan->auth), &(reg->auth), sizeof(n2n_auth_t));
+            memcpy(&(scan->cold->last_cookie), reg->cookie, sizeof(N2N_COOKIE_SIZE));
+            memcpy(&(scan->cold->auth), &(reg->auth), sizeof(n2n_auth_t));
             scan->last_valid_time_stamp = initial_time_stamp();
 
             HASH_ADD_PEER(comm->edges, scan);
+            mac_table_add(&(comm->edges_index), scan->mac_addr, scan);
+            sss->snapshot_dirty = 1;
 
             traceEvent(TRACE_INFO, "update_edge created  %s ==> %s",
                        macaddr_str(mac_buf, reg->edgeMac),
@@ -423,9 +1015,10 @@ static int update_edge (n2n_sn_t *sss,
     } else {
         /* Known */
         if(!sock_equal(sender_sock, &(scan->sock))) {
-            if((auth = auth_edge(&(scan->auth), &(reg->auth))) == 0) {
+            if((auth = auth_edge(&(scan->cold->auth), &(reg->auth))) == 0) {
                 memcpy(&(scan->sock), sender_sock, sizeof(n2n_sock_t));
-                memcpy(&(scan->last_cookie), reg->cookie, sizeof(N2N_COOKIE_SIZE));
+                memcpy(&(scan->cold->last_cookie), reg->cookie, sizeof(N2N_COOKIE_SIZE));
+                sss->snapshot_dirty = 1;
 
                 traceEvent(TRACE_INFO, "update_edge updated  %s ==> %s",
                            macaddr_str(mac_buf, reg->edgeMac),
@@ -437,7 +1030,7 @@ static int update_edge (n2n_sn_t *sss,
                 ret = update_edge_auth_fail;
             }
         } else {
-            memcpy(&(scan->last_cookie), reg->cookie, sizeof(N2N_COOKIE_SIZE));
+            memcpy(&(scan->cold->last_cookie), reg->cookie, sizeof(N2N_COOKIE_SIZE));
 
             traceEvent(TRACE_DEBUG, "update_edge unchanged %s ==> %s",
                        macaddr_str(mac_buf, reg->edgeMac),
@@ -448,7 +1041,16 @@ static int update_edge (n2n_sn_t *sss,
     }
 
     if(scan != NULL) {
+        if(ret != update_edge_auth_fail) {
+            scan->compact_packets = (reg->features & N2N_FEATURE_COMPACT_PACKET)
+                                    && (comm->header_encryption == HEADER_ENCRYPTION_NONE)
+                                    && (comm->is_federation == IS_NO_FEDERATION);
+            // expiry follows the announced keepalive interval, as far as it could have been probed
+            scan->timeout = (reg->features & N2N_FEATURE_KEEPALIVE) ? min(reg->keepalive, N2N_NAT_PROBE_DELAY_MAX) : 0;
+            update_edge_mcast_groups(scan, reg);
+        }
         scan->last_seen = now;
+        arm_peer_expiry(&(comm->edges_expiry), scan, now);
     }
 
     return ret;
@@ -704,10 +1306,11 @@ static int re_register_and_purge_supernodes (n2n_sn_t *sss, struct sn_community
 
                 /* sent = */ sendto_sock(sss, &(peer->sock), pktbuf, idx);
             }
-            if(time >= LAST_SEEN_SN_INACTIVE) {
-                purge_expired_registrations(&(comm->edges), &time, LAST_SEEN_SN_INACTIVE); /* purge not-seen-long-time supernodes*/
-            }
         }
+
+        /* purge not-seen-long-time supernodes */
+        if(purge_expired_peers(&(comm->edges_expiry), &(comm->edges_index), &(comm->edges), now) > 0)
+            sss->snapshot_dirty = 1;
     }
 
     (*p_last_re_reg_and_purge) = now;
@@ -729,19 +1332,27 @@ static int purge_expired_communities (n2n_sn_t *sss,
     traceEvent(TRACE_DEBUG, "Purging old communities and edges");
 
     HASH_ITER(hh, sss->communities, comm, tmp) {
-        num_reg += purge_peer_list(&comm->edges, now - REGISTRATION_TIMEOUT);
+        num_reg += purge_expired_peers(&comm->edges_expiry, &comm->edges_index, &comm->edges, now);
+        purge_expired_peers(&comm->remote_expiry, &comm->remote_index, &comm->remote_edges, now);
         if((comm->edges == NULL) && (comm->purgeable == COMMUNITY_PURGEABLE)) {
             traceEvent(TRACE_INFO, "Purging idle community %s", comm->community);
             if(NULL != comm->header_encryption_ctx) {
                 /* this should not happen as 'purgeable' and thus only communities w/o encrypted header here */
                 free(comm->header_encryption_ctx);
             }
-            HASH_DEL(sss->communities, comm);
+            sn_community_del(sss, comm);
+            mac_table_free(&comm->edges_index);
+            clear_peer_list(&comm->remote_edges);
+            mac_table_free(&comm->remote_index);
+            free(comm->peer_list);
             free(comm);
         }
     }
     (*p_last_purge) = now;
 
+    if(num_reg > 0)
+        sss->snapshot_dirty = 1;
+
     traceEvent(TRACE_DEBUG, "Remove %ld edges", num_reg);
 
     return 0;
@@ -781,6 +1392,24 @@ static int sort_communities (n2n_sn_t *sss,
 }
 
 
+static int write_snapshot (n2n_sn_t *sss,
+                           time_t* p_last_snapshot,
+                           time_t now) {
+
+    /* changes get written out soon, the edges' last seen times now and then only */
+    if((now - (*p_last_snapshot)) < (sss->snapshot_dirty ? SN_SNAPSHOT_INTERVAL : SN_SNAPSHOT_REFRESH_INTERVAL)) {
+        return 0;
+    }
+
+    sn_snapshot_write(sss, now);
+
+    sss->snapshot_dirty = 0;
+    (*p_last_snapshot) = now;
+
+    return 0;
+}
+
+
 static int process_mgmt (n2n_sn_t *sss,
                          const struct sockaddr_in *sender_sock,
                          const uint8_t *mgmt_buf,
@@ -796,6 +1425,7 @@ static int process_mgmt (n2n_sn_t *sss,
     macstr_t mac_buf;
     n2n_sock_str_t sockbuf;
     dec_ip_bit_str_t ip_bit_str = {'\0'};
+    peer_pool_stats_t pool_stats;
 
     traceEvent(TRACE_DEBUG, "process_mgmt");
 
@@ -806,7 +1436,11 @@ static int process_mgmt (n2n_sn_t *sss,
     HASH_ITER(hh, sss->communities, community, tmp) {
         num_edges += HASH_COUNT(community->edges);
         ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
-                            "community: %s\n", community->community);
+                            "community: %s [id %u | fwd %u | broadcast %u | reg_sup %u]\n",
+                            community->community, community->id,
+                            (unsigned int) sss->community_ids.stats[community->id].fwd,
+                            (unsigned int) sss->community_ids.stats[community->id].broadcast,
+                            (unsigned int) sss->community_ids.stats[community->id].reg_super);
         sendto_mgmt(sss, sender_sock, (const uint8_t *) resbuf, ressize);
         ressize = 0;
 
@@ -817,7 +1451,7 @@ static int process_mgmt (n2n_sn_t *sss,
                                 ++num, ip_subnet_to_str(ip_bit_str, &peer->dev_addr),
                                 macaddr_str(mac_buf, peer->mac_addr),
                                 sock_to_cstr(sockbuf, &(peer->sock)),
-                                peer->dev_desc,
+                                peer->cold->dev_desc,
                                 now - peer->last_seen);
 
             sendto_mgmt(sss, sender_sock, (const uint8_t *) resbuf, ressize);
@@ -847,24 +1481,48 @@ static int process_mgmt (n2n_sn_t *sss,
                         (unsigned int) sss->stats.errors);
 
     ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
-                        "fwd %u | ",
-                        (unsigned int) sss->stats.fwd);
+                        "fwd %u (%u cut-through) | ",
+                        (unsigned int) sss->stats.fwd,
+                        (unsigned int) sss->stats.cut_through);
 
     ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
-                        "broadcast %u | ",
-                        (unsigned int) sss->stats.broadcast);
+                        "broadcast %u (%u mcast pruned, %u sent p2p) | ",
+                        (unsigned int) sss->stats.broadcast,
+                        (unsigned int) sss->stats.mcast_pruned,
+                        (unsigned int) sss->stats.bcast_p2p);
 
     ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
                         "cur_cmnts %u\n", HASH_COUNT(sss->communities));
 
+    ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
+                        "fed_uni %u | fed_bcast %u | fed_absent %u | ctrl_dropped %u | nat_probes %u\n",
+                        (unsigned int) sss->stats.fed_unicast,
+                        (unsigned int) sss->stats.fed_broadcast,
+                        (unsigned int) sss->stats.fed_absent,
+                        (unsigned int) sss->stats.ctrl_dropped,
+                        (unsigned int) sss->stats.nat_probes);
+
     ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
                         "last_fwd  %lu sec ago | ",
                         (long unsigned int) (now - sss->stats.last_fwd));
 
     ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
-                        "last reg  %lu sec ago\n\n",
+                        "last reg  %lu sec ago\n",
                         (long unsigned int) (now - sss->stats.last_reg_super));
 
+    peer_pool_get_stats(&pool_stats);
+    ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
+                        "mem/edge  %u B (%u hot + %u cold) | ",
+                        (unsigned int) (sizeof(struct peer_info) + sizeof(struct peer_info_cold)),
+                        (unsigned int) sizeof(struct peer_info),
+                        (unsigned int) sizeof(struct peer_info_cold));
+
+    ressize += snprintf(resbuf + ressize, N2N_SN_PKTBUF_SIZE - ressize,
+                        "peer_pool %u/%u, %u KB\n\n",
+                        (unsigned int) pool_stats.in_use,
+                        (unsigned int) pool_stats.capacity,
+                        (unsigned int) (pool_stats.bytes / 1024));
+
     sendto_mgmt(sss, sender_sock, (const uint8_t *) resbuf, ressize);
 
     return 0;
@@ -888,8 +1546,497 @@ static int sendto_mgmt (n2n_sn_t *sss,
     return 0;
 }
 
+/** Check if a datagram is a compact PACKET and return its community if so. Compact
+ *  PACKETs only get accepted from edges which negotiated them, sending from their
+ *  registered socket. Anything else could also be an encrypted header starting with
+ *  N2N_PKT_VERSION_COMPACT by chance and is left to the regular checks. */
+static struct sn_community* find_compact_community (n2n_sn_t *sss,
+                                                    const struct sockaddr_in *sender_sock,
+                                                    const uint8_t *udp_buf,
+                                                    size_t udp_size) {
+
+    n2n_common_t        cmn;
+    uint32_t            community_id = 0;
+    n2n_mac_t           srcMac;
+    n2n_sock_t          sender;
+    size_t              rem = udp_size;
+    size_t              idx = 0;
+    struct sn_community *comm;
+    struct peer_info    *edge;
+
+    if(decode_common_compact(&cmn, &community_id, udp_buf, &rem, &idx) < 0)
+        return NULL;
+
+    if((cmn.pc != MSG_TYPE_PACKET) || (cmn.flags & N2N_FLAGS_FROM_SUPERNODE))
+        return NULL;
+
+    comm = sn_community_by_id(sss, community_id);
+    if(!comm || (comm->header_encryption != HEADER_ENCRYPTION_NONE))
+        return NULL;
+
+    if(decode_mac(srcMac, udp_buf, &rem, &idx) != N2N_MAC_SIZE)
+        return NULL;
+
+    edge = mac_table_find(&(comm->edges_index), srcMac);
+    if(!edge || !edge->compact_packets)
+        return NULL;
+
+    memset(&sender, 0, sizeof(n2n_sock_t));
+    sender.family = AF_INET;
+    sender.port = ntohs(sender_sock->sin_port);
+    memcpy(sender.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
+    if(!sock_equal(&sender, &(edge->sock)))
+        return NULL;
+
+    return comm;
+}
+
+
+/* cut-through forwarding of unicast PACKETs in communities without header encryption
+ *
+ * the regular path of process_udp() decodes the whole header, re-encodes it into a
+ * separate buffer and copies the payload behind it. here, only what is needed to route
+ * by destination MAC gets read and the patched header is placed right in front of the
+ * untouched payload, making use of the receive buffer's headroom. anything off the
+ * common case (encrypted headers, broadcasts, unknown destinations, federation, ...)
+ * is left to the regular path
+ *
+ * returns 1 if the packet has been forwarded, 0 if it needs regular processing */
+static int forward_cut_through (n2n_sn_t *sss,
+                                const struct sockaddr_in *sender_sock,
+                                uint8_t *udp_buf,
+                                size_t udp_size,
+                                time_t now) {
+
+    n2n_common_t        cmn;
+    n2n_PACKET_t        pkt;
+    struct sn_community *comm;
+    struct peer_info    *dst;
+    uint32_t            community_id;
+    uint8_t             hdr[N2N_SN_PKTBUF_HEADROOM * 2];
+    size_t              hdr_len = 0;
+    size_t              rem = udp_size;
+    size_t              idx = 0;
+    uint8_t             *out;
+    size_t              out_len;
+    ssize_t             sent;
+    n2n_sock_t          sn_sock;
+
+    if(udp_buf[0] == N2N_PKT_VERSION_COMPACT) {
+        // also verifies the sender
+        comm = find_compact_community(sss, sender_sock, udp_buf, udp_size);
+        if(!comm)
+            return 0;
+        decode_common_compact(&cmn, &community_id, udp_buf, &rem, &idx);
+        memcpy(cmn.community, comm->community, N2N_COMMUNITY_SIZE);
+    } else {
+        // see process_udp() for the layout assumptions
+        if((udp_size < 20) || (udp_buf[0] != N2N_PKT_VERSION) || (udp_buf[19] != 0)
+           || ((be16toh(*(uint16_t*)&(udp_buf[2])) & N2N_FLAGS_TYPE_MASK) != MSG_TYPE_PACKET))
+            return 0;
+        HASH_FIND_COMMUNITY(sss->communities, (char *)&udp_buf[4], comm);
+        if(!comm || (comm->header_encryption != HEADER_ENCRYPTION_NONE) || (comm->is_federation == IS_FEDERATION))
+            return 0;
+        decode_common(&cmn, udp_buf, &rem, &idx);
+    }
+
+    if((cmn.pc != MSG_TYPE_PACKET) || (cmn.ttl < 1)
+       || ((cmn.flags & (N2N_FLAGS_SOCKET | N2N_FLAGS_FROM_SUPERNODE)) == N2N_FLAGS_SOCKET)
+       || (rem < 2 * N2N_MAC_SIZE + 2))
+        return 0;
+
+    decode_PACKET_fast(&pkt, &cmn, udp_buf, &rem, &idx);
+
+    if(is_multi_broadcast(pkt.dstMac))
+        return 0;
+
+    dst = mac_table_find(&(comm->edges_index), pkt.dstMac);
+    if(!dst || (dst->sock.family != AF_INET))
+        return 0;
+
+    if(cmn.flags & N2N_FLAGS_FROM_SUPERNODE) {
+        // already carries the socket, pass on unmodified; the sender is an edge of the
+        // forwarding supernode
+        memset(&sn_sock, 0, sizeof(n2n_sock_t));
+        sn_sock.family = AF_INET;
+        sn_sock.port = ntohs(sender_sock->sin_port);
+        memcpy(sn_sock.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
+        learn_remote_edge(sss, comm, pkt.srcMac, &sn_sock, now);
+        out = udp_buf;
+        out_len = udp_size;
+    } else {
+        --(cmn.ttl);
+        cmn.flags |= N2N_FLAGS_SOCKET | N2N_FLAGS_FROM_SUPERNODE;
+        pkt.sock.family = AF_INET;
+        pkt.sock.port = ntohs(sender_sock->sin_port);
+        memcpy(pkt.sock.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
+
+        if(dst->compact_packets) {
+            encode_PACKET_compact(hdr, &hdr_len, &cmn, comm->id, &pkt);
+        } else {
+            encode_PACKET_fast(hdr, &hdr_len, &cmn, &pkt);
+        }
+
+        // grows by the socket and, if changing to the regular common part, by the community
+        // name: never more than the headroom
+        out = udp_buf + idx - hdr_len;
+        memcpy(out, hdr, hdr_len);
+        out_len = hdr_len + (udp_size - idx);
+    }
+
+    sss->stats.last_fwd = now;
+    sent = sendto_sock(sss, &(dst->sock), out, out_len);
+    if(sent == out_len) {
+        ++(sss->stats.fwd);
+        ++(sss->stats.cut_through);
+        ++(sss->community_ids.stats[comm->id].fwd);
+    } else {
+        ++(sss->stats.errors);
+        traceEvent(TRACE_ERROR, "forward_cut_through %lu bytes FAILED (%d: %s)",
+                   out_len, errno, strerror(errno));
+    }
+
+    return 1;
+}
+
+
+/** Have a PING answered once more after 'delay' seconds so the edge learns whether its
+ *  NAT binding survives that long. Only edges registered here get served.
+ *
+ *  @return 0 if the probe got scheduled, -1 otherwise
+ */
+static int schedule_nat_probe (n2n_sn_t *sss,
+                               const struct sn_community *comm,
+                               const struct sockaddr_in *sender_sock,
+                               const n2n_mac_t mac,
+                               uint16_t delay,
+                               time_t now) {
+
+    sn_nat_probe_t *probe;
+
+    if((delay > N2N_NAT_PROBE_DELAY_MAX) || (sss->num_nat_probes >= SN_NAT_PROBES_MAX))
+        return -1;
+
+    if(comm->is_federation == IS_FEDERATION)
+        return -1;
+
+    if(!mac_table_find(&(comm->edges_index), mac))
+        return -1;
+
+    probe = (sn_nat_probe_t*)calloc(1, sizeof(sn_nat_probe_t));
+    if(!probe)
+        return -1;
+
+    probe->dst = *sender_sock;
+    memcpy(probe->community, comm->community, sizeof(n2n_community_t));
+    memcpy(probe->mac, mac, sizeof(n2n_mac_t));
+    timer_wheel_arm(&(sss->nat_probes), &(probe->timer), now + delay);
+    ++(sss->num_nat_probes);
+
+    return 0;
+}
+
+
+/* timer wheel callback, answers a delayed PING */
+static void send_nat_probe (n2n_timer_t *timer, void *data) {
+
+    n2n_sn_t *sss = (n2n_sn_t*)data;
+    sn_nat_probe_t *probe = TIMER_CONTAINER(timer, sn_nat_probe_t, timer);
+    struct sn_community *comm;
+    uint8_t encbuf[N2N_SN_PKTBUF_SIZE];
+    size_t encx = 0;
+    n2n_common_t cmn;
+    n2n_PEER_INFO_t pi;
+    macstr_t mac_buf;
+
+    HASH_FIND_COMMUNITY(sss->communities, (char *)probe->community, comm);
+    if(comm) {
+        memset(&cmn, 0, sizeof(cmn));
+        cmn.ttl = N2N_DEFAULT_TTL;
+        cmn.pc = n2n_peer_info;
+        cmn.flags = N2N_FLAGS_FROM_SUPERNODE;
+        memcpy(cmn.community, comm->community, sizeof(n2n_community_t));
+
+        memset(&pi, 0, sizeof(pi));
+        pi.aflags = N2N_AFLAGS_NAT_PROBE;
+        memcpy(pi.srcMac, sss->mac_addr, sizeof(n2n_mac_t));
+        pi.sock.family = AF_INET;
+        pi.sock.port = ntohs(probe->dst.sin_port);
+        memcpy(pi.sock.addr.v4, &(probe->dst.sin_addr.s_addr), IPV4_SIZE);
+        pi.data = sn_selection_criterion_gather_data(sss);
+
+        encode_PEER_INFO(encbuf, &encx, &cmn, &pi);
+
+        if(comm->header_encryption == HEADER_ENCRYPTION_ENABLED) {
+            packet_header_encrypt(encbuf, encx, encx, comm->header_encryption_ctx,
+                                  comm->header_iv_ctx,
+                                  time_stamp());
+        }
+
+        sendto(sss->sock, encbuf, encx, 0,
+               (struct sockaddr *)&(probe->dst), sizeof(struct sockaddr_in));
+        ++(sss->stats.nat_probes);
+
+        traceEvent(TRACE_DEBUG, "Tx delayed PONG to %s",
+                   macaddr_str(mac_buf, probe->mac));
+    }
+
+    --(sss->num_nat_probes);
+    free(probe);
+}
+
+
+/* timer wheel callback, discards a delayed PING on shutdown */
+static void drop_nat_probe (n2n_timer_t *timer, void *data) {
+
+    n2n_sn_t *sss = (n2n_sn_t*)data;
+
+    --(sss->num_nat_probes);
+    free(TIMER_CONTAINER(timer, sn_nat_probe_t, timer));
+}
+
+
+/** Returns the edge registered with the given MAC address if it is the sender, NULL otherwise. */
+static struct peer_info* edge_at_sender (struct sn_community *comm,
+                                         const n2n_mac_t mac,
+                                         const struct sockaddr_in *sender_sock) {
+
+    struct peer_info *scan;
+    n2n_sock_t sender;
+
+    sender.family = AF_INET;
+    sender.port = ntohs(sender_sock->sin_port);
+    memcpy(sender.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
+
+    scan = mac_table_find(&(comm->edges_index), mac);
+    if(!scan || !sock_equal(&(scan->sock), &sender)) {
+        return NULL;
+    }
+
+    return scan;
+}
+
+
+/** Answer a QUERY_PEER for one of its target MACs: with a PEER_INFO if the edge is registered
+ *  here, else by forwarding the query to the federation.
+ */
+static void answer_query_peer (n2n_sn_t *sss,
+                               struct sn_community *comm,
+                               const n2n_common_t *cmn,
+                               const n2n_QUERY_PEER_t *query,
+                               const n2n_mac_t target,
+                               const struct sockaddr_in *sender_sock,
+                               uint8_t from_supernode) {
+
+    uint8_t encbuf[N2N_SN_PKTBUF_SIZE];
+    size_t encx = 0;
+    n2n_common_t cmn2;
+    n2n_PEER_INFO_t pi;
+    n2n_QUERY_PEER_t fwd;
+    struct peer_info *scan;
+    macstr_t mac_buf;
+    macstr_t mac_buf2;
+
+    traceEvent(TRACE_DEBUG, "Rx QUERY_PEER from %s for %s",
+               macaddr_str(mac_buf, query->srcMac),
+               macaddr_str(mac_buf2, target));
+
+    scan = mac_table_find(&(comm->edges_index), target);
+    if(scan) {
+        memset(&cmn2, 0, sizeof(cmn2));
+        cmn2.ttl = N2N_DEFAULT_TTL;
+        cmn2.pc = n2n_peer_info;
+        cmn2.flags = N2N_FLAGS_FROM_SUPERNODE;
+        memcpy(cmn2.community, cmn->community, sizeof(n2n_community_t));
+
+        memset(&pi, 0, sizeof(pi));
+        pi.aflags = 0;
+        memcpy(pi.mac, target, sizeof(n2n_mac_t));
+        pi.sock = scan->sock;
+
+        encode_PEER_INFO(encbuf, &encx, &cmn2, &pi);
+
+        if(comm->header_encryption == HEADER_ENCRYPTION_ENABLED) {
+            packet_header_encrypt(encbuf, encx, encx, comm->header_encryption_ctx,
+                                  comm->header_iv_ctx,
+                                  time_stamp());
+        }
+
+        /* only supernodes get to have the answer directed elsewhere */
+        if(from_supernode && (cmn->flags & N2N_FLAGS_SOCKET)) {
+            sendto_sock(sss, &(query->sock), encbuf, encx);
+        } else {
+            sendto(sss->sock, encbuf, encx, 0,
+                   (struct sockaddr *)sender_sock, sizeof(struct sockaddr_in));
+        }
+        traceEvent(TRACE_DEBUG, "Tx PEER_INFO to %s",
+                   macaddr_str(mac_buf, query->srcMac));
+
+    } else {
+
+        if(from_supernode) {
+            traceEvent(TRACE_DEBUG, "QUERY_PEER on unknown edge from supernode %s. Dropping the packet.",
+                       macaddr_str(mac_buf, query->srcMac));
+        } else {
+            traceEvent(TRACE_DEBUG, "QUERY_PEER from unknown edge %s. Forwarding to all other supernodes.",
+                       macaddr_str(mac_buf, query->srcMac));
+
+            memcpy(&cmn2, cmn, sizeof(n2n_common_t));
+
+            /* We are going to add socket even if it was not there before */
+            cmn2.flags |= N2N_FLAGS_SOCKET | N2N_FLAGS_FROM_SUPERNODE;
+
+            /* forwarded for this target only, other supernodes might not take batches */
+            memset(&fwd, 0, sizeof(fwd));
+            memcpy(fwd.srcMac, query->srcMac, sizeof(n2n_mac_t));
+            memcpy(fwd.targetMac, target, sizeof(n2n_mac_t));
+            fwd.sock.family = AF_INET;
+            fwd.sock.port = ntohs(sender_sock->sin_port);
+            memcpy(fwd.sock.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
+
+            encode_QUERY_PEER(encbuf, &encx, &cmn2, &fwd);
+
+            if(comm->header_encryption == HEADER_ENCRYPTION_ENABLED) {
+                packet_header_encrypt(encbuf, encx, encx, comm->header_encryption_ctx,
+                                      comm->header_iv_ctx,
+                                      time_stamp());
+            }
+
+            try_broadcast(sss, NULL, cmn, query->srcMac, NULL, NULL, from_supernode, encbuf, encx);
+        }
+    }
+}
+
+
+/** Return the community's edges ranked by last seen time, most recent first. The ranking
+ *  gets rebuilt at most every SN_PEER_LIST_REFRESH_INTERVAL seconds, so the community does not
+ *  get walked and sorted for each and every peer list request. NULL if out of memory.
+ */
+static sn_peer_list_t* refresh_peer_list (struct sn_community *comm, time_t now) {
+
+    sn_peer_list_t *list = comm->peer_list;
+    struct peer_info *scan, *tmp;
+    struct peer_info *recent[N2N_PEER_LIST_MAX + 1];
+    uint32_t num_recent = 0, i, j;
+
+    if(list && (now < list->refresh_at)) {
+        return list;
+    }
+
+    if(!list) {
+        list = (sn_peer_list_t*)calloc(1, sizeof(sn_peer_list_t));
+        if(!list) {
+            traceEvent(TRACE_ERROR, "refresh_peer_list failed to allocate the peer list");
+            return NULL;
+        }
+        comm->peer_list = list;
+    }
+
+    // keep the most recently seen ones, sorted, by insertion
+    HASH_ITER(hh, comm->edges, scan, tmp) {
+        if((num_recent == N2N_PEER_LIST_MAX + 1) && (scan->last_seen <= recent[num_recent - 1]->last_seen)) {
+            continue;
+        }
+        j = (num_recent < N2N_PEER_LIST_MAX + 1) ? num_recent++ : num_recent - 1;
+        for(; (j > 0) && (recent[j - 1]->last_seen < scan->last_seen); j--) {
+            recent[j] = recent[j - 1];
+        }
+        recent[j] = scan;
+    }
+
+    for(i = 0; i < num_recent; i++) {
+        memcpy(list->macs[i], recent[i]->mac_addr, sizeof(n2n_mac_t));
+        list->socks[i] = recent[i]->sock;
+    }
+    list->num = num_recent;
+    list->refresh_at = now + SN_PEER_LIST_REFRESH_INTERVAL;
+
+    return list;
+}
+
+
+/** Answer a peer list request, a QUERY_PEER for the broadcast MAC, with the requested page of the
+ *  community's most recently active edges. Only edges asking from the socket they are registered
+ *  with get an answer which thus cannot be directed at someone else.
+ */
+static void answer_peer_list (n2n_sn_t *sss,
+                              struct sn_community *comm,
+                              const n2n_common_t *cmn,
+                              const n2n_QUERY_PEER_t *query,
+                              const struct sockaddr_in *sender_sock,
+                              time_t now) {
+
+    uint8_t encbuf[N2N_SN_PKTBUF_SIZE];
+    size_t encx = 0;
+    n2n_common_t cmn2;
+    n2n_PEER_INFO_t pi;
+    struct peer_info *self;
+    sn_peer_list_t *list;
+    unsigned int num_offered = 0, first, i;
+    macstr_t mac_buf;
+
+    self = edge_at_sender(comm, query->srcMac, sender_sock);
+    if(!self) {
+        traceEvent(TRACE_DEBUG, "Peer list request from unregistered %s dropped",
+                   macaddr_str(mac_buf, query->srcMac));
+        return;
+    }
+
+    list = refresh_peer_list(comm, now);
+    if(!list) {
+        return;
+    }
+
+    memset(&cmn2, 0, sizeof(cmn2));
+    cmn2.ttl = N2N_DEFAULT_TTL;
+    cmn2.pc = n2n_peer_info;
+    cmn2.flags = N2N_FLAGS_FROM_SUPERNODE;
+    memcpy(cmn2.community, cmn->community, sizeof(n2n_community_t));
+
+    memset(&pi, 0, sizeof(pi));
+    pi.aflags = N2N_AFLAGS_PEER_LIST;
+    memcpy(pi.srcMac, sss->mac_addr, sizeof(n2n_mac_t));
+    memcpy(pi.mac, broadcast_mac, sizeof(n2n_mac_t));
+    pi.sock = self->sock;
+    pi.page = query->page;
+    first = (unsigned int)query->page * N2N_PEER_LIST_PAGE;
+    for(i = 0; (i < list->num) && (num_offered < N2N_PEER_LIST_MAX); i++) {
+        if(!memcmp(list->macs[i], query->srcMac, sizeof(n2n_mac_t))) {
+            continue;
+        }
+        if(num_offered >= first) {
+            if(pi.num_peers == N2N_PEER_LIST_PAGE) {
+                pi.aflags |= N2N_AFLAGS_PEER_LIST_MORE;
+                break;
+            }
+            memcpy(pi.peer_macs[pi.num_peers], list->macs[i], sizeof(n2n_mac_t));
+            pi.peer_socks[pi.num_peers] = list->socks[i];
+            pi.num_peers++;
+        }
+        num_offered++;
+    }
+
+    encode_PEER_INFO(encbuf, &encx, &cmn2, &pi);
+
+    if(comm->header_encryption == HEADER_ENCRYPTION_ENABLED) {
+        packet_header_encrypt(encbuf, encx, encx, comm->header_encryption_ctx,
+                              comm->header_iv_ctx,
+                              time_stamp());
+    }
+
+    sendto(sss->sock, encbuf, encx, 0,
+           (struct sockaddr *)sender_sock, sizeof(struct sockaddr_in));
+
+    traceEvent(TRACE_DEBUG, "Tx PEER_INFO page %u with %u of %u peers to %s",
+               pi.page, pi.num_peers, list->num,
+               macaddr_str(mac_buf, query->srcMac));
+}
+
+
 /** Examine a datagram and determine what to do with it.
  *
+ *  udp_buf needs to be preceded by N2N_SN_PKTBUF_HEADROOM writable bytes, so forwarded
+ *  PACKETs can get their header grown in place.
  */
 static int process_udp (n2n_sn_t * sss,
                         const struct sockaddr_in * sender_sock,
@@ -906,22 +2053,36 @@ static int process_udp (n2n_sn_t * sss,
     macstr_t            mac_buf2;
     n2n_sock_str_t      sockbuf;
     char                buf[32];
-    struct sn_community *comm, *tmp;
+    struct sn_community *comm = NULL, *tmp;
     uint64_t            stamp;
+    uint32_t            community_id;
+    uint8_t             compact = 0;
     const n2n_mac_t     null_mac = {0, 0, 0, 0, 0, 0}; /* 00:00:00:00:00:00 */
 
+    if(forward_cut_through(sss, sender_sock, udp_buf, udp_size, now)) {
+        return 0;
+    }
+
     traceEvent(TRACE_DEBUG, "Processing incoming UDP packet [len: %lu][sender: %s:%u]",
                udp_size, intoa(ntohl(sender_sock->sin_addr.s_addr), buf, sizeof(buf)),
                ntohs(sender_sock->sin_port));
 
+    /* compact PACKETs only exist for communities without header encryption, their
+     * community is found by id */
+    if((udp_size > 0) && (udp_buf[00] == N2N_PKT_VERSION_COMPACT)) {
+        comm = find_compact_community(sss, sender_sock, udp_buf, udp_size);
+        compact = (comm != NULL);
+    }
+
     /* check if header is unencrypted. the following check is around 99.99962 percent reliable.
      * it heavily relies on the structure of packet's common part
      * changes to wire.c:encode/decode_common need to go together with this code */
-    if(udp_size < 20) {
+    if(compact) {
+        /* already identified by find_compact_community() */
+    } else if(udp_size < 20) {
         traceEvent(TRACE_DEBUG, "process_udp dropped a packet too short to be valid.");
         return -1;
-    }
-    if((udp_buf[19] == (uint8_t)0x00) // null terminated community name
+    } else if((udp_buf[19] == (uint8_t)0x00) // null terminated community name
        && (udp_buf[00] == N2N_PKT_VERSION) // correct packet version
        && ((be16toh(*(uint16_t*)&(udp_buf[02])) & N2N_FLAGS_TYPE_MASK) <= MSG_TYPE_MAX_TYPE) // message type
        && ( be16toh(*(uint16_t*)&(udp_buf[02])) < N2N_FLAGS_OPTIONS) // flags
@@ -994,7 +2155,10 @@ static int process_udp (n2n_sn_t * sss,
 
     rem = udp_size; /* Counts down bytes of packet to protect against buffer overruns. */
     idx = 0; /* marches through packet header as parts are decoded. */
-    if(decode_common(&cmn, udp_buf, &rem, &idx) < 0) {
+    if(compact) {
+        decode_common_compact(&cmn, &community_id, udp_buf, &rem, &idx);
+        memcpy(cmn.community, comm->community, N2N_COMMUNITY_SIZE);
+    } else if(decode_common(&cmn, udp_buf, &rem, &idx) < 0) {
         traceEvent(TRACE_ERROR, "Failed to decode common section");
         return -1; /* failed to decode packet */
     }
@@ -1009,18 +2173,33 @@ static int process_udp (n2n_sn_t * sss,
 
     --(cmn.ttl); /* The value copied into all forwarded packets. */
 
+    if(((msg_type == MSG_TYPE_REGISTER_SUPER) || (msg_type == MSG_TYPE_UNREGISTER_SUPER)
+        || (msg_type == MSG_TYPE_QUERY_PEER) || (msg_type == MSG_TYPE_REGISTER))
+       && !admit_control_msg(sss, sender_sock, &cmn, comm, from_supernode, now)) {
+        traceEvent(TRACE_DEBUG, "process_udp dropped %s from %s:%u exceeding the control plane rate",
+                   msg_type2str(msg_type), intoa(ntohl(sender_sock->sin_addr.s_addr), buf, sizeof(buf)),
+                   ntohs(sender_sock->sin_port));
+        ++(sss->stats.ctrl_dropped);
+        return -1;
+    }
+
     switch(msg_type) {
+        case MSG_TYPE_BROADCAST:
         case MSG_TYPE_PACKET: {
-            /* PACKET from one edge to another edge via supernode. */
+            /* PACKET from one edge to another edge via supernode. A BROADCAST is a broadcast
+             * PACKET the edge sent to some peers directly, it goes on as PACKET to the others. */
 
             /* pkt will be modified in place and recoded to an output of potentially
              * different size due to addition of the socket.*/
             n2n_PACKET_t  pkt;
+            n2n_BROADCAST_t bcast;
             n2n_common_t  cmn2;
-            uint8_t       encbuf[N2N_SN_PKTBUF_SIZE];
+            uint8_t       encbuf[N2N_SN_PKTBUF_HEADROOM * 2];
             size_t        encx = 0;
             int           unicast; /* non-zero if unicast */
-            uint8_t *     rec_buf; /* either udp_buf or encbuf */
+            uint8_t *     rec_buf; /* start of the (re-encoded) packet within udp_buf */
+            n2n_sock_t    sn_sock;
+            struct peer_info *dst;
 
             if(!comm) {
                 traceEvent(TRACE_DEBUG, "process_udp PACKET with unknown community %s", cmn.community);
@@ -1028,7 +2207,18 @@ static int process_udp (n2n_sn_t * sss,
             }
 
             sss->stats.last_fwd = now;
-            decode_PACKET(&pkt, &cmn, udp_buf, &rem, &idx);
+            if(msg_type == MSG_TYPE_BROADCAST) {
+                if(decode_BROADCAST(&bcast, &pkt, &cmn, udp_buf, &rem, &idx) < 0) {
+                    traceEvent(TRACE_DEBUG, "process_udp dropped malformed BROADCAST");
+                    return -1;
+                }
+                if(from_supernode || memcmp(pkt.dstMac, broadcast_mac, sizeof(n2n_mac_t))) {
+                    traceEvent(TRACE_DEBUG, "process_udp dropped BROADCAST not from an edge or not to broadcast");
+                    return -1;
+                }
+            } else {
+                decode_PACKET_fast(&pkt, &cmn, udp_buf, &rem, &idx);
+            }
 
             // already checked for valid comm
             if(comm->header_encryption == HEADER_ENCRYPTION_ENABLED) {
@@ -1051,18 +2241,29 @@ static int process_udp (n2n_sn_t * sss,
 
                 /* We are going to add socket even if it was not there before */
                 cmn2.flags |= N2N_FLAGS_SOCKET | N2N_FLAGS_FROM_SUPERNODE;
+                cmn2.pc = n2n_packet;
 
                 pkt.sock.family = AF_INET;
                 pkt.sock.port = ntohs(sender_sock->sin_port);
                 memcpy(pkt.sock.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
 
-                rec_buf = encbuf;
-                /* Re-encode the header. */
-                encode_PACKET(encbuf, &encx, &cmn2, &pkt);
+                /* Re-encode the header, the compact one if the destination negotiated it */
+                dst = NULL;
+                if(unicast && (comm->header_encryption == HEADER_ENCRYPTION_NONE)) {
+                    dst = mac_table_find(&(comm->edges_index), pkt.dstMac);
+                }
+                if(dst && dst->compact_packets) {
+                    encode_PACKET_compact(encbuf, &encx, &cmn2, comm->id, &pkt);
+                } else {
+                    encode_PACKET_fast(encbuf, &encx, &cmn2, &pkt);
+                }
                 uint16_t oldEncx = encx;
 
-                /* Copy the original payload unchanged */
-                encode_buf(encbuf, &encx, (udp_buf + idx), (udp_size - idx));
+                /* Place it in front of the original payload which stays where it is, the
+                 * headroom in front of udp_buf covers the growth */
+                rec_buf = udp_buf + idx - encx;
+                memcpy(rec_buf, encbuf, encx);
+                encx += udp_size - idx;
 
                 if(comm->header_encryption == HEADER_ENCRYPTION_ENABLED) {
                     packet_header_encrypt(rec_buf, oldEncx, encx,
@@ -1075,6 +2276,13 @@ static int process_udp (n2n_sn_t * sss,
 
                 traceEvent(TRACE_DEBUG, "Rx PACKET fwd unmodified");
 
+                /* the sender is an edge of the forwarding supernode */
+                memset(&sn_sock, 0, sizeof(n2n_sock_t));
+                sn_sock.family = AF_INET;
+                sn_sock.port = ntohs(sender_sock->sin_port);
+                memcpy(sn_sock.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
+                learn_remote_edge(sss, comm, pkt.srcMac, &sn_sock, now);
+
                 rec_buf = udp_buf;
                 encx = udp_size;
 
@@ -1087,9 +2295,10 @@ static int process_udp (n2n_sn_t * sss,
 
             /* Common section to forward the final product. */
             if(unicast) {
-                try_forward(sss, comm, &cmn, pkt.dstMac, from_supernode, rec_buf, encx);
+                try_forward(sss, comm, &cmn, pkt.dstMac, from_supernode, rec_buf, encx, now);
             } else {
-                try_broadcast(sss, comm, &cmn, pkt.srcMac, from_supernode, rec_buf, encx);
+                try_broadcast(sss, comm, &cmn, pkt.srcMac, pkt.dstMac,
+                              (msg_type == MSG_TYPE_BROADCAST) ? &bcast : NULL, from_supernode, rec_buf, encx);
             }
             break;
         }
@@ -1155,7 +2364,7 @@ static int process_udp (n2n_sn_t * sss,
                                           comm->header_encryption_ctx, comm->header_iv_ctx,
                                           time_stamp());
                 }
-                try_forward(sss, comm, &cmn, reg.dstMac, from_supernode, rec_buf, encx); /* unicast only */
+                try_forward(sss, comm, &cmn, reg.dstMac, from_supernode, rec_buf, encx, now); /* unicast only */
             } else {
                 traceEvent(TRACE_ERROR, "Rx REGISTER with multicast destination");
             }
@@ -1178,16 +2387,15 @@ static int process_udp (n2n_sn_t * sss,
             n2n_REGISTER_SUPER_ACK_payload_t       *payload;
             size_t                                 encx = 0;
             struct sn_community                    *fed;
-            struct sn_community_regular_expression *re, *tmp_re;
-            struct peer_info                       *peer, *tmp_peer, *p;
-            int8_t                                 allowed_match = -1;
+            struct peer_info                       *p;
             uint8_t                                match = 0;
-            int                                    match_length = 0;
             n2n_ip_subnet_t                        ipaddr;
             int                                    num = 0;
             int                                    skip_add;
-            int                                    skip;
             int                                    ret_value;
+            struct peer_info                       *homes[SN_COMMUNITY_HOMES_MAX];
+            int                                    num_homes = 0;
+            int                                    h;
 
             memset(&ack, 0, sizeof(n2n_REGISTER_SUPER_ACK_t));
             memset(&nak, 0, sizeof(n2n_REGISTER_SUPER_NAK_t));
@@ -1197,6 +2405,11 @@ static int process_udp (n2n_sn_t * sss,
             ++(sss->stats.reg_super);
             decode_REGISTER_SUPER(&reg, &cmn, udp_buf, &rem, &idx);
 
+            /* compact PACKETs are a matter between the edge and the supernode it registers with */
+            if(cmn.flags & N2N_FLAGS_SOCKET) {
+                reg.features = 0;
+            }
+
             if(comm) {
                 if(comm->header_encryption == HEADER_ENCRYPTION_ENABLED) {
                     if(!find_edge_time_stamp_and_verify(comm->edges, from_supernode, reg.edgeMac, stamp, TIME_STAMP_NO_JITTER)) {
@@ -1214,16 +2427,7 @@ static int process_udp (n2n_sn_t * sss,
             */
 
             if(!comm && sss->lock_communities) {
-                HASH_ITER(hh, sss->rules, re, tmp_re) {
-                    allowed_match = re_matchp(re->rule, (const char *)cmn.community, &match_length);
-
-                    if((allowed_match != -1)
-                       && (match_length == strlen((const char *)cmn.community)) // --- only full matches allowed (remove, if also partial matches wanted)
-                       && (allowed_match == 0)) { // --- only full matches allowed (remove, if also partial matches wanted)
-                        match = 1;
-                        break;
-                    }
-                }
+                match = community_allowed_by_rules(sss, (const char *)cmn.community);
                 if(match != 1) {
                     traceEvent(TRACE_INFO, "Discarded registration: unallowed community '%s'",
                                (char*)cmn.community);
@@ -1242,13 +2446,19 @@ static int process_udp (n2n_sn_t * sss,
                     /* ... and also are purgeable during periodic purge */
                     comm->purgeable = COMMUNITY_PURGEABLE;
                     comm->number_enc_packets = 0;
-                    HASH_ADD_STR(sss->communities, community, comm);
-
-                    traceEvent(TRACE_INFO, "New community: %s", comm->community);
-                    assign_one_ip_subnet(sss, comm);
+                    if(sn_community_add(sss, comm) == 0) {
+                        traceEvent(TRACE_INFO, "New community: %s", comm->community);
+                        assign_one_ip_subnet(sss, comm);
+                    } else {
+                        free(comm);
+                        comm = NULL;
+                    }
                 }
             }
 
+            if(comm)
+                ++(sss->community_ids.stats[comm->id].reg_super);
+
             if(comm) {
                 cmn2.ttl = N2N_DEFAULT_TTL;
                 cmn2.pc = n2n_register_super_ack;
@@ -1280,32 +2490,31 @@ static int process_udp (n2n_sn_t * sss,
                 if(comm->is_federation == IS_FEDERATION) {
                     skip_add = SN_ADD;
                     p = add_sn_to_list_by_mac_or_sock(&(sss->federation->edges), &(ack.sock), &(reg.edgeMac), &skip_add);
+                    if(skip_add == SN_ADD_ADDED) {
+                        arm_peer_expiry(&(sss->federation->edges_expiry), p, now);
+                        sss->snapshot_dirty = 1;
+                    }
                 }
 
                 // REVISIT: consider adding last_seen
 
-                /* Skip random numbers of supernodes before payload assembling, calculating an appropriate random_number.
-                 * That way, all supernodes have a chance to be propagated with REGISTER_SUPER_ACK. */
-                skip = HASH_COUNT(sss->federation->edges) - (int)(REG_SUPER_ACK_PAYLOAD_ENTRY_SIZE / REG_SUPER_ACK_PAYLOAD_ENTRY_SIZE);
-                skip = (skip < 0) ? 0 : n2n_rand_sqr(skip);
-
                 /* Assembling supernode list for REGISTER_SUPER_ACK payload */
                 payload = (n2n_REGISTER_SUPER_ACK_payload_t*)payload_buf;
-                HASH_ITER(hh, sss->federation->edges, peer, tmp_peer) {
-                    if(skip) {
-                        skip--;
-                        continue;
+
+                /* With community homing, the community's homes go first so the edge gets to know
+                 * them and moves there as soon as it sees they are less loaded (see sn_selection.c) */
+                if(sss->community_homes && (comm->is_federation == IS_NO_FEDERATION)) {
+                    community_home_rank(sss, comm->community, homes, &num_homes, now);
+                    for(h = 0; h < num_homes; h++) {
+                        memcpy(&(payload->sock), &(homes[h]->sock), sizeof(n2n_sock_t));
+                        memcpy(&(payload->mac), &(homes[h]->mac_addr), sizeof(n2n_mac_t));
+                        payload++;
+                        num++;
                     }
-                    if(memcmp(&(peer->sock), &(ack.sock), sizeof(n2n_sock_t)) == 0) continue; /* a supernode doesn't add itself to the payload */
-                    if((now - peer->last_seen) >= (2*LAST_SEEN_SN_ACTIVE)) continue; /* skip long-time-not-seen supernodes.
-                                                                                      * We need to allow for a little extra time because supernodes sometimes exceed
-                                                                                      * their SN_ACTIVE time before they get re-registred to. */
-                    if(((++num)*REG_SUPER_ACK_PAYLOAD_ENTRY_SIZE) > REG_SUPER_ACK_PAYLOAD_SPACE) break; /* no more space available in REGISTER_SUPER_ACK payload */
-                    memcpy(&(payload->sock), &(peer->sock), sizeof(n2n_sock_t));
-                    memcpy(&(payload->mac), &(peer->mac_addr), sizeof(n2n_mac_t));
-                    // shift to next payload entry
-                    payload++;
                 }
+
+                num += copy_ack_payload(sss, payload, REG_SUPER_ACK_PAYLOAD_SPACE / REG_SUPER_ACK_PAYLOAD_ENTRY_SIZE - num,
+                                        &(ack.sock), homes, num_homes, now);
                 ack.num_sn = num;
 
                 traceEvent(TRACE_DEBUG, "Rx REGISTER_SUPER for %s [%s]",
@@ -1315,11 +2524,26 @@ static int process_udp (n2n_sn_t * sss,
                 if(memcmp(reg.edgeMac, &null_mac, N2N_MAC_SIZE) != 0) {
                     if(cmn.flags & N2N_FLAGS_SOCKET) {
                         ret_value = update_edge(sss, &reg, comm, &(ack.sock), SN_ADD_SKIP, now);
+                        /* not registered here, but reachable through the forwarding supernode */
+                        if(ret_value == update_edge_new_sn) {
+                            learn_remote_edge(sss, comm, reg.edgeMac, &(ack.sock), now);
+                        }
                     } else {
                         ret_value = update_edge(sss, &reg, comm, &(ack.sock), SN_ADD, now);
                     }
                 }
 
+                if((reg.features & N2N_FEATURE_COMPACT_PACKET)
+                   && (comm->header_encryption == HEADER_ENCRYPTION_NONE)
+                   && (comm->is_federation == IS_NO_FEDERATION)) {
+                    ack.community_id = comm->id;
+                }
+                ack.features = reg.features & (N2N_FEATURE_QUERY_BATCH | N2N_FEATURE_PEER_LIST | N2N_FEATURE_MCAST_SNOOP);
+                /* federated supernodes would not spare the edges reached directly */
+                if(!HASH_COUNT(sss->federation->edges)) {
+                    ack.features |= reg.features & N2N_FEATURE_BCAST_P2P;
+                }
+
                 if(ret_value == update_edge_auth_fail) {
                     cmn2.pc = n2n_register_super_nak;
                     memcpy(&(nak.cookie), &(reg.cookie), sizeof(n2n_cookie_t));
@@ -1348,6 +2572,7 @@ static int process_udp (n2n_sn_t * sss,
                         memcpy(reg.sock.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
 
                         cmn2.pc = n2n_register_super;
+                        reg.features = 0;
                         encode_REGISTER_SUPER(ackbuf, &encx, &cmn2, &reg);
 
                         if(comm->header_encryption == HEADER_ENCRYPTION_ENABLED) {
@@ -1356,7 +2581,7 @@ static int process_udp (n2n_sn_t * sss,
                                                   time_stamp());
                         }
 
-                        try_broadcast(sss, NULL, &cmn, reg.edgeMac, from_supernode, ackbuf, encx);
+                        try_broadcast(sss, NULL, &cmn, reg.edgeMac, NULL, NULL, from_supernode, ackbuf, encx);
 
                         encx = 0;
                         cmn2.pc = n2n_register_super_ack;
@@ -1417,8 +2642,12 @@ static int process_udp (n2n_sn_t * sss,
 
             HASH_FIND_PEER(comm->edges, unreg.srcMac, peer);
             if(peer != NULL) {
-                if((auth = auth_edge(&(peer->auth), &unreg.auth)) == 0) {
+                if((auth = auth_edge(&(peer->cold->auth), &unreg.auth)) == 0) {
                     HASH_DEL(comm->edges, peer);
+                    mac_table_remove(&(comm->edges_index), peer->mac_addr);
+                    timer_wheel_disarm(&(peer->expiry));
+                    peer_info_free(peer);
+                    sss->snapshot_dirty = 1;
                 }
             }
 
@@ -1496,6 +2725,8 @@ static int process_udp (n2n_sn_t * sss,
 
                 if(skip_add == SN_ADD_ADDED) {
                     tmp->last_seen = now - LAST_SEEN_SN_NEW;
+                    arm_peer_expiry(&(sss->federation->edges_expiry), tmp, now);
+                    sss->snapshot_dirty = 1;
                 }
 
                 // shift to next payload entry
@@ -1544,6 +2775,10 @@ static int process_udp (n2n_sn_t * sss,
             if(comm->is_federation == IS_NO_FEDERATION) {
                 if(peer != NULL) {
                     HASH_DEL(comm->edges, peer);
+                    mac_table_remove(&(comm->edges_index), peer->mac_addr);
+                    timer_wheel_disarm(&(peer->expiry));
+                    peer_info_free(peer);
+                    sss->snapshot_dirty = 1;
                 }
             }
 
@@ -1556,24 +2791,13 @@ static int process_udp (n2n_sn_t * sss,
             size_t                                 encx = 0;
             n2n_common_t                           cmn2;
             n2n_PEER_INFO_t                        pi;
-            struct sn_community_regular_expression *re, *tmp_re;
             struct peer_info                       *peer, *tmp_peer, *p;
-            int8_t                                 allowed_match = -1;
             uint8_t                                match = 0;
-            int                                    match_length = 0;
+            uint8_t                                t;
             uint8_t                                *rec_buf; /* either udp_buf or encbuf */
 
             if(!comm && sss->lock_communities) {
-                HASH_ITER(hh, sss->rules, re, tmp_re) {
-                    allowed_match = re_matchp(re->rule, (const char *)cmn.community, &match_length);
-
-                    if((allowed_match != -1)
-                       && (match_length == strlen((const char *)cmn.community)) // --- only full match…
-                       && (allowed_match == 0)) {                               // --- only full matches allowed (re…
-                        match = 1;
-                        break;
-                    }
-                }
+                match = community_allowed_by_rules(sss, (const char *)cmn.community);
                 if(match != 1) {
                     traceEvent(TRACE_DEBUG, "process_udp QUERY_PEER from unknown community %s", cmn.community);
                     return -1;
@@ -1607,12 +2831,20 @@ static int process_udp (n2n_sn_t * sss,
                 memcpy(cmn2.community, cmn.community, sizeof(n2n_community_t));
 
                 pi.aflags = 0;
+                if(query.delay && comm
+                   && (schedule_nat_probe(sss, comm, sender_sock, query.srcMac, query.delay, now) == 0)) {
+                    pi.aflags = N2N_AFLAGS_NAT_PROBE_SCHEDULED;
+                }
                 memcpy(pi.mac, query.targetMac, sizeof(n2n_mac_t));
                 memcpy(pi.srcMac, sss->mac_addr, sizeof(n2n_mac_t));
                 pi.sock.family = AF_INET;
                 pi.sock.port = ntohs(sender_sock->sin_port);
                 memcpy(pi.sock.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
                 pi.data = sn_selection_criterion_gather_data(sss);
+                if(sss->community_homes && !(comm && (comm->is_federation == IS_FEDERATION))) {
+                    pi.data = sn_selection_criterion_homing(pi.data,
+                                                            community_home_rank(sss, (char*)cmn.community, NULL, NULL, now));
+                }
 
                 encode_PEER_INFO(encbuf, &encx, &cmn2, &pi);
 
@@ -1630,67 +2862,21 @@ static int process_udp (n2n_sn_t * sss,
                 traceEvent(TRACE_DEBUG, "Tx PONG to %s",
                            macaddr_str(mac_buf, query.srcMac));
 
-            } else {
-                traceEvent(TRACE_DEBUG, "Rx QUERY_PEER from %s for %s",
-                           macaddr_str(mac_buf, query.srcMac),
-                           macaddr_str(mac_buf2, query.targetMac));
-
-                struct peer_info *scan;
-                HASH_FIND_PEER(comm->edges, query.targetMac, scan);
-                if(scan) {
-                    cmn2.ttl = N2N_DEFAULT_TTL;
-                    cmn2.pc = n2n_peer_info;
-                    cmn2.flags = N2N_FLAGS_FROM_SUPERNODE;
-                    memcpy(cmn2.community, cmn.community, sizeof(n2n_community_t));
-
-                    pi.aflags = 0;
-                    memcpy(pi.mac, query.targetMac, sizeof(n2n_mac_t));
-                    pi.sock = scan->sock;
-
-                    encode_PEER_INFO(encbuf, &encx, &cmn2, &pi);
-
-                    if(comm->header_encryption == HEADER_ENCRYPTION_ENABLED) {
-                        packet_header_encrypt(encbuf, encx, encx, comm->header_encryption_ctx,
-                                              comm->header_iv_ctx,
-                                              time_stamp());
-                    }
-
-                    if(cmn.flags & N2N_FLAGS_SOCKET) {
-                        sendto_sock(sss, &query.sock, encbuf, encx);
-                    } else {
-                        sendto(sss->sock, encbuf, encx, 0,
-                               (struct sockaddr *)sender_sock, sizeof(struct sockaddr_in));
-                    }
-                    traceEvent(TRACE_DEBUG, "Tx PEER_INFO to %s",
-                               macaddr_str(mac_buf, query.srcMac));
-
-                } else {
-
-                    if(from_supernode) {
-                        traceEvent(TRACE_DEBUG, "QUERY_PEER on unknown edge from supernode %s. Dropping the packet.",
-                                   macaddr_str(mac_buf, query.srcMac));
-                    } else {
-                        traceEvent(TRACE_DEBUG, "QUERY_PEER from unknown edge %s. Forwarding to all other supernodes.",
-                                   macaddr_str(mac_buf, query.srcMac));
-
-                        memcpy(&cmn2, &cmn, sizeof(n2n_common_t));
-
-                        /* We are going to add socket even if it was not there before */
-                        cmn2.flags |= N2N_FLAGS_SOCKET | N2N_FLAGS_FROM_SUPERNODE;
-                        query.sock.family = AF_INET;
-                        query.sock.port = ntohs(sender_sock->sin_port);
-                        memcpy(query.sock.addr.v4, &(sender_sock->sin_addr.s_addr), IPV4_SIZE);
-
-                        encode_QUERY_PEER(encbuf, &encx, &cmn2, &query);
-
-                        if(comm->header_encryption == HEADER_ENCRYPTION_ENABLED) {
-                            packet_header_encrypt(encbuf, encx, encx, comm->header_encryption_ctx,
-                                                  comm->header_iv_ctx,
-                                                  time_stamp());
-                        }
-
-                        try_broadcast(sss, NULL, &cmn, query.srcMac, from_supernode, encbuf, encx);
-                    }
+            } else if(comm && (memcmp(query.targetMac, broadcast_mac, sizeof(n2n_mac_t)) == 0)) {
+                if(!from_supernode) {
+                    answer_peer_list(sss, comm, &cmn, &query, sender_sock, now);
+                }
+            } else if(comm) {
+                // a batch gets answered as if each of its MACs was queried on its own -- if it
+                // comes from the registered edge itself, it could not get reflected elsewhere
+                answer_query_peer(sss, comm, &cmn, &query, query.targetMac, sender_sock, from_supernode);
+                if((query.num_targets > 0) && !edge_at_sender(comm, query.srcMac, sender_sock)) {
+                    traceEvent(TRACE_DEBUG, "Batch of %u more QUERY_PEER targets from unregistered %s dropped",
+                               query.num_targets, macaddr_str(mac_buf, query.srcMac));
+                    query.num_targets = 0;
+                }
+                for(t = 0; t < query.num_targets; t++) {
+                    answer_query_peer(sss, comm, &cmn, &query, query.targets[t], sender_sock, from_supernode);
                 }
             }
 
@@ -1709,13 +2895,29 @@ static int process_udp (n2n_sn_t * sss,
  *  daemonisation on some platforms. */
 int run_sn_loop (n2n_sn_t *sss, int *keep_running) {
 
-    uint8_t pktbuf[N2N_SN_PKTBUF_SIZE];
+    uint8_t pktbuf[N2N_SN_PKTBUF_HEADROOM + N2N_SN_PKTBUF_SIZE];
     time_t last_purge_edges = 0;
     time_t last_sort_communities = 0;
     time_t last_re_reg_and_purge = 0;
+    time_t last_snapshot = 0;
 
     sss->start_time = time(NULL);
 
+    /* control plane admission, the tables are keyed by random seeds */
+    if(sss->ctrl_rate_by_source)
+        token_bucket_table_init(&(sss->ctrl_by_source), SN_CTRL_ADMISSION_TABLE_SIZE,
+                                sss->ctrl_rate_by_source, sss->ctrl_rate_by_source * SN_CTRL_BURST_SECS);
+    if(sss->ctrl_rate_by_community)
+        token_bucket_table_init(&(sss->ctrl_by_community), SN_CTRL_ADMISSION_TABLE_SIZE,
+                                sss->ctrl_rate_by_community, sss->ctrl_rate_by_community * SN_CTRL_BURST_SECS);
+    traceEvent(TRACE_NORMAL, "Control plane admission: %u msg/s per source, %u per community, %u overall (0: no limit)",
+               sss->ctrl_rate_by_source, sss->ctrl_rate_by_community, sss->ctrl_rate_total);
+
+    /* warm restart: carry on with the state of the previous run */
+    sn_snapshot_load(sss, sss->start_time);
+    sss->snapshot_dirty = 0;
+    last_snapshot = sss->start_time;
+
     while(*keep_running) {
         int rc;
         ssize_t bread;
@@ -1730,7 +2932,8 @@ int run_sn_loop (n2n_sn_t *sss, int *keep_running) {
         FD_SET(sss->sock, &socket_mask);
         FD_SET(sss->mgmt_sock, &socket_mask);
 
-        wait_time.tv_sec = 10;
+        // delayed PINGs are due to the second
+        wait_time.tv_sec = sss->num_nat_probes ? 1 : 10;
         wait_time.tv_usec = 0;
         rc = select(max_sock + 1, &socket_mask, NULL, NULL, &wait_time);
 
@@ -1742,7 +2945,7 @@ int run_sn_loop (n2n_sn_t *sss, int *keep_running) {
                 socklen_t i;
 
                 i = sizeof(sender_sock);
-                bread = recvfrom(sss->sock, pktbuf, N2N_SN_PKTBUF_SIZE, 0 /*flags*/,
+                bread = recvfrom(sss->sock, pktbuf + N2N_SN_PKTBUF_HEADROOM, N2N_SN_PKTBUF_SIZE, 0 /*flags*/,
                                  (struct sockaddr *)&sender_sock, (socklen_t *)&i);
 
                 if((bread < 0)
@@ -1763,7 +2966,7 @@ int run_sn_loop (n2n_sn_t *sss, int *keep_running) {
                 /* We have a datagram to process */
                 if(bread > 0) {
                     /* And the datagram has data (not just a header) */
-                    process_udp(sss, &sender_sock, pktbuf, bread, now);
+                    process_udp(sss, &sender_sock, pktbuf + N2N_SN_PKTBUF_HEADROOM, bread, now);
                 }
             }
 
@@ -1791,8 +2994,13 @@ int run_sn_loop (n2n_sn_t *sss, int *keep_running) {
         re_register_and_purge_supernodes(sss, sss->federation, &last_re_reg_and_purge, now);
         purge_expired_communities(sss, &last_purge_edges, now);
         sort_communities(sss, &last_sort_communities, now);
+        write_snapshot(sss, &last_snapshot, now);
+        timer_wheel_advance(&(sss->nat_probes), now, send_nat_probe, sss);
     } /* while */
 
+    /* most recent state for the next start */
+    sn_snapshot_write(sss, time(NULL));
+
     sn_term(sss);
 
     return 0;
@@ -0,0 +1,176 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#include "timer_wheel.h"
+
+
+// hierarchical timing wheel with a resolution of one second
+//
+// level 0 keeps one slot per tick for the next TIMER_WHEEL_SIZE ticks, every further
+// level spans TIMER_WHEEL_SIZE times the range of the level below. whenever the lower
+// bits of the current tick wrap around, the corresponding slot of the next level gets
+// cascaded down. so, arming and disarming are O(1) and each timer is touched at most
+// once per level on its way to expiry -- no matter how many timers are armed
+//
+// a zeroed wheel is a valid, empty wheel; it catches up with the first call to
+// timer_wheel_advance()
+
+
+#define TIMER_WHEEL_SPAN    ((time_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+
+static void timer_link (n2n_timer_t **head, n2n_timer_t *timer) {
+
+    timer->next = *head;
+    if(timer->next)
+        timer->next->pprev = &(timer->next);
+    timer->pprev = head;
+    *head = timer;
+}
+
+
+// moves the whole content of a slot to a local list head
+static void timer_detach_slot (n2n_timer_t **slot, n2n_timer_t **list) {
+
+    *list = *slot;
+    if(*list)
+        (*list)->pprev = list;
+    *slot = NULL;
+}
+
+
+static void timer_place (n2n_timer_wheel_t *wheel, n2n_timer_t *timer) {
+
+    time_t expires = timer->expires;
+    time_t delta;
+    int level;
+
+    // already due timers go to the slot processed next
+    if(expires < wheel->now)
+        expires = wheel->now;
+
+    // too far out, park in outermost level and re-place when cascading
+    delta = expires - wheel->now;
+    if(delta >= TIMER_WHEEL_SPAN) {
+        expires = wheel->now + TIMER_WHEEL_SPAN - 1;
+        delta = TIMER_WHEEL_SPAN - 1;
+    }
+
+    for(level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        if(delta < ((time_t)1 << (TIMER_WHEEL_BITS * (level + 1))))
+            break;
+    }
+
+    timer_link(&(wheel->slot[level][(expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK]), timer);
+}
+
+
+static void timer_replace_list (n2n_timer_wheel_t *wheel, n2n_timer_t **list) {
+
+    n2n_timer_t *timer;
+
+    while(*list) {
+        timer = *list;
+        timer_wheel_disarm(timer);
+        timer_place(wheel, timer);
+    }
+}
+
+
+/* ************************************** */
+
+
+void timer_wheel_init (n2n_timer_wheel_t *wheel, time_t now) {
+
+    memset(wheel, 0, sizeof(n2n_timer_wheel_t));
+    wheel->now = now;
+}
+
+
+// (re-)arms the timer to fire at 'expires', already due timers fire with the next advance
+void timer_wheel_arm (n2n_timer_wheel_t *wheel, n2n_timer_t *timer, time_t expires) {
+
+    timer_wheel_disarm(timer);
+    timer->expires = expires;
+    timer_place(wheel, timer);
+}
+
+
+// does not need the wheel and is safe to call on timers never armed (zeroed)
+void timer_wheel_disarm (n2n_timer_t *timer) {
+
+    if(timer->pprev == NULL)
+        return;
+
+    *(timer->pprev) = timer->next;
+    if(timer->next)
+        timer->next->pprev = timer->pprev;
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+
+// fires all timers due up to and including 'now', returns their number; timers are
+// disarmed before their callback is called which thus may re-arm or free them
+size_t timer_wheel_advance (n2n_timer_wheel_t *wheel, time_t now, n2n_timer_cb_t cb, void *data) {
+
+    n2n_timer_t *list, *timer;
+    size_t fired = 0;
+    int level, i;
+
+    if(now - wheel->now >= TIMER_WHEEL_SPAN) {
+        // far behind (or never advanced at all), rather than spinning through
+        // each of the missed ticks, re-place all timers relative to 'now'
+        list = NULL;
+        for(level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            for(i = 0; i < TIMER_WHEEL_SIZE; i++) {
+                while(wheel->slot[level][i]) {
+                    timer = wheel->slot[level][i];
+                    timer_wheel_disarm(timer);
+                    timer_link(&list, timer);
+                }
+            }
+        }
+        wheel->now = now;
+        timer_replace_list(wheel, &list);
+    }
+
+    while(wheel->now <= now) {
+        // cascade, outermost level first
+        for(level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            if(wheel->now & (((time_t)1 << (TIMER_WHEEL_BITS * level)) - 1))
+                continue;
+            timer_detach_slot(&(wheel->slot[level][(wheel->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK]), &list);
+            timer_replace_list(wheel, &list);
+        }
+
+        timer_detach_slot(&(wheel->slot[0][wheel->now & TIMER_WHEEL_MASK]), &list);
+        wheel->now++;
+
+        while(list) {
+            timer = list;
+            timer_wheel_disarm(timer);
+            cb(timer, data);
+            fired++;
+        }
+    }
+
+    return fired;
+}
@@ -0,0 +1,122 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#include "token_bucket.h"
+
+
+// token buckets for rate limiting
+//
+// a bucket holds up to 'burst' tokens and gets refilled by 'rate' tokens per second,
+// each admitted event takes one token. callers limiting an event by several buckets
+// check all of them first and charge them only if every one is ready, so a rejected
+// event does not use up tokens of the buckets it passed.
+//
+// the table variant is a fixed-size array of buckets indexed by a keyed hash of the key
+// (e.g. an ip address), see hash_array_alloc(). each entry stores its key, a key finding
+// its slot taken by another one replaces it with a fresh bucket. keys never share a
+// bucket; two keys busy in the same slot at the same time keep resetting each other's
+// bucket and are then only held by the other limits.
+//
+// a zeroed bucket is a full bucket, a rate of zero disables the limit
+
+
+/* refills the bucket and returns 1 if it holds a token, without taking it */
+int token_bucket_ready (n2n_token_bucket_t *bucket, uint32_t rate, uint32_t burst, time_t now) {
+
+    uint32_t elapsed = (uint32_t)now - bucket->last_refill;
+
+    if(rate == 0)
+        return 1;
+
+    if(elapsed) {
+        if((elapsed > burst / rate) || (bucket->last_refill == 0))
+            bucket->tokens = burst;
+        else if(bucket->tokens + elapsed * rate < burst)
+            bucket->tokens += elapsed * rate;
+        else
+            bucket->tokens = burst;
+        bucket->last_refill = (uint32_t)now;
+    }
+
+    return (bucket->tokens != 0);
+}
+
+
+/* takes a token from a bucket found ready just before */
+void token_bucket_charge (n2n_token_bucket_t *bucket, uint32_t rate) {
+
+    if(rate && bucket->tokens)
+        bucket->tokens--;
+}
+
+
+/* size gets rounded up to a power of two */
+int token_bucket_table_init (token_bucket_table_t *table, uint32_t size, uint32_t rate, uint32_t burst) {
+
+    memset(table, 0, sizeof(token_bucket_table_t));
+    table->entries = (token_bucket_entry_t*)hash_array_alloc(size, sizeof(token_bucket_entry_t),
+                                                             &(table->mask), &(table->seed));
+    if(!table->entries)
+        return -1;
+
+    table->rate = rate;
+    table->burst = burst;
+
+    return 0;
+}
+
+
+void token_bucket_table_free (token_bucket_table_t *table) {
+
+    free(table->entries);
+    memset(table, 0, sizeof(token_bucket_table_t));
+}
+
+
+/* returns the key's bucket, taking over the slot with a fresh bucket if another key holds it */
+static n2n_token_bucket_t* token_bucket_table_bucket (token_bucket_table_t *table, uint64_t key) {
+
+    token_bucket_entry_t *entry = &(table->entries[hash_mix(key ^ table->seed) & table->mask]);
+
+    if(entry->key != key) {
+        entry->key = key;
+        memset(&(entry->bucket), 0, sizeof(n2n_token_bucket_t));
+    }
+
+    return &(entry->bucket);
+}
+
+
+/* returns 1 if the key's bucket holds a token; without buckets, i.e. rate limiting disabled, it always does */
+int token_bucket_table_ready (token_bucket_table_t *table, uint64_t key, time_t now) {
+
+    if(!table->entries)
+        return 1;
+
+    return token_bucket_ready(token_bucket_table_bucket(table, key), table->rate, table->burst, now);
+}
+
+
+void token_bucket_table_charge (token_bucket_table_t *table, uint64_t key) {
+
+    if(!table->entries)
+        return;
+
+    token_bucket_charge(token_bucket_table_bucket(table, key), table->rate);
+}
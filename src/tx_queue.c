@@ -0,0 +1,123 @@
+/**
+ * (C) 2007-21 - ntop.org and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not see see <http://www.gnu.org/licenses/>
+ *
+ */
+
+
+#include "tx_queue.h"
+
+
+// holding queue for outgoing frames
+//
+// frames an edge cannot send the best way yet, e.g. to a peer whose direct path is still
+// being established, wait here for a short while. the queue is a fixed array of slots in
+// order of arrival, each slot pointing to a copy of its frame. it is bounded overall and
+// per destination mac address, so a single destination cannot take all the room. frames
+// leave the queue in order, either all frames to one destination once its path is known,
+// or all frames queued before some time once they waited long enough.
+//
+// a zeroed queue is a valid empty queue
+
+
+int tx_queue_add (tx_queue_t *queue, const uint8_t *frame, size_t len, uint64_t now) {
+
+    tx_queue_frame_t *slot;
+
+    if((len < N2N_MAC_SIZE) || (queue->num >= TX_QUEUE_SIZE))
+        return -1;
+
+    if(tx_queue_count(queue, frame) >= TX_QUEUE_PER_DEST)
+        return -1;
+
+    slot = &(queue->frames[queue->num]);
+    slot->data = malloc(len);
+    if(!slot->data)
+        return -1;
+
+    memcpy(slot->data, frame, len);
+    memcpy(slot->dst, frame, N2N_MAC_SIZE); /* destination mac is first in ethernet header */
+    slot->len = len;
+    slot->queued = now;
+    queue->num++;
+
+    return 0;
+}
+
+
+// number of frames queued for dst, or of all frames if dst is NULL
+size_t tx_queue_count (const tx_queue_t *queue, const n2n_mac_t dst) {
+
+    size_t i, num = 0;
+
+    if(!dst)
+        return queue->num;
+
+    for(i = 0; i < queue->num; i++) {
+        if(!memcmp(queue->frames[i].dst, dst, N2N_MAC_SIZE))
+            num++;
+    }
+
+    return num;
+}
+
+
+// hand the frames to dst (or to any destination if NULL) which were queued before
+// queued_before (or at any time if 0) to send() in order and remove them. send() may
+// add frames to the queue again, they are left for the next flush. flushing from
+// within send() does nothing
+size_t tx_queue_flush (tx_queue_t *queue, const n2n_mac_t dst, uint64_t queued_before, tx_queue_send_f send, void *ctx) {
+
+    tx_queue_frame_t frame;
+    size_t i = 0, end = queue->num, num = 0;
+
+    if(queue->flushing)
+        return 0;
+    queue->flushing = 1;
+
+    while(i < end) {
+        frame = queue->frames[i];
+
+        if((dst && memcmp(frame.dst, dst, N2N_MAC_SIZE))
+           || (queued_before && (frame.queued >= queued_before))) {
+            i++;
+            continue;
+        }
+
+        // remove before sending, send() might append
+        memmove(&(queue->frames[i]), &(queue->frames[i + 1]), (queue->num - i - 1) * sizeof(tx_queue_frame_t));
+        queue->num--;
+        end--;
+
+        send(ctx, frame.data, frame.len);
+        free(frame.data);
+        num++;
+    }
+
+    queue->flushing = 0;
+
+    return num;
+}
+
+
+void tx_queue_free (tx_queue_t *queue) {
+
+    size_t i;
+
+    for(i = 0; i < queue->num; i++)
+        free(queue->frames[i].data);
+
+    queue->num = 0;
+}
@@ -232,6 +232,61 @@ int decode_common (n2n_common_t * out,
 }
 
 
+/* the compact common part is used by PACKETs only, it carries the id the supernode
+ * assigned to the community (see REGISTER_SUPER_ACK) instead of its 16-byte name */
+int encode_common_compact (uint8_t * base,
+                           size_t * idx,
+                           const n2n_common_t * common,
+                           uint32_t community_id) {
+
+    int retval = 0;
+    uint16_t flags = 0;
+
+    retval += encode_uint8(base, idx, N2N_PKT_VERSION_COMPACT);
+    retval += encode_uint8(base, idx, common->ttl);
+
+    flags  = common->pc & N2N_FLAGS_TYPE_MASK;
+    flags |= common->flags & N2N_FLAGS_BITS_MASK;
+
+    retval += encode_uint16(base, idx, flags);
+    retval += encode_uint32(base, idx, community_id);
+
+    return retval;
+}
+
+
+/* the community name is left empty, it needs to be looked up by the id */
+int decode_common_compact (n2n_common_t * out,
+                           uint32_t * community_id,
+                           const uint8_t * base,
+                           size_t * rem,
+                           size_t * idx) {
+
+    size_t idx0 = *idx;
+    uint8_t dummy = 0;
+
+    if(*rem < N2N_COMPACT_COMMON_SIZE) {
+        return -1;
+    }
+
+    decode_uint8(&dummy, base, rem, idx);
+
+    if(N2N_PKT_VERSION_COMPACT != dummy) {
+        return -1;
+    }
+
+    decode_uint8(&(out->ttl), base, rem, idx);
+    decode_uint16(&(out->flags), base, rem, idx);
+    out->pc = (out->flags & N2N_FLAGS_TYPE_MASK);
+    out->flags &= N2N_FLAGS_BITS_MASK;
+
+    memset(out->community, 0, N2N_COMMUNITY_SIZE);
+    decode_uint32(community_id, base, rem, idx);
+
+    return (*idx - idx0);
+}
+
+
 int encode_sock (uint8_t * base,
                  size_t * idx,
                  const n2n_sock_t * sock) {
@@ -343,6 +398,7 @@ int encode_REGISTER_SUPER (uint8_t *base,
                            const n2n_REGISTER_SUPER_t *reg) {
 
     int retval = 0;
+    uint8_t i;
 
     retval += encode_common(base, idx, common);
     retval += encode_buf(base, idx, reg->cookie, N2N_COOKIE_SIZE);
@@ -356,6 +412,19 @@ int encode_REGISTER_SUPER (uint8_t *base,
     retval += encode_uint16(base, idx, reg->auth.scheme);
     retval += encode_uint16(base, idx, reg->auth.toksize);
     retval += encode_buf(base, idx, reg->auth.token, reg->auth.toksize);
+    /* optional, older supernodes ignore it */
+    if(0 != reg->features) {
+        retval += encode_uint16(base, idx, reg->features);
+    }
+    if(reg->features & N2N_FEATURE_KEEPALIVE) {
+        retval += encode_uint16(base, idx, reg->keepalive);
+    }
+    if(reg->features & N2N_FEATURE_MCAST_SNOOP) {
+        retval += encode_uint8(base, idx, reg->num_mcast_groups);
+        for(i = 0; i < reg->num_mcast_groups; i++) {
+            retval += encode_mac(base, idx, reg->mcast_groups[i]);
+        }
+    }
 
     return retval;
 }
@@ -368,6 +437,7 @@ int decode_REGISTER_SUPER (n2n_REGISTER_SUPER_t *reg,
                            size_t *idx) {
 
     size_t retval = 0;
+    uint8_t i;
     memset(reg, 0, sizeof(n2n_REGISTER_SUPER_t));
 
     retval += decode_buf(reg->cookie, N2N_COOKIE_SIZE, base, rem, idx);
@@ -381,6 +451,24 @@ int decode_REGISTER_SUPER (n2n_REGISTER_SUPER_t *reg,
     retval += decode_uint16(&(reg->auth.scheme), base, rem, idx);
     retval += decode_uint16(&(reg->auth.toksize), base, rem, idx);
     retval += decode_buf(reg->auth.token, reg->auth.toksize, base, rem, idx);
+    /* optional, stays zero if not present */
+    retval += decode_uint16(&(reg->features), base, rem, idx);
+    if(reg->features & N2N_FEATURE_KEEPALIVE) {
+        retval += decode_uint16(&(reg->keepalive), base, rem, idx);
+    }
+    if(reg->features & N2N_FEATURE_MCAST_SNOOP) {
+        retval += decode_uint8(&(reg->num_mcast_groups), base, rem, idx);
+        if(reg->num_mcast_groups > N2N_MCAST_GROUPS_MAX) {
+            reg->num_mcast_groups = N2N_MCAST_GROUPS_MAX;
+        }
+        for(i = 0; i < reg->num_mcast_groups; i++) {
+            if(*rem < N2N_MAC_SIZE) {
+                reg->num_mcast_groups = i;
+                break;
+            }
+            retval += decode_mac(reg->mcast_groups[i], base, rem, idx);
+        }
+    }
 
     return retval;
 }
@@ -485,6 +573,13 @@ int encode_REGISTER_SUPER_ACK (uint8_t *base,
     retval += encode_sock(base, idx, &(reg->sock));
     retval += encode_uint8(base, idx, reg->num_sn);
     retval += encode_buf(base, idx, tmpbuf, (reg->num_sn*REG_SUPER_ACK_PAYLOAD_ENTRY_SIZE));
+    /* optional, only sent to edges asking for compact PACKETs or for features */
+    if((0 != reg->community_id) || (0 != reg->features)) {
+        retval += encode_uint32(base, idx, reg->community_id);
+    }
+    if(0 != reg->features) {
+        retval += encode_uint16(base, idx, reg->features);
+    }
 
     return retval;
 }
@@ -513,6 +608,10 @@ int decode_REGISTER_SUPER_ACK (n2n_REGISTER_SUPER_ACK_t *reg,
     retval += decode_uint8(&(reg->num_sn), base, rem, idx);
     retval += decode_buf(tmpbuf, (reg->num_sn * REG_SUPER_ACK_PAYLOAD_ENTRY_SIZE), base, rem, idx);
 
+    /* optional, stay zero if not present */
+    retval += decode_uint32(&(reg->community_id), base, rem, idx);
+    retval += decode_uint16(&(reg->features), base, rem, idx);
+
     return retval;
 }
 
@@ -568,6 +667,121 @@ int fill_sockaddr (struct sockaddr * addr,
 }
 
 
+/* fixed-layout codec for the PACKET header, used on the data paths
+ *
+ * a PACKET header has one of very few shapes: common part, both MACs, optionally the
+ * sender's IPv4 socket (added by the supernode), compression and transform. so, rather
+ * than composing it field by field, it gets written and read by a few wide (unaligned)
+ * copies and one length check only. the uncommon IPv6 socket and short buffers are
+ * handed over to the generic encode_PACKET() / decode_PACKET() */
+
+#define N2N_PACKET_MACS_SIZE       (2 * N2N_MAC_SIZE)
+#define N2N_PACKET_SOCK4_SIZE      (4 + IPV4_SIZE)  /* family flags, port, address */
+
+
+/* writes the part following the common part, returns its length */
+static size_t encode_PACKET_tail (uint8_t * p,
+                                  const n2n_PACKET_t * pkt) {
+
+    uint8_t *p0 = p;
+    uint32_t w;
+
+    memcpy(p, pkt->srcMac, N2N_MAC_SIZE);
+    memcpy(p + N2N_MAC_SIZE, pkt->dstMac, N2N_MAC_SIZE);
+    p += N2N_PACKET_MACS_SIZE;
+
+    if(AF_INET == pkt->sock.family) {
+        /* upper half is the family flags, zero for IPv4 */
+        w = htonl(pkt->sock.port);
+        memcpy(p, &w, sizeof(w));
+        memcpy(p + sizeof(w), pkt->sock.addr.v4, IPV4_SIZE);
+        p += N2N_PACKET_SOCK4_SIZE;
+    }
+
+    p[0] = pkt->compression;
+    p[1] = pkt->transform;
+
+    return (p + 2) - p0;
+}
+
+
+int encode_PACKET_fast (uint8_t * base,
+                        size_t * idx,
+                        const n2n_common_t * common,
+                        const n2n_PACKET_t * pkt) {
+
+    uint8_t *p = base + *idx;
+    uint32_t w;
+    size_t len;
+
+    if((0 != pkt->sock.family) && (AF_INET != pkt->sock.family)) {
+        len = *idx;
+        encode_PACKET(base, idx, common, pkt);
+        return *idx - len;
+    }
+
+    /* version, ttl, flags */
+    w = htonl(((uint32_t)N2N_PKT_VERSION << 24) | ((uint32_t)common->ttl << 16)
+              | (common->pc & N2N_FLAGS_TYPE_MASK) | (common->flags & N2N_FLAGS_BITS_MASK));
+    memcpy(p, &w, sizeof(w));
+    memcpy(p + sizeof(w), common->community, N2N_COMMUNITY_SIZE);
+
+    len = sizeof(w) + N2N_COMMUNITY_SIZE;
+    len += encode_PACKET_tail(p + len, pkt);
+    *idx += len;
+
+    return len;
+}
+
+
+int decode_PACKET_fast (n2n_PACKET_t * pkt,
+                        const n2n_common_t * cmn, /* info on how to interpret it */
+                        const uint8_t * base,
+                        size_t * rem,
+                        size_t * idx) {
+
+    const uint8_t *p = base + *idx;
+    size_t len = N2N_PACKET_MACS_SIZE + 2;
+    uint32_t w;
+
+    if(cmn->flags & N2N_FLAGS_SOCKET) {
+        /* the family flags' msb tells IPv6 */
+        if((*rem <= N2N_PACKET_MACS_SIZE) || (p[N2N_PACKET_MACS_SIZE] & 0x80)) {
+            return decode_PACKET(pkt, cmn, base, rem, idx);
+        }
+        len += N2N_PACKET_SOCK4_SIZE;
+    }
+
+    if(*rem < len) {
+        return decode_PACKET(pkt, cmn, base, rem, idx);
+    }
+
+    memcpy(pkt->srcMac, p, N2N_MAC_SIZE);
+    memcpy(pkt->dstMac, p + N2N_MAC_SIZE, N2N_MAC_SIZE);
+    p += N2N_PACKET_MACS_SIZE;
+
+    if(cmn->flags & N2N_FLAGS_SOCKET) {
+        memcpy(&w, p, sizeof(w));
+        pkt->sock.family = AF_INET;
+        pkt->sock.port = ntohl(w) & 0xffff;
+        memset(pkt->sock.addr.v6, 0, IPV6_SIZE); /* so memcmp() works for equality. */
+        memcpy(pkt->sock.addr.v4, p + sizeof(w), IPV4_SIZE);
+        p += N2N_PACKET_SOCK4_SIZE;
+    } else {
+        memset(&(pkt->sock), 0, sizeof(n2n_sock_t));
+    }
+
+    pkt->compression = p[0];
+    pkt->transform = p[1];
+
+    *idx += len;
+    *rem -= len;
+
+    return len;
+}
+
+
+
 int encode_PACKET (uint8_t * base,
                    size_t * idx,
                    const n2n_common_t * common,
@@ -588,6 +802,35 @@ int encode_PACKET (uint8_t * base,
 }
 
 
+/* same as encode_PACKET but with the compact common part, 12 bytes shorter; only to
+ * be sent between an edge and the supernode which granted the community id */
+int encode_PACKET_compact (uint8_t * base,
+                           size_t * idx,
+                           const n2n_common_t * common,
+                           uint32_t community_id,
+                           const n2n_PACKET_t * pkt) {
+
+    int retval = 0;
+
+    size_t len;
+
+    retval += encode_common_compact(base, idx, common, community_id);
+    if((0 != pkt->sock.family) && (AF_INET != pkt->sock.family)) {
+        retval += encode_mac(base, idx, pkt->srcMac);
+        retval += encode_mac(base, idx, pkt->dstMac);
+        retval += encode_sock(base, idx, &(pkt->sock));
+        retval += encode_uint8(base, idx, pkt->compression);
+        retval += encode_uint8(base, idx, pkt->transform);
+    } else {
+        len = encode_PACKET_tail(base + *idx, pkt);
+        *idx += len;
+        retval += len;
+    }
+
+    return retval;
+}
+
+
 int decode_PACKET (n2n_PACKET_t * pkt,
                    const n2n_common_t * cmn, /* info on how to interpret it */
                    const uint8_t * base,
@@ -617,6 +860,7 @@ int encode_PEER_INFO (uint8_t *base,
                       const n2n_PEER_INFO_t *pkt) {
 
     int retval = 0;
+    uint8_t i;
 
     retval += encode_common(base, idx, common);
     retval += encode_uint16(base, idx, pkt->aflags);
@@ -624,6 +868,14 @@ int encode_PEER_INFO (uint8_t *base,
     retval += encode_mac(base, idx, pkt->mac);
     retval += encode_sock(base, idx, &pkt->sock);
     retval += encode_buf(base, idx, &pkt->data, sizeof(SN_SELECTION_CRITERION_DATA_TYPE));
+    if(pkt->aflags & N2N_AFLAGS_PEER_LIST) {
+        retval += encode_uint8(base, idx, pkt->page);
+        retval += encode_uint8(base, idx, pkt->num_peers);
+        for(i = 0; i < pkt->num_peers; i++) {
+            retval += encode_mac(base, idx, pkt->peer_macs[i]);
+            retval += encode_sock(base, idx, &pkt->peer_socks[i]);
+        }
+    }
 
     return retval;
 }
@@ -636,6 +888,7 @@ int decode_PEER_INFO (n2n_PEER_INFO_t *pkt,
                       size_t *idx) {
 
     size_t retval = 0;
+    uint8_t i;
     memset(pkt, 0, sizeof(n2n_PEER_INFO_t));
 
     retval += decode_uint16(&(pkt->aflags), base, rem, idx);
@@ -643,6 +896,22 @@ int decode_PEER_INFO (n2n_PEER_INFO_t *pkt,
     retval += decode_mac(pkt->mac, base, rem, idx);
     retval += decode_sock(&pkt->sock, base, rem, idx);
     retval += decode_buf((uint8_t*)&pkt->data, sizeof(SN_SELECTION_CRITERION_DATA_TYPE), base, rem, idx);
+    if(pkt->aflags & N2N_AFLAGS_PEER_LIST) {
+        retval += decode_uint8(&(pkt->page), base, rem, idx);
+        retval += decode_uint8(&(pkt->num_peers), base, rem, idx);
+        if(pkt->num_peers > N2N_PEER_LIST_PAGE) {
+            pkt->num_peers = N2N_PEER_LIST_PAGE;
+        }
+        for(i = 0; i < pkt->num_peers; i++) {
+            /* MAC and at least an IPv4 socket */
+            if(*rem < N2N_MAC_SIZE + 8) {
+                pkt->num_peers = i;
+                break;
+            }
+            retval += decode_mac(pkt->peer_macs[i], base, rem, idx);
+            retval += decode_sock(&pkt->peer_socks[i], base, rem, idx);
+        }
+    }
 
     return retval;
 }
@@ -658,6 +927,17 @@ int encode_QUERY_PEER (uint8_t * base,
     retval += encode_common(base, idx, common);
     retval += encode_mac(base, idx, pkt->srcMac);
     retval += encode_mac(base, idx, pkt->targetMac);
+    /* optional, older supernodes ignore them */
+    if((0 != pkt->delay) || (0 != pkt->num_targets) || (0 != pkt->page)) {
+        retval += encode_uint16(base, idx, pkt->delay);
+    }
+    if((0 != pkt->num_targets) || (0 != pkt->page)) {
+        retval += encode_uint8(base, idx, pkt->num_targets);
+        retval += encode_buf(base, idx, pkt->targets, pkt->num_targets * N2N_MAC_SIZE);
+    }
+    if(0 != pkt->page) {
+        retval += encode_uint8(base, idx, pkt->page);
+    }
 
     return retval;
 }
@@ -673,6 +953,59 @@ int decode_QUERY_PEER (n2n_QUERY_PEER_t * pkt,
 
     retval += decode_mac(pkt->srcMac, base, rem, idx);
     retval += decode_mac(pkt->targetMac, base, rem, idx);
+    /* optional, stay zero if not present */
+    retval += decode_uint16(&(pkt->delay), base, rem, idx);
+    retval += decode_uint8(&(pkt->num_targets), base, rem, idx);
+    if(pkt->num_targets > N2N_QUERY_BATCH_MAX) {
+        pkt->num_targets = N2N_QUERY_BATCH_MAX;
+    }
+    if(*rem < pkt->num_targets * N2N_MAC_SIZE) {
+        pkt->num_targets = *rem / N2N_MAC_SIZE;
+    }
+    retval += decode_buf((uint8_t*)pkt->targets, pkt->num_targets * N2N_MAC_SIZE, base, rem, idx);
+    retval += decode_uint8(&(pkt->page), base, rem, idx);
+
+    return retval;
+}
+
+
+int encode_BROADCAST (uint8_t *base,
+                      size_t *idx,
+                      const n2n_common_t *common,
+                      const n2n_BROADCAST_t *bcast,
+                      const n2n_PACKET_t *pkt) {
+
+    int retval = 0;
+
+    retval += encode_common(base, idx, common);
+    retval += encode_uint8(base, idx, bcast->num_excluded);
+    retval += encode_buf(base, idx, bcast->excluded, bcast->num_excluded * N2N_MAC_SIZE);
+    retval += encode_mac(base, idx, pkt->srcMac);
+    retval += encode_mac(base, idx, pkt->dstMac);
+    retval += encode_uint8(base, idx, pkt->compression);
+    retval += encode_uint8(base, idx, pkt->transform);
+
+    return retval;
+}
+
+
+int decode_BROADCAST (n2n_BROADCAST_t *bcast,
+                      n2n_PACKET_t *pkt,
+                      const n2n_common_t *cmn, /* info on how to interpret it */
+                      const uint8_t *base,
+                      size_t *rem,
+                      size_t *idx) {
+
+    size_t retval = 0;
+    memset(bcast, 0, sizeof(n2n_BROADCAST_t));
+
+    retval += decode_uint8(&(bcast->num_excluded), base, rem, idx);
+    /* an exclusion list cut short would make the supernode send copies the sender delivered already */
+    if((bcast->num_excluded > N2N_BCAST_P2P_MAX) || (*rem < bcast->num_excluded * N2N_MAC_SIZE)) {
+        return -1;
+    }
+    retval += decode_buf((uint8_t*)bcast->excluded, bcast->num_excluded * N2N_MAC_SIZE, base, rem, idx);
+    retval += decode_PACKET(pkt, cmn, base, rem, idx);
 
     return retval;
 }
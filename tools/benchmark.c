@@ -20,6 +20,7 @@
 
 #define DURATION                2.5   // test duration per algorithm
 #define PACKETS_BEFORE_GETTIME  2047  // do not check time after every packet but after (2 ^ n - 1)
+#define NUM_COMMUNITY_RULES     10000 // number of regular expressions for community matching benchmark
 
 /* heap allocation for compression as per lzo example doc */
 #define HEAP_ALLOC(var,size) lzo_align_t __LZO_MMODEL var [ ((size) + (sizeof(lzo_align_t) - 1)) / sizeof(lzo_align_t) ]
@@ -51,6 +52,9 @@ static void init_compression_for_benchmark(void);
 static void deinit_compression_for_benchmark(void);
 static void run_compression_benchmark(void);
 static void run_hashing_benchmark(void);
+static void run_community_rules_benchmark(void);
+static void run_mac_lookup_benchmark(uint32_t num_entries);
+static void run_packet_header_benchmark(int with_sock);
 
 
 int main(int argc, char * argv[]) {
@@ -91,6 +95,17 @@ int main(int argc, char * argv[]) {
 
   run_hashing_benchmark();
 
+  run_community_rules_benchmark();
+
+  run_mac_lookup_benchmark(1000);
+  run_mac_lookup_benchmark(100000);
+  run_mac_lookup_benchmark(1000000);
+  printf("\n");
+
+  run_packet_header_benchmark(0);
+  run_packet_header_benchmark(1);
+  printf("\n");
+
   /* Cleanup */
   transop_null.deinit(&transop_null);
   transop_tf.deinit(&transop_tf);
@@ -281,6 +296,286 @@ static void run_hashing_benchmark(void) {
   printf("\n");
 }
 
+// --- community rules benchmark ----------------------------------------------------------
+
+static void run_community_rules_benchmark(void) {
+  const float target_sec = DURATION;
+  struct timeval t1;
+  struct timeval t2;
+  ssize_t target_usec = target_sec * 1e6;
+  ssize_t tdiff; // microseconds
+  size_t num_names;
+  size_t num_matches;
+  float mpps;
+  char pattern[N2N_COMMUNITY_SIZE * 2];
+  re_t *rules;
+  re_set_t rule_set;
+  int match_length;
+  int i;
+
+  // the names to check, the last ones do not match any rule and thus need to be checked against all of them
+  const char *names[] = { "team00042", "lab07_ab", "site12x9999", "xteam00042", "lab07-ab", "unknown" };
+  const int num_test_names = sizeof(names) / sizeof(names[0]);
+
+  rules = (re_t*)calloc(NUM_COMMUNITY_RULES, sizeof(re_t));
+  if(!rules)
+    return;
+
+  for(i = 0; i < NUM_COMMUNITY_RULES; i++) {
+    switch(i % 3) {
+      case 0:  snprintf(pattern, sizeof(pattern), "team%05d", i); break;
+      case 1:  snprintf(pattern, sizeof(pattern), "lab%02d_[a-z]+", i % 100); break;
+      default: snprintf(pattern, sizeof(pattern), "site\\d+x%04d", i); break;
+    }
+    rules[i] = re_compile(pattern);
+  }
+
+  // one rule after another
+  printf("(%s)\t%s\t%.1f sec\t(%u rules)",
+	 "regex", "match", target_sec, (unsigned int)NUM_COMMUNITY_RULES);
+  fflush(stdout);
+  tdiff = 0;
+  num_names = 0;
+  num_matches = 0;
+  gettimeofday( &t1, NULL );
+
+  while(tdiff < target_usec) {
+    const char *name = names[num_names % num_test_names];
+    for(i = 0; i < NUM_COMMUNITY_RULES; i++) {
+      if((re_matchp(rules[i], name, &match_length) == 0) && (match_length == strlen(name))) {
+        num_matches++;
+        break;
+      }
+    }
+    num_names++;
+    if (!(num_names & 63)) {
+      gettimeofday( &t2, NULL );
+      tdiff = ((t2.tv_sec - t1.tv_sec) * 1000000) + (t2.tv_usec - t1.tv_usec);
+    }
+  }
+  mpps = num_names / (tdiff / 1e6) / 1e6;
+  printf(" ---> (%u matches)\t%12u names\t%8.1f Knames/s\n",
+	 (unsigned int)num_matches, (unsigned int)num_names, mpps * 1e3);
+
+  // all rules compiled into one automaton
+  gettimeofday( &t1, NULL );
+  rule_set = re_set_compile(rules, NUM_COMMUNITY_RULES);
+  gettimeofday( &t2, NULL );
+  tdiff = ((t2.tv_sec - t1.tv_sec) * 1000000) + (t2.tv_usec - t1.tv_usec);
+  printf("(%s)\t%s\t%.1f sec\t(%u rules)",
+	 "regex", "set", target_sec, (unsigned int)NUM_COMMUNITY_RULES);
+  printf(" [compiled in %.1f ms]", tdiff / 1e3);
+  fflush(stdout);
+  tdiff = 0;
+  num_names = 0;
+  num_matches = 0;
+  gettimeofday( &t1, NULL );
+
+  while(tdiff < target_usec) {
+    num_matches += re_set_matchp(rule_set, names[num_names % num_test_names]);
+    num_names++;
+    if (!(num_names & PACKETS_BEFORE_GETTIME)) {
+      gettimeofday( &t2, NULL );
+      tdiff = ((t2.tv_sec - t1.tv_sec) * 1000000) + (t2.tv_usec - t1.tv_usec);
+    }
+  }
+  mpps = num_names / (tdiff / 1e6) / 1e6;
+  printf(" ---> (%u matches)\t%12u names\t%8.1f Knames/s\n",
+	 (unsigned int)num_matches, (unsigned int)num_names, mpps * 1e3);
+  printf("\n");
+
+  re_set_free(rule_set);
+  for(i = 0; i < NUM_COMMUNITY_RULES; i++)
+    free(rules[i]);
+  free(rules);
+}
+
+// --- mac lookup benchmark ---------------------------------------------------------------
+
+// just what uthash needs to find peers, keeps the memory footprint at one million entries low
+struct bench_peer {
+  n2n_mac_t mac_addr;
+  UT_hash_handle hh;
+};
+
+static void run_mac_lookup_benchmark(uint32_t num_entries) {
+  const float target_sec = DURATION;
+  struct timeval t1;
+  struct timeval t2;
+  ssize_t target_usec = target_sec * 1e6;
+  ssize_t tdiff; // microseconds
+  size_t num_lookups;
+  size_t num_found;
+  struct bench_peer *peers, *head = NULL, *found;
+  mac_table_t table;
+  uint32_t *order;
+  uint64_t r;
+  uint32_t i;
+
+  peers = (struct bench_peer*)calloc(num_entries, sizeof(struct bench_peer));
+  order = (uint32_t*)calloc(num_entries, sizeof(uint32_t));
+  if(!peers || !order) {
+    free(peers);
+    free(order);
+    return;
+  }
+  mac_table_init(&table);
+
+  for(i = 0; i < num_entries; i++) {
+    r = n2n_rand();
+    memcpy(peers[i].mac_addr, &r, sizeof(n2n_mac_t));
+    peers[i].mac_addr[0] &= 0xfe; // unicast
+    peers[i].mac_addr[1] = i >> 16; // unique
+    peers[i].mac_addr[2] = i >> 8;
+    peers[i].mac_addr[3] = i;
+    HASH_ADD_PEER(head, &peers[i]);
+    // the table never dereferences the peer, it just stores the pointer
+    mac_table_add(&table, peers[i].mac_addr, (struct peer_info*)&peers[i]);
+    order[i] = i;
+  }
+  // look up in random order
+  for(i = num_entries - 1; i > 0; i--) {
+    uint32_t j = n2n_rand() % (i + 1);
+    uint32_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  // uthash
+  printf("(%s)\t%s\t%.1f sec\t(%u entries)",
+	 "uthash", "find", target_sec, (unsigned int)num_entries);
+  fflush(stdout);
+  tdiff = 0;
+  num_lookups = 0;
+  num_found = 0;
+  gettimeofday( &t1, NULL );
+
+  while(tdiff < target_usec) {
+    HASH_FIND_PEER(head, peers[order[num_lookups % num_entries]].mac_addr, found);
+    num_found += (found != NULL);
+    num_lookups++;
+    if (!(num_lookups & PACKETS_BEFORE_GETTIME)) {
+      gettimeofday( &t2, NULL );
+      tdiff = ((t2.tv_sec - t1.tv_sec) * 1000000) + (t2.tv_usec - t1.tv_usec);
+    }
+  }
+  printf(" ---> (%u found)\t%12u lookups\t%8.1f ns/lookup\n",
+	 (unsigned int)(num_found == num_lookups), (unsigned int)num_lookups, tdiff * 1e3 / num_lookups);
+
+  // mac table
+  printf("(%s)\t%s\t%.1f sec\t(%u entries)",
+	 "mactbl", "find", target_sec, (unsigned int)num_entries);
+  fflush(stdout);
+  tdiff = 0;
+  num_lookups = 0;
+  num_found = 0;
+  gettimeofday( &t1, NULL );
+
+  while(tdiff < target_usec) {
+    found = (struct bench_peer*)mac_table_find(&table, peers[order[num_lookups % num_entries]].mac_addr);
+    num_found += (found != NULL);
+    num_lookups++;
+    if (!(num_lookups & PACKETS_BEFORE_GETTIME)) {
+      gettimeofday( &t2, NULL );
+      tdiff = ((t2.tv_sec - t1.tv_sec) * 1000000) + (t2.tv_usec - t1.tv_usec);
+    }
+  }
+  printf(" ---> (%u found)\t%12u lookups\t%8.1f ns/lookup\n",
+	 (unsigned int)(num_found == num_lookups), (unsigned int)num_lookups, tdiff * 1e3 / num_lookups);
+
+  HASH_CLEAR(hh, head);
+  mac_table_free(&table);
+  free(peers);
+  free(order);
+}
+
+// --- packet header codec benchmark -----------------------------------------------------
+
+static void run_packet_header_benchmark(int with_sock) {
+  const float target_sec = DURATION;
+  struct timeval t1;
+  struct timeval t2;
+  ssize_t target_usec = target_sec * 1e6;
+  ssize_t tdiff; // microseconds
+  size_t num_headers;
+  uint8_t buf[64], fastbuf[64];
+  size_t idx, fastidx, rem;
+  n2n_common_t cmn, dcmn;
+  n2n_PACKET_t pkt, dpkt;
+  uint32_t check;
+  int step;
+
+  memset(&cmn, 0, sizeof(cmn));
+  cmn.ttl = N2N_DEFAULT_TTL;
+  cmn.pc = n2n_packet;
+  strncpy((char*)cmn.community, "abc123def456", N2N_COMMUNITY_SIZE);
+
+  memset(&pkt, 0, sizeof(pkt));
+  memcpy(pkt.srcMac, "\x02\x01\x02\x03\x04\x05", N2N_MAC_SIZE);
+  memcpy(pkt.dstMac, "\x02\x05\x04\x03\x02\x01", N2N_MAC_SIZE);
+  pkt.transform = N2N_TRANSFORM_ID_AES;
+  if(with_sock) {
+    // as re-encoded by the supernode
+    cmn.flags = N2N_FLAGS_SOCKET | N2N_FLAGS_FROM_SUPERNODE;
+    pkt.sock.family = AF_INET;
+    pkt.sock.port = 7654;
+    memcpy(pkt.sock.addr.v4, "\xc0\xa8\x01\x02", IPV4_SIZE);
+  }
+
+  // zeroed padding for the comparisons below
+  memset(&dcmn, 0, sizeof(dcmn));
+  memset(&dpkt, 0, sizeof(dpkt));
+
+  idx = 0;
+  encode_PACKET(buf, &idx, &cmn, &pkt);
+
+  for(step = 0; step < 4; step++) {
+    printf("(%s)\t%s\t%.1f sec\t(%u bytes)",
+	   (step & 1) ? "fast" : "generic", (step & 2) ? "decode" : "encode", target_sec, (unsigned int)idx);
+    fflush(stdout);
+    tdiff = 0;
+    num_headers = 0;
+    check = 0;
+    gettimeofday( &t1, NULL );
+
+    while(tdiff < target_usec) {
+      switch(step) {
+        case 0:
+          fastidx = 0;
+          encode_PACKET(fastbuf, &fastidx, &cmn, &pkt);
+          check += fastbuf[num_headers & 31];
+          break;
+        case 1:
+          fastidx = 0;
+          encode_PACKET_fast(fastbuf, &fastidx, &cmn, &pkt);
+          check += fastbuf[num_headers & 31];
+          break;
+        default:
+          rem = idx;
+          fastidx = 0;
+          decode_common(&dcmn, buf, &rem, &fastidx);
+          if(step == 2)
+            decode_PACKET(&dpkt, &dcmn, buf, &rem, &fastidx);
+          else
+            decode_PACKET_fast(&dpkt, &dcmn, buf, &rem, &fastidx);
+          check += dpkt.dstMac[num_headers % N2N_MAC_SIZE];
+      }
+      num_headers++;
+      if (!(num_headers & PACKETS_BEFORE_GETTIME)) {
+        gettimeofday( &t2, NULL );
+        tdiff = ((t2.tv_sec - t1.tv_sec) * 1000000) + (t2.tv_usec - t1.tv_usec);
+      }
+    }
+    printf(" %s (%s sock)\t%12u headers\t%8.1f ns/header\t(%08x)\n",
+	   (step & 2) ? "<---" : "--->", with_sock ? "v4" : "no",
+	   (unsigned int)num_headers, tdiff * 1e3 / num_headers, check);
+
+    if((step < 2) ? ((fastidx != idx) || memcmp(fastbuf, buf, idx))
+                  : ((fastidx != idx) || memcmp(&dpkt, &pkt, sizeof(pkt)) || memcmp(&dcmn, &cmn, sizeof(cmn))))
+      printf("\theader codec mismatch!\n");
+  }
+}
+
 // --- cipher benchmark -------------------------------------------------------------------
 
 static void run_transop_benchmark(const char *op_name, n2n_trans_op_t *op_fn, n2n_edge_conf_t *conf, uint8_t *pktbuf) {